@@ -46,6 +46,8 @@ SPINLOCK_INLINE
 spinlock_data_t spinlock_data_get(volatile spinlock_data_t *sd);
 SPINLOCK_INLINE
 spinlock_data_t spinlock_data_testandset(volatile spinlock_data_t *sd);
+SPINLOCK_INLINE
+spinlock_data_t spinlock_data_fetchinc(volatile spinlock_data_t *sd);
 
 ////////////////////////////////////////////////////////////
 
@@ -118,5 +120,33 @@ spinlock_data_testandset(volatile spinlock_data_t *sd)
 	return x;
 }
 
+/*
+ * Atomically increment a spinlock_data_t and return its old value,
+ * also with LL/SC (see above). Unlike test-and-set this has to
+ * succeed, so retry until the SC does. The add in between touches
+ * only registers, which is allowed.
+ */
+SPINLOCK_INLINE
+spinlock_data_t
+spinlock_data_fetchinc(volatile spinlock_data_t *sd)
+{
+	spinlock_data_t x;
+	spinlock_data_t y;
+
+	do {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *sd */
+			"addiu %1, %0, 1;"	/*   y = x + 1 */
+			"sc %1, 0(%2);"		/*   *sd = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y) : "r" (sd));
+	} while (y == 0);
+
+	return x;
+}
+
 
 #endif /* _MIPS_SPINLOCK_H_ */
@@ -63,10 +63,10 @@ int tlb_probe(uint32_t entryhi, uint32_t entrylo);
 /*
  * TLB entry fields.
  *
- * Note that the MIPS has support for a 6-bit address space ID. In the
- * interests of simplicity, we don't use it. The fields related to it
- * (TLBLO_GLOBAL and TLBHI_PID) can be left always zero, as can the
- * bits that aren't assigned a meaning.
+ * Note that the MIPS has support for a 6-bit address space ID. dumbvm
+ * doesn't use it and leaves TLBHI_PID zero; the paging VM tags its
+ * entries with it (see vmtlb.c). TLBLO_GLOBAL can be left always
+ * zero, as can the bits that aren't assigned a meaning.
  *
  * The TLBLO_DIRTY bit is actually a write privilege bit - it is not
  * ever set by the processor. If you set it, writes are permitted. If
@@ -78,7 +78,9 @@ int tlb_probe(uint32_t entryhi, uint32_t entrylo);
 
 /* Fields in the high-order word */
 #define TLBHI_VPAGE   0xfffff000
-/*      TLBHI_PID     0x00000fc0 */
+#define TLBHI_PID     0x00000fc0
+#define TLBHI_PIDSHIFT 6
+#define NUM_ASID      64	/* number of distinct TLBHI_PID values */
 
 /* Fields in the low-order word */
 #define TLBLO_PPAGE   0xfffff000
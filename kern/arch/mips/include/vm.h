@@ -113,14 +113,16 @@ paddr_t ram_getfirstfree(void);
 /*
  * TLB shootdown bits.
  *
- * We'll take up to 16 invalidations before just flushing the whole TLB.
+ * The paging VM shoots down whole address spaces: the target cpu
+ * forgets every translation of ts_as and then V's ts_done.
  */
 
+struct addrspace;
+struct semaphore;
+
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	int ts_placeholder;
+	struct addrspace *ts_as;	/* address space to forget */
+	struct semaphore *ts_done;	/* V'd when done */
 };
 
 #define TLBSHOOTDOWN_MAX 16
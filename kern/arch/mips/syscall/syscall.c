@@ -35,6 +35,7 @@
 #include <current.h>
 #include <addrspace.h>
 #include <syscall.h>
+#include <copyinout.h>
 
 
 /*
@@ -110,6 +111,11 @@ syscall(struct trapframe *tf)
 				 (userptr_t)tf->tf_a1);
 		break;
 
+	    case SYS_nanosleep:
+		err = sys_nanosleep((const_userptr_t)tf->tf_a0,
+				    (userptr_t)tf->tf_a1);
+		break;
+
 	    /* Add stuff here */
 #if OPT_C2
 	    case SYS_write:
@@ -122,6 +128,35 @@ syscall(struct trapframe *tf)
 				(userptr_t)tf->tf_a1,
 				(size_t)tf->tf_a2,&err);
                 break;
+	    case SYS_writev:
+	        retval = sys_writev((int)tf->tf_a0,
+				(userptr_t)tf->tf_a1,
+				(int)tf->tf_a2,&err);
+                break;
+	    case SYS_readv:
+	        retval = sys_readv((int)tf->tf_a0,
+				(userptr_t)tf->tf_a1,
+				(int)tf->tf_a2,&err);
+                break;
+	    case SYS_pwrite:
+	    case SYS_pread:
+		/* the 64-bit offset is aligned, so it's on the stack */
+		err = copyin((const_userptr_t)(tf->tf_sp+16), &pos,
+			     sizeof(pos));
+		if (err) {
+			break;
+		}
+		if (callno == SYS_pwrite) {
+			retval = sys_pwrite((int)tf->tf_a0,
+					    (userptr_t)tf->tf_a1,
+					    (size_t)tf->tf_a2, pos, &err);
+		}
+		else {
+			retval = sys_pread((int)tf->tf_a0,
+					   (userptr_t)tf->tf_a1,
+					   (size_t)tf->tf_a2, pos, &err);
+		}
+		break;
 		case SYS_open:
 	        retval = sys_open((userptr_t)tf->tf_a0,
 				  (int)tf->tf_a1,
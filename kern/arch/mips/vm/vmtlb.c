@@ -0,0 +1,182 @@
+/*
+ * MIPS TLB management for the paging VM system (vm/vm.c).
+ *
+ * The MI code asks for four things: switch to an address space,
+ * throw away every translation, load one translation, and drop one
+ * translation.
+ *
+ * Entries are tagged with a 6-bit address space ID (ASID), so
+ * switching address spaces does not require a TLB flush. ASIDs are
+ * handed out per cpu, since each cpu has its own TLB: an address
+ * space's ASID is only good on the cpu that issued it (as_asidcpu)
+ * and only for that cpu's current ASID generation (as_asidgen). When
+ * a cpu runs out of ASIDs it flushes its TLB and starts a new
+ * generation, which implicitly revokes every ASID it handed out
+ * before. An address space that moves to another cpu, or whose
+ * mappings must all be dropped (vmtlb_flushas), simply gets a fresh
+ * ASID, which leaves any old entries unreachable. ASID 0 is never
+ * issued; it tags the invalid entries written by a flush.
+ *
+ * When the TLB is full, victims are chosen round-robin per cpu
+ * (c_tlbvictim). The MIPS TLB has no referenced bit, so there is
+ * nothing for a second-chance scheme to go on, and round-robin at
+ * least never throws out the entry that was just loaded.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <mips/tlb.h>
+#include <addrspace.h>
+#include <vm.h>
+
+/*
+ * The hardware matches TLB entries against the ASID in the EntryHi
+ * register, which tlb_read and a flush clobber. Put it back.
+ */
+#define SET_ENTRYHI(x) __asm volatile("mtc0 %0,$10" :: "r" (x))
+
+/* EntryHi for VADDR in the current address space. Interrupts off. */
+#define CUR_ENTRYHI(vaddr) \
+	((vaddr) | (curcpu->c_curasid << TLBHI_PIDSHIFT))
+
+/*
+ * Invalidate the whole TLB on this CPU. Call with interrupts off.
+ */
+static
+void
+vmtlb_flush_all(void)
+{
+	int i;
+
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	curcpu->c_tlbinvalidations++;
+	curcpu->c_tlbvictim = 0;
+	SET_ENTRYHI(CUR_ENTRYHI(0));
+}
+
+/*
+ * Make AS the address space the TLB translates for on this cpu,
+ * giving it a new ASID if its old one is not valid here.
+ */
+void
+vmtlb_activate(struct addrspace *as)
+{
+	struct cpu *c;
+	int spl;
+
+	spl = splhigh();
+	c = curcpu->c_self;
+
+	if (as->as_asidcpu != c || as->as_asidgen != c->c_asidgen) {
+		if (c->c_asidnext == NUM_ASID) {
+			/* Out of ASIDs: start a new generation. */
+			c->c_asidgen++;
+			c->c_asidnext = 1;
+			vmtlb_flush_all();
+		}
+		as->as_asid = c->c_asidnext++;
+		as->as_asidgen = c->c_asidgen;
+		as->as_asidcpu = c;
+	}
+
+	c->c_curas = as;
+	c->c_curasid = as->as_asid;
+	SET_ENTRYHI(CUR_ENTRYHI(0));
+
+	splx(spl);
+}
+
+/*
+ * Revoke AS's ASID, so that none of the translations it may have in
+ * any TLB can be used again. If AS is active on this cpu it is
+ * reactivated with a fresh ASID. (If it is active on another cpu,
+ * that cpu must call this too; see vm_shootdown.)
+ */
+void
+vmtlb_flushas(struct addrspace *as)
+{
+	int spl;
+
+	spl = splhigh();
+	as->as_asidcpu = NULL;
+	if (curcpu->c_curas == as) {
+		vmtlb_activate(as);
+	}
+	splx(spl);
+}
+
+/*
+ * Invalidate the whole TLB on this CPU.
+ */
+void
+vmtlb_flush(void)
+{
+	int spl;
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+	vmtlb_flush_all();
+	splx(spl);
+}
+
+/*
+ * Load the translation VADDR -> ELO for the current address space.
+ * If VADDR is already in the TLB (e.g. the page was read-only and is
+ * now writable) overwrite it; otherwise replace the next round-robin
+ * slot. After a flush the victim pointer sweeps through invalid
+ * slots first, so there is no need to search for a free one.
+ */
+void
+vmtlb_load(vaddr_t vaddr, uint32_t elo)
+{
+	uint32_t ehi, oehi, oelo;
+	int i, spl;
+
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+
+	spl = splhigh();
+
+	ehi = CUR_ENTRYHI(vaddr);
+	i = tlb_probe(ehi, 0);
+	if (i >= 0) {
+		tlb_write(ehi, elo, i);
+		splx(spl);
+		return;
+	}
+
+	i = curcpu->c_tlbvictim;
+	curcpu->c_tlbvictim = (i + 1) % NUM_TLB;
+	tlb_read(&oehi, &oelo, i);
+	if (oelo & TLBLO_VALID) {
+		curcpu->c_tlbevictions++;
+	}
+	tlb_write(ehi, elo, i);
+
+	splx(spl);
+}
+
+/*
+ * Drop the translation for VADDR in the current address space from
+ * this CPU's TLB, if present.
+ */
+void
+vmtlb_invalidate(vaddr_t vaddr)
+{
+	int i, spl;
+
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+
+	spl = splhigh();
+	i = tlb_probe(CUR_ENTRYHI(vaddr), 0);
+	if (i >= 0) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+		curcpu->c_tlbinvalidations++;
+		SET_ENTRYHI(CUR_ENTRYHI(0));
+	}
+	splx(spl);
+}
@@ -53,12 +53,27 @@
  */
 #define CPU_FREQUENCY 25000000 /* 25 MHz */
 
+/* Cycles per hardclock. */
+#define TICK_CYCLES (CPU_FREQUENCY / HZ)
+
+/*
+ * Longest an idle cpu leaves the timer off for, in ticks, even with
+ * nothing to do. Just a safety net.
+ */
+#define IDLE_MAXTICKS HZ
+
+/* Wiring of LAMEbus interrupts to bits in the cause register */
+#define LAMEBUS_IRQ_BIT  0x00000400	/* all system bus slots */
+#define LAMEBUS_IPI_BIT  0x00000800	/* inter-processor interrupt */
+#define MIPS_TIMER_BIT   0x00008000	/* on-chip timer */
+
 /*
  * Access to the on-chip timer.
  *
  * The c0_count register increments on every cycle; when the value
  * matches the c0_compare register, the timer interrupt line is
- * asserted. Writing to c0_compare again clears the interrupt.
+ * asserted and (on System/161) c0_count starts again from 0. Writing
+ * to c0_compare again clears the interrupt.
  */
 static
 void
@@ -76,6 +91,147 @@ mips_timer_set(uint32_t count)
 		:: "r" (count));
 }
 
+static
+uint32_t
+mips_timer_get(void)
+{
+	uint32_t count;
+
+	/* $9 == c0_count */
+	__asm volatile("mfc0 %0, $9" : "=r" (count));
+	return count;
+}
+
+static
+uint32_t
+mips_cause_get(void)
+{
+	uint32_t cause;
+
+	/* $13 == c0_cause */
+	__asm volatile("mfc0 %0, $13" : "=r" (cause));
+	return cause;
+}
+
+/*
+ * Count cycles: the hardclocks so far, plus the on-chip counter, which
+ * runs from 0 since the last one (less any of it already made up as
+ * hardclocks after tickless idle).
+ */
+uint32_t
+cpu_cycles(void)
+{
+	unsigned ticks;
+	uint32_t count;
+	int spl;
+
+	spl = splhigh();
+	ticks = curcpu->c_hardclocks;
+	count = mips_timer_get();
+	if (mips_cause_get() & MIPS_TIMER_BIT) {
+		/* the counter restarted, but hardclock hasn't run yet */
+		ticks++;
+		count = mips_timer_get();
+	}
+	else {
+		count -= curcpu->c_timerskew;
+	}
+	splx(spl);
+
+	return ticks * TICK_CYCLES + count;
+}
+
+/*
+ * Tickless idle. Rather than wake up every tick for nothing, an idle
+ * cpu sets the timer to go off only when the next callout is due.
+ * Since the counter restarts at each timer interrupt and keeps
+ * running until the next, it still counts from the last real tick,
+ * so if some other interrupt wakes us first we can tell from it how
+ * many ticks went by.
+ */
+void
+mainbus_idle_timer(unsigned ticks)
+{
+	KASSERT(curthread->t_curspl > 0);
+
+	if (curcpu->c_idleticks > 0) {
+		/* still stretched; cpu_idle returned without an interrupt */
+		return;
+	}
+	if (ticks > IDLE_MAXTICKS) {
+		ticks = IDLE_MAXTICKS;
+	}
+	if (ticks <= 1) {
+		return;
+	}
+	if (mips_cause_get() & MIPS_TIMER_BIT) {
+		/* a tick is already due; don't lose it */
+		return;
+	}
+	if (curcpu->c_timerskew > 0) {
+		/*
+		 * Woken early last time, and the counter hasn't been
+		 * restarted since; wait for the next tick to line it
+		 * up again, or the ticks would be counted wrong.
+		 */
+		return;
+	}
+
+	curcpu->c_idleticks = ticks;
+	mips_timer_set(ticks * TICK_CYCLES);
+}
+
+/*
+ * Called on each interrupt that is either from the timer or comes
+ * while the timer is stretched. Put the timer back to interrupting
+ * once a tick, and return how many hardclocks are owed. *SKEW gets
+ * how much of the counter they account for, if it wasn't restarted.
+ */
+static
+unsigned
+mips_timer_ticks(uint32_t cause, uint32_t *skew)
+{
+	unsigned ticks;
+	uint32_t count;
+
+	*skew = 0;
+
+	ticks = curcpu->c_idleticks;
+	if (ticks == 0) {
+		/* an ordinary tick */
+		mips_timer_set(TICK_CYCLES);
+		return 1;
+	}
+	curcpu->c_idleticks = 0;
+
+	/* (the timer may also have gone off since the trap) */
+	if ((cause | mips_cause_get()) & MIPS_TIMER_BIT) {
+		/* slept the whole way */
+		mips_timer_set(TICK_CYCLES);
+		return ticks;
+	}
+
+	/*
+	 * Woken early; keep the timer in step with the old ticks by
+	 * setting it for the next tick boundary. If the counter gets
+	 * past that before the compare register is written, there'd
+	 * be no interrupt until it wraps, so check and try again.
+	 * (If it reaches it just after, the interrupt is pending and
+	 * the counter restarts, which is fine.)
+	 */
+	count = mips_timer_get();
+	while (1) {
+		ticks = count / TICK_CYCLES;
+		mips_timer_set((ticks + 1) * TICK_CYCLES);
+		count = mips_timer_get();
+		if (count < (ticks + 1) * TICK_CYCLES) {
+			break;
+		}
+	}
+	*skew = ticks * TICK_CYCLES;
+	return ticks;
+}
+
 /*
  * LAMEbus data for the system. (We have only one LAMEbus per system.)
  * This does not need to be locked, because it's constant once
@@ -116,7 +272,7 @@ mainbus_bootstrap(void)
 	/*
 	 * Configure the MIPS on-chip timer to interrupt HZ times a second.
 	 */
-	mips_timer_set(CPU_FREQUENCY / HZ);
+	mips_timer_set(TICK_CYCLES);
 }
 
 /*
@@ -288,22 +444,30 @@ mainbus_debugger(void)
 /*
  * Interrupt dispatcher.
  */
-
-/* Wiring of LAMEbus interrupts to bits in the cause register */
-#define LAMEBUS_IRQ_BIT  0x00000400	/* all system bus slots */
-#define LAMEBUS_IPI_BIT  0x00000800	/* inter-processor interrupt */
-#define MIPS_TIMER_BIT   0x00008000	/* on-chip timer */
-
 void
 mainbus_interrupt(struct trapframe *tf)
 {
-	uint32_t cause;
+	uint32_t cause, skew;
+	unsigned ticks;
 	bool seen = false;
 
 	/* interrupts should be off */
 	KASSERT(curthread->t_curspl > 0);
 
 	cause = tf->tf_cause;
+	if ((cause & MIPS_TIMER_BIT) || curcpu->c_idleticks > 0) {
+		/*
+		 * Do the clock first, so anything else sees the right
+		 * time. After tickless idle, make up the missed ticks.
+		 */
+		ticks = mips_timer_ticks(cause, &skew);
+		while (ticks > 0) {
+			hardclock();
+			ticks--;
+		}
+		curcpu->c_timerskew = skew;
+		seen = (cause & MIPS_TIMER_BIT) != 0;
+	}
 	if (cause & LAMEBUS_IRQ_BIT) {
 		lamebus_interrupt(lamebus);
 		seen = true;
@@ -313,13 +477,6 @@ mainbus_interrupt(struct trapframe *tf)
 		lamebus_clear_ipi(lamebus, curcpu);
 		seen = true;
 	}
-	if (cause & MIPS_TIMER_BIT) {
-		/* Reset the timer (this clears the interrupt) */
-		mips_timer_set(CPU_FREQUENCY / HZ);
-		/* and call hardclock */
-		hardclock();
-		seen = true;
-	}
 
 	if (!seen) {
 		if ((cause & CCA_IRQS) == 0) {
@@ -49,6 +49,7 @@
 #include <uio.h>
 #include <membar.h>
 #include <synch.h>
+#include <slab.h>
 #include <lamebus/emu.h>
 #include <platform/bus.h>
 #include <vfs.h>
@@ -261,6 +262,28 @@ emu_close(struct emu_softc *sc, uint32_t handle)
 	return result;
 }
 
+/*
+ * User buffers are copied through a kernel buffer outside e_lock:
+ * touching user memory can fault, and paging in reads from a file,
+ * quite possibly one on this device.
+ */
+static
+char *
+emu_bounce(struct uio *uio, uint32_t len, int *result)
+{
+	char *bounce;
+
+	*result = 0;
+	if (uio->uio_segflg == UIO_SYSSPACE) {
+		return NULL;
+	}
+	bounce = kmalloc(len);
+	if (bounce == NULL) {
+		*result = ENOMEM;
+	}
+	return bounce;
+}
+
 /*
  * Common code for read and readdir.
  */
@@ -269,6 +292,9 @@ int
 emu_doread(struct emu_softc *sc, uint32_t handle, uint32_t len,
 	   uint32_t op, struct uio *uio)
 {
+	char *bounce;
+	uint32_t got;
+	off_t newoffset;
 	int result;
 
 	KASSERT(uio->uio_rw == UIO_READ);
@@ -278,6 +304,11 @@ emu_doread(struct emu_softc *sc, uint32_t handle, uint32_t len,
 		return 0;
 	}
 
+	bounce = emu_bounce(uio, len, &result);
+	if (result) {
+		return result;
+	}
+
 	lock_acquire(sc->e_lock);
 
 	emu_wreg(sc, REG_HANDLE, handle);
@@ -290,12 +321,27 @@ emu_doread(struct emu_softc *sc, uint32_t handle, uint32_t len,
 	}
 
 	membar_load_load();
-	result = uiomove(sc->e_iobuf, emu_rreg(sc, REG_IOLEN), uio);
+	got = emu_rreg(sc, REG_IOLEN);
+	if (bounce == NULL) {
+		result = uiomove(sc->e_iobuf, got, uio);
+		uio->uio_offset = emu_rreg(sc, REG_OFFSET);
+		goto out;
+	}
+
+	memcpy(bounce, sc->e_iobuf, got);
+	newoffset = emu_rreg(sc, REG_OFFSET);
+	lock_release(sc->e_lock);
 
-	uio->uio_offset = emu_rreg(sc, REG_OFFSET);
+	result = uiomove(bounce, got, uio);
+	if (result == 0) {
+		uio->uio_offset = newoffset;
+	}
+	kfree(bounce);
+	return result;
 
  out:
 	lock_release(sc->e_lock);
+	kfree(bounce);
 	return result;
 }
 
@@ -329,6 +375,8 @@ int
 emu_write(struct emu_softc *sc, uint32_t handle, uint32_t len,
 	  struct uio *uio)
 {
+	char *bounce;
+	off_t offset;
 	int result;
 
 	KASSERT(uio->uio_rw == UIO_WRITE);
@@ -337,13 +385,31 @@ emu_write(struct emu_softc *sc, uint32_t handle, uint32_t len,
 		return EFBIG;
 	}
 
+	bounce = emu_bounce(uio, len, &result);
+	if (result) {
+		return result;
+	}
+	offset = uio->uio_offset;
+	if (bounce != NULL) {
+		result = uiomove(bounce, len, uio);
+		if (result) {
+			kfree(bounce);
+			return result;
+		}
+	}
+
 	lock_acquire(sc->e_lock);
 
 	emu_wreg(sc, REG_HANDLE, handle);
 	emu_wreg(sc, REG_IOLEN, len);
-	emu_wreg(sc, REG_OFFSET, uio->uio_offset);
+	emu_wreg(sc, REG_OFFSET, offset);
 
-	result = uiomove(sc->e_iobuf, len, uio);
+	if (bounce != NULL) {
+		memcpy(sc->e_iobuf, bounce, len);
+	}
+	else {
+		result = uiomove(sc->e_iobuf, len, uio);
+	}
 	membar_store_store();
 	if (result) {
 		goto out;
@@ -354,6 +420,7 @@ emu_write(struct emu_softc *sc, uint32_t handle, uint32_t len,
 
  out:
 	lock_release(sc->e_lock);
+	kfree(bounce);
 	return result;
 }
 
@@ -529,7 +596,7 @@ emufs_reclaim(struct vnode *v)
 	lock_release(ef->ef_emu->e_lock);
 	vfs_biglock_release();
 
-	kfree(ev);
+	kmem_cache_free(ef->ef_vnodecache, ev);
 	return 0;
 }
 
@@ -1171,7 +1238,7 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 
 	/* Didn't have one; create it */
 
-	ev = kmalloc(sizeof(struct emufs_vnode));
+	ev = kmem_cache_alloc(ef->ef_vnodecache);
 	if (ev==NULL) {
 		lock_release(ef->ef_emu->e_lock);
 		return ENOMEM;
@@ -1185,7 +1252,7 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 	if (result) {
 		lock_release(ef->ef_emu->e_lock);
 		vfs_biglock_release();
-		kfree(ev);
+		kmem_cache_free(ef->ef_vnodecache, ev);
 		return result;
 	}
 
@@ -1195,7 +1262,7 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 		vnode_cleanup(&ev->ev_v);
 		lock_release(ef->ef_emu->e_lock);
 		vfs_biglock_release();
-		kfree(ev);
+		kmem_cache_free(ef->ef_vnodecache, ev);
 		return result;
 	}
 
@@ -1309,9 +1376,18 @@ emufs_addtovfs(struct emu_softc *sc, const char *devname)
 		kfree(ef);
 		return ENOMEM;
 	}
+	ef->ef_vnodecache = kmem_cache_create("emufs_vnode",
+					      sizeof(struct emufs_vnode),
+					      0, NULL);
+	if (ef->ef_vnodecache == NULL) {
+		vnodearray_destroy(ef->ef_vnodes);
+		kfree(ef);
+		return ENOMEM;
+	}
 
 	result = emufs_loadvnode(ef, EMU_ROOTHANDLE, 1, &ef->ef_root);
 	if (result) {
+		kmem_cache_destroy(ef->ef_vnodecache);
 		kfree(ef);
 		return result;
 	}
@@ -1321,6 +1397,7 @@ emufs_addtovfs(struct emu_softc *sc, const char *devname)
 	result = vfs_addfs(devname, &ef->ef_fs);
 	if (result) {
 		VOP_DECREF(&ef->ef_root->ev_v);
+		kmem_cache_destroy(ef->ef_vnodecache);
 		kfree(ef);
 	}
 	return result;
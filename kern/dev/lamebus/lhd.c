@@ -36,7 +36,8 @@
 #include <lib.h>
 #include <uio.h>
 #include <membar.h>
-#include <synch.h>
+#include <spinlock.h>
+#include <wchan.h>
 #include <platform/bus.h>
 #include <vfs.h>
 #include <lamebus/lhd.h>
@@ -95,16 +96,189 @@ int lhd_code_to_errno(struct lhd_softc *lh, int code)
 	return EAGAIN;
 }
 
+////////////////////////////////////////////////////////////
+// Request queue
+
+/*
+ * The queue is kept sorted by sector, and served by a one-way
+ * elevator (C-LOOK): the next request is the first one at or past
+ * where the disk head was left, wrapping around to the lowest sector
+ * when there is none. The LAMEbus disk tells us its rotation speed
+ * but not its layout; sector numbers run track by track, so their
+ * order is the seek order.
+ *
+ * The disk moves one sector per command, through its one-sector
+ * buffer. The interrupt handler starts the next sector (of the same
+ * request, or of the next one) before anything else, so the disk
+ * is never left idle waiting for a thread to be scheduled. Requests
+ * for adjacent sectors, such as the pieces of a large sequential
+ * transfer issued by different threads, come out of the elevator
+ * back to back and are done as one run with no seek in between.
+ */
+
 /*
- * Record that an I/O has completed: save the result and poke the
- * completion semaphore.
+ * Start the next sector. Call with lh_lock held and the disk idle.
+ */
+static
+void
+lhd_start(struct lhd_softc *lh)
+{
+	struct lhd_request *lr, **lrp;
+	uint32_t statval = LHD_WORKING;
+	int result;
+
+	KASSERT(spinlock_do_i_hold(&lh->lh_lock));
+
+	if (lh->lh_cur == NULL) {
+		if (lh->lh_queue == NULL) {
+			return;
+		}
+		/* Pick the next request in elevator order */
+		lrp = &lh->lh_queue;
+		while (*lrp != NULL && (*lrp)->lr_sector < lh->lh_headpos) {
+			lrp = &(*lrp)->lr_next;
+		}
+		if (*lrp == NULL) {
+			/* nothing further out; sweep again from the start */
+			lrp = &lh->lh_queue;
+		}
+		lr = *lrp;
+		*lrp = lr->lr_next;
+		lr->lr_next = NULL;
+		lh->lh_cur = lr;
+	}
+	lr = lh->lh_cur;
+
+	/* If writing, transfer the data to the on-card buffer. */
+	if (lr->lr_uio->uio_rw == UIO_WRITE) {
+		statval |= LHD_ISWRITE;
+		result = uiomove(lh->lh_buf, LHD_SECTSIZE, lr->lr_uio);
+		/* kernel memory; can't fail */
+		KASSERT(result == 0);
+		membar_store_store();
+	}
+
+	/* Tell it what sector we want, and start the operation. */
+	lhd_wreg(lh, LHD_REG_SECT, lr->lr_sector + lr->lr_cursect);
+	lhd_wreg(lh, LHD_REG_STAT, statval);
+}
+
+/*
+ * Report that a request is finished. Not called with lh_lock held,
+ * so the callback may start more I/O.
+ */
+static
+void
+lhd_finish(struct lhd_softc *lh, struct lhd_request *lr, int err)
+{
+	if (lr->lr_done != NULL) {
+		lr->lr_done(lr, err);
+		return;
+	}
+
+	/* Once lr_finished is set the waiter may reuse LR at any time */
+	spinlock_acquire(&lh->lh_lock);
+	lr->lr_result = err;
+	lr->lr_finished = true;
+	wchan_wakeall(lh->lh_wchan, &lh->lh_lock);
+	spinlock_release(&lh->lh_lock);
+}
+
+/*
+ * Record that a sector has been done: if reading, collect the data,
+ * and get the disk started on the next one. If that finished the
+ * request (or it failed), report completion.
  */
 static
 void
 lhd_iodone(struct lhd_softc *lh, int err)
 {
-	lh->lh_result = err;
-	V(lh->lh_done);
+	struct lhd_request *lr, *done = NULL;
+	int result;
+
+	spinlock_acquire(&lh->lh_lock);
+
+	lr = lh->lh_cur;
+	if (lr == NULL) {
+		/* not ours; probably left over from before we attached */
+		spinlock_release(&lh->lh_lock);
+		return;
+	}
+
+	/* If reading, transfer the data out of the on-card buffer. */
+	if (err == 0 && lr->lr_uio->uio_rw == UIO_READ) {
+		membar_load_load();
+		result = uiomove(lh->lh_buf, LHD_SECTSIZE, lr->lr_uio);
+		KASSERT(result == 0);
+	}
+
+	lh->lh_headpos = lr->lr_sector + lr->lr_cursect + 1;
+	lr->lr_cursect++;
+	if (err != 0 || lr->lr_cursect == lr->lr_nsect) {
+		lh->lh_cur = NULL;
+		done = lr;
+	}
+
+	/* Keep the disk busy */
+	lhd_start(lh);
+
+	spinlock_release(&lh->lh_lock);
+
+	if (done != NULL) {
+		lhd_finish(lh, done, err);
+	}
+}
+
+/*
+ * Queue a request. LR must not be touched until it is finished.
+ */
+void
+lhd_submit(struct lhd_softc *lh, struct lhd_request *lr)
+{
+	struct lhd_request **lrp;
+
+	KASSERT(lr->lr_nsect > 0);
+	KASSERT(lr->lr_uio->uio_segflg == UIO_SYSSPACE);
+	KASSERT(lr->lr_uio->uio_resid == lr->lr_nsect * LHD_SECTSIZE);
+
+	lr->lr_cursect = 0;
+	lr->lr_result = 0;
+	lr->lr_finished = false;
+
+	spinlock_acquire(&lh->lh_lock);
+
+	/* Insert in sector order, after any others for the same sector */
+	lrp = &lh->lh_queue;
+	while (*lrp != NULL && (*lrp)->lr_sector <= lr->lr_sector) {
+		lrp = &(*lrp)->lr_next;
+	}
+	lr->lr_next = *lrp;
+	*lrp = lr;
+
+	if (lh->lh_cur == NULL) {
+		/* disk idle; get it going */
+		lhd_start(lh);
+	}
+
+	spinlock_release(&lh->lh_lock);
+}
+
+/*
+ * Wait for a request submitted without a completion function to
+ * finish, and return its result.
+ */
+int
+lhd_wait(struct lhd_softc *lh, struct lhd_request *lr)
+{
+	KASSERT(lr->lr_done == NULL);
+
+	spinlock_acquire(&lh->lh_lock);
+	while (!lr->lr_finished) {
+		wchan_sleep(lh->lh_wchan, &lh->lh_lock);
+	}
+	spinlock_release(&lh->lh_lock);
+
+	return lr->lr_result;
 }
 
 /*
@@ -179,6 +353,70 @@ lhd_reset(struct lhd_softc *lh)
 }
 #endif
 
+/*
+ * Do one request and wait for it.
+ */
+static
+int
+lhd_rw(struct lhd_softc *lh, uint32_t sector, uint32_t nsect,
+       struct uio *uio)
+{
+	struct lhd_request lr;
+
+	lr.lr_sector = sector;
+	lr.lr_nsect = nsect;
+	lr.lr_uio = uio;
+	lr.lr_done = NULL;
+	lr.lr_data = NULL;
+	lhd_submit(lh, &lr);
+	return lhd_wait(lh, &lr);
+}
+
+/*
+ * I/O to or from user memory. The interrupt handler can't get at
+ * it, so go a sector at a time through a kernel buffer.
+ */
+static
+int
+lhd_userio(struct lhd_softc *lh, uint32_t sector, uint32_t nsect,
+	   struct uio *uio)
+{
+	struct iovec iov;
+	struct uio ku;
+	char *kbuf;
+	uint32_t i;
+	int result = 0;
+
+	kbuf = kmalloc(LHD_SECTSIZE);
+	if (kbuf == NULL) {
+		return ENOMEM;
+	}
+
+	for (i=0; i<nsect; i++) {
+		uio_kinit(&iov, &ku, kbuf, LHD_SECTSIZE,
+			  (off_t)(sector+i) * LHD_SECTSIZE, uio->uio_rw);
+		if (uio->uio_rw == UIO_WRITE) {
+			result = uiomove(kbuf, LHD_SECTSIZE, uio);
+			if (result) {
+				break;
+			}
+		}
+		result = lhd_rw(lh, sector+i, 1, &ku);
+		if (result) {
+			break;
+		}
+		if (uio->uio_rw == UIO_READ) {
+			result = uiomove(kbuf, LHD_SECTSIZE, uio);
+			if (result) {
+				break;
+			}
+		}
+	}
+
+	kfree(kbuf);
+	return result;
+}
+
 /*
  * I/O function (for both reads and writes)
  */
@@ -192,9 +430,6 @@ lhd_io(struct device *d, struct uio *uio)
 	uint32_t sectoff = uio->uio_offset % LHD_SECTSIZE;
 	uint32_t len = uio->uio_resid / LHD_SECTSIZE;
 	uint32_t lenoff = uio->uio_resid % LHD_SECTSIZE;
-	uint32_t i;
-	uint32_t statval = LHD_WORKING;
-	int result;
 
 	/* Don't allow I/O that isn't sector-aligned. */
 	if (sectoff != 0 || lenoff != 0) {
@@ -207,61 +442,16 @@ lhd_io(struct device *d, struct uio *uio)
 		return EINVAL;
 	}
 
-	/* Set up the value to write into the status register. */
-	if (uio->uio_rw==UIO_WRITE) {
-		statval |= LHD_ISWRITE;
+	if (len == 0) {
+		return 0;
 	}
 
-	/* Loop over all the sectors we were asked to do. */
-	for (i=0; i<len; i++) {
-
-		/* Wait until nobody else is using the device. */
-		P(lh->lh_clear);
-
-		/*
-		 * Are we writing? If so, transfer the data to the
-		 * on-card buffer.
-		 */
-		if (uio->uio_rw == UIO_WRITE) {
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
-			membar_store_store();
-			if (result) {
-				V(lh->lh_clear);
-				return result;
-			}
-		}
-
-		/* Tell it what sector we want... */
-		lhd_wreg(lh, LHD_REG_SECT, sector+i);
-
-		/* and start the operation. */
-		lhd_wreg(lh, LHD_REG_STAT, statval);
-
-		/* Now wait until the interrupt handler tells us we're done. */
-		P(lh->lh_done);
-
-		/* Get the result value saved by the interrupt handler. */
-		result = lh->lh_result;
-
-		/*
-		 * Are we reading? If so, and if we succeeded,
-		 * transfer the data out of the on-card buffer.
-		 */
-		if (result==0 && uio->uio_rw==UIO_READ) {
-			membar_load_load();
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
-		}
-
-		/* Tell another thread it's cleared to go ahead. */
-		V(lh->lh_clear);
-
-		/* If we failed, return the error. */
-		if (result) {
-			return result;
-		}
+	if (uio->uio_segflg != UIO_SYSSPACE) {
+		return lhd_userio(lh, sector, len, uio);
 	}
 
-	return 0;
+	/* The whole transfer goes to the disk as one request. */
+	return lhd_rw(lh, sector, len, uio);
 }
 
 static const struct device_ops lhd_devops = {
@@ -284,15 +474,14 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 	/* Get a pointer to the on-chip buffer. */
 	lh->lh_buf = bus_map_area(lh->lh_busdata, lh->lh_buspos, LHD_BUFFER);
 
-	/* Create the semaphores. */
-	lh->lh_clear = sem_create("lhd-clear", 1);
-	if (lh->lh_clear == NULL) {
-		return ENOMEM;
-	}
-	lh->lh_done = sem_create("lhd-done", 0);
-	if (lh->lh_done == NULL) {
-		sem_destroy(lh->lh_clear);
-		lh->lh_clear = NULL;
+	/* Set up the request queue. */
+	spinlock_init(&lh->lh_lock);
+	lh->lh_queue = NULL;
+	lh->lh_cur = NULL;
+	lh->lh_headpos = 0;
+	lh->lh_wchan = wchan_create("lhd");
+	if (lh->lh_wchan == NULL) {
+		spinlock_cleanup(&lh->lh_lock);
 		return ENOMEM;
 	}
 
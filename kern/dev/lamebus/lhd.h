@@ -31,12 +31,40 @@
 #define _LAMEBUS_LHD_H_
 
 #include <device.h>
+#include <spinlock.h>
 
 /*
  * Our sector size
  */
 #define LHD_SECTSIZE  512
 
+/*
+ * An I/O request. Requests are queued per disk and started in
+ * elevator order from the interrupt handler, so callers need not
+ * wait for one another, or at all: lhd_submit returns at once and
+ * LR_DONE, if set, is called when the request is finished. It runs
+ * in interrupt context and may not sleep. If LR_DONE is NULL, use
+ * lhd_wait to wait for the request instead.
+ *
+ * LR_UIO must describe LR_NSECT sectors of kernel memory; a read
+ * fills it in and a write takes the data from it. The request
+ * structure belongs to the driver until it is finished.
+ */
+struct lhd_request {
+	/* set up by the caller */
+	uint32_t lr_sector;		/* first sector */
+	uint32_t lr_nsect;		/* number of sectors */
+	struct uio *lr_uio;		/* where the data is */
+	void (*lr_done)(struct lhd_request *, int result);
+	void *lr_data;			/* for lr_done's use */
+
+	/* private to the driver */
+	struct lhd_request *lr_next;	/* queue link */
+	uint32_t lr_cursect;		/* sectors done so far */
+	int lr_result;			/* outcome, for lhd_wait */
+	bool lr_finished;		/* for lhd_wait */
+};
+
 /*
  * Hardware device data associated with lhd (LAMEbus hard disk)
  */
@@ -51,9 +79,11 @@ struct lhd_softc {
 	 */
 
 	void *lh_buf;			/* Pointer to on-card I/O buffer */
-	int lh_result;			/* Result from I/O operation */
-	struct semaphore *lh_clear;	/* Synchronization */
-	struct semaphore *lh_done;
+	struct spinlock lh_lock;	/* Protects the fields below */
+	struct lhd_request *lh_queue;	/* Waiting requests, by sector */
+	struct lhd_request *lh_cur;	/* Request the disk is working on */
+	uint32_t lh_headpos;		/* Sector after the last one done */
+	struct wchan *lh_wchan;		/* For lhd_wait */
 
 	struct device lh_dev;		/* VFS device structure */
 };
@@ -61,4 +91,8 @@ struct lhd_softc {
 /* Functions called by lower-level drivers */
 void lhd_irq(/*struct lhd_softc*/ void *);	/* Interrupt handler */
 
+/* Request queue */
+void lhd_submit(struct lhd_softc *lh, struct lhd_request *lr);
+int lhd_wait(struct lhd_softc *lh, struct lhd_request *lr);
+
 #endif /* _LAMEBUS_LHD_H_ */
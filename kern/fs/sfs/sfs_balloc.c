@@ -35,35 +35,49 @@
 #include <types.h>
 #include <lib.h>
 #include <bitmap.h>
+#include <synch.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
 /*
- * Zero out a disk block.
+ * Zero out a disk block. This only happens in the buffer cache; the
+ * zeros go to disk whenever the block is written back.
  */
 static
 int
 sfs_clearblock(struct sfs_fs *sfs, daddr_t block)
 {
-	/* static -> automatically initialized to zero */
-	static char zeros[SFS_BLOCKSIZE];
+	struct sfs_buf *buf;
+	int result;
 
-	return sfs_writeblock(sfs, block, zeros, SFS_BLOCKSIZE);
+	result = sfs_buf_get(sfs, block, &buf);
+	if (result) {
+		return result;
+	}
+	bzero(sfs_buf_data(buf), SFS_BLOCKSIZE);
+	sfs_buf_markdirty(buf);
+	sfs_buf_release(buf);
+	return 0;
 }
 
 /*
- * Allocate a block.
+ * Allocate a block. The freemap is only locked while choosing it;
+ * nobody else can get the block until we hand it back, so clearing
+ * it can happen afterwards.
  */
 int
 sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock)
 {
 	int result;
 
+	lock_acquire(sfs->sfs_freemaplock);
 	result = bitmap_alloc(sfs->sfs_freemap, diskblock);
 	if (result) {
+		lock_release(sfs->sfs_freemaplock);
 		return result;
 	}
 	sfs->sfs_freemapdirty = true;
+	lock_release(sfs->sfs_freemaplock);
 
 	if (*diskblock >= sfs->sfs_sb.sb_nblocks) {
 		panic("sfs: %s: balloc: invalid block %u\n",
@@ -73,7 +87,7 @@ sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock)
 	/* Clear block before returning it */
 	result = sfs_clearblock(sfs, *diskblock);
 	if (result) {
-		bitmap_unmark(sfs->sfs_freemap, *diskblock);
+		sfs_bfree(sfs, *diskblock);
 	}
 	return result;
 }
@@ -84,8 +98,10 @@ sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock)
 void
 sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock)
 {
+	lock_acquire(sfs->sfs_freemaplock);
 	bitmap_unmark(sfs->sfs_freemap, diskblock);
 	sfs->sfs_freemapdirty = true;
+	lock_release(sfs->sfs_freemaplock);
 }
 
 /*
@@ -94,10 +110,17 @@ sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock)
 int
 sfs_bused(struct sfs_fs *sfs, daddr_t diskblock)
 {
+	int result;
+
 	if (diskblock >= sfs->sfs_sb.sb_nblocks) {
 		panic("sfs: %s: sfs_bused called on out of range block %u\n",
 		      sfs->sfs_sb.sb_volname, diskblock);
 	}
-	return bitmap_isset(sfs->sfs_freemap, diskblock);
+
+	lock_acquire(sfs->sfs_freemaplock);
+	result = bitmap_isset(sfs->sfs_freemap, diskblock);
+	lock_release(sfs->sfs_freemaplock);
+
+	return result;
 }
 
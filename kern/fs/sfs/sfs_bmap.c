@@ -35,6 +35,7 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
 #include <vfs.h>
 #include <sfs.h>
 #include "sfsprivate.h"
@@ -43,31 +44,21 @@
  * Look up the disk block number (from 0 up to the number of blocks on
  * the disk) given a file and the logical block number within that
  * file. If DOALLOC is set, and no such block exists, one will be
- * allocated.
+ * allocated. The vnode must be locked.
  */
 int
 sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 	 daddr_t *diskblock)
 {
-	/*
-	 * I/O buffer for handling indirect blocks.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *idbuf;
+	uint32_t *iddata;
 	daddr_t block;
 	daddr_t idblock;
 	uint32_t idnum, idoff;
 	int result;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
-
-	/* Since we're using a static buffer, we'd better be locked. */
-	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(lock_do_i_hold(sv->sv_lock));
 
 	/*
 	 * If the block we want is one of the direct blocks...
@@ -141,7 +132,7 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		 * There's no indirect block allocated, but we need to
 		 * allocate a block whose number needs to be stored in
 		 * the indirect block. Thus, we need to allocate an
-		 * indirect block.
+		 * indirect block. (sfs_balloc zeroes it for us.)
 		 */
 		result = sfs_balloc(sfs, &idblock);
 		if (result) {
@@ -153,39 +144,33 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 
 		/* Mark the inode dirty */
 		sv->sv_dirty = true;
-
-		/* Clear the indirect block buffer */
-		bzero(idbuf, sizeof(idbuf));
 	}
-	else {
-		/*
-		 * We already have an indirect block allocated; load it.
-		 */
-		result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
-		if (result) {
-			return result;
-		}
+
+	/* Load the indirect block. */
+	result = sfs_buf_read(sfs, idblock, &idbuf);
+	if (result) {
+		return result;
 	}
+	iddata = sfs_buf_data(idbuf);
 
 	/* Get the block out of the indirect block buffer */
-	block = idbuf[idoff];
+	block = iddata[idoff];
 
 	/* If there's no block there, allocate one */
 	if (block==0 && doalloc) {
 		result = sfs_balloc(sfs, &block);
 		if (result) {
+			sfs_buf_release(idbuf);
 			return result;
 		}
 
 		/* Remember the block we allocated */
-		idbuf[idoff] = block;
+		iddata[idoff] = block;
 
-		/* The indirect block is now dirty; write it back */
-		result = sfs_writeblock(sfs, idblock, idbuf, sizeof(idbuf));
-		if (result) {
-			return result;
-		}
+		/* The indirect block is now dirty */
+		sfs_buf_markdirty(idbuf);
 	}
+	sfs_buf_release(idbuf);
 
 	/* Hand back the result and return. */
 	if (block != 0 && !sfs_bused(sfs, block)) {
@@ -198,21 +183,15 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 }
 
 /*
- * Called for ftruncate() and from sfs_reclaim.
+ * Called for ftruncate() and from sfs_reclaim. The vnode must be
+ * locked, or (in sfs_reclaim) unreachable.
  */
 int
 sfs_itrunc(struct sfs_vnode *sv, off_t len)
 {
-	/*
-	 * I/O buffer for handling the indirect block.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *idbuf;
+	uint32_t *iddata;
 
 	/* Length in blocks (divide rounding up) */
 	uint32_t blocklen = DIVROUNDUP(len, SFS_BLOCKSIZE);
@@ -223,10 +202,6 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 	int result;
 	int hasnonzero, iddirty;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
-
-	vfs_biglock_acquire();
-
 	/*
 	 * Go through the direct blocks. Discard any that are
 	 * past the limit we're truncating to.
@@ -253,42 +228,39 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 		/* We're past the proposed EOF; may need to free stuff */
 
 		/* Read the indirect block */
-		result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
+		result = sfs_buf_read(sfs, idblock, &idbuf);
 		if (result) {
-			vfs_biglock_release();
 			return result;
 		}
+		iddata = sfs_buf_data(idbuf);
 
 		hasnonzero = 0;
 		iddirty = 0;
 		for (j=0; j<SFS_DBPERIDB; j++) {
 			/* Discard any blocks that are past the new EOF */
-			if (blocklen < baseblock+j && idbuf[j] != 0) {
-				sfs_bfree(sfs, idbuf[j]);
-				idbuf[j] = 0;
+			if (blocklen < baseblock+j && iddata[j] != 0) {
+				sfs_bfree(sfs, iddata[j]);
+				iddata[j] = 0;
 				iddirty = 1;
 			}
 			/* Remember if we see any nonzero blocks in here */
-			if (idbuf[j]!=0) {
+			if (iddata[j]!=0) {
 				hasnonzero=1;
 			}
 		}
 
+		if (iddirty) {
+			/* The indirect block is dirty */
+			sfs_buf_markdirty(idbuf);
+		}
+		sfs_buf_release(idbuf);
+
 		if (!hasnonzero) {
 			/* The whole indirect block is empty now; free it */
 			sfs_bfree(sfs, idblock);
 			sv->sv_i.sfi_indirect = 0;
 			sv->sv_dirty = true;
 		}
-		else if (iddirty) {
-			/* The indirect block is dirty; write it back */
-			result = sfs_writeblock(sfs, idblock, idbuf,
-						sizeof(idbuf));
-			if (result) {
-				vfs_biglock_release();
-				return result;
-			}
-		}
 	}
 
 	/* Set the file size */
@@ -297,7 +269,6 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 	/* Mark the inode dirty */
 	sv->sv_dirty = true;
 
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -0,0 +1,916 @@
+/*
+ * SFS filesystem
+ *
+ * Buffer cache.
+ *
+ * A fixed pool of SFS_NBUF block buffers, shared by all mounted
+ * volumes, caches inodes, indirect blocks, directories and file
+ * data. Buffers are found by (volume, block) through a hash table;
+ * those nobody holds are kept on an LRU list, and a miss reuses the
+ * least recently used one, writing it out first if it is dirty.
+ * Writes just mark the buffer dirty: it reaches the disk when it is
+ * evicted, when the volume is synced, or when the syncer thread
+ * (sfs_syncer.c) finds it has been dirty for SFS_DIRTY_AGE seconds.
+ * The syncer is also woken early if more than SFS_DIRTY_HIWAT
+ * buffers are dirty. It writes runs of adjacent dirty blocks as one
+ * device request.
+ *
+ * Reads can be clustered the same way with sfs_buf_prefetch, which
+ * brings a run of blocks into the cache in one request, either right
+ * away or, for read-ahead, from a separate thread working through a
+ * small queue. Blocks being prefetched are held, so anyone who needs
+ * one in the meantime waits for it to arrive. Prefetching never
+ * waits for a buffer or writes out a dirty one to make room.
+ *
+ * A buffer is held (pinned) from sfs_buf_read/sfs_buf_get until
+ * sfs_buf_release. Holding is exclusive: anyone else who wants the
+ * same block waits. A held buffer is not on the LRU list and so is
+ * never evicted.
+ *
+ * sfs_buflock protects the hash table, the LRU list, and the state
+ * of every buffer (but not the contents, which belong to the
+ * holder). Buffers are never freed, so a thread woken up from a
+ * buffer's wait channel can always look at it again safely, even if
+ * it now holds some other block.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <vfs.h>
+#include <sfs.h>
+#include "sfsprivate.h"
+
+#define SFS_NBUF	128		/* buffers in the cache */
+#define SFS_BUFHASH	64		/* hash buckets */
+#define SFS_DIRTY_AGE	5		/* seconds before the syncer writes */
+#define SFS_DIRTY_HIWAT	(SFS_NBUF/2)	/* dirty buffers to wake the syncer */
+#define SFS_DIRTY_LOWAT	(SFS_NBUF/4)	/* ...and where it stops */
+#define SFS_CLUSTER	16		/* max blocks per device request */
+#define SFS_RAQUEUE	16		/* queued read-ahead requests */
+
+#define SFS_BUFHASHFN(sfs, block) \
+	((((uintptr_t)(sfs) >> 4) + (block)) % SFS_BUFHASH)
+
+struct sfs_buf {
+	struct sfs_fs *b_fs;		/* volume, or NULL if unused */
+	daddr_t b_block;		/* block number on b_fs */
+	void *b_data;			/* SFS_BLOCKSIZE bytes */
+	struct sfs_buf *b_hashnext;	/* hash chain */
+	struct sfs_buf *b_lrunext;	/* LRU list, if not held */
+	struct sfs_buf *b_lruprev;
+	struct wchan *b_wchan;		/* waiting for the buffer */
+	bool b_held;			/* somebody has it */
+	bool b_dirty;			/* needs writing to disk */
+	time_t b_dirtytime;		/* when it became dirty */
+};
+
+/* A queued read-ahead */
+struct sfs_rareq {
+	struct sfs_fs *ra_fs;
+	daddr_t ra_block;
+	unsigned ra_nblocks;
+};
+
+static struct spinlock sfs_buflock = SPINLOCK_INITIALIZER;
+static struct sfs_buf *sfs_bufs;		/* the pool */
+static struct sfs_buf *sfs_bufhash[SFS_BUFHASH];
+static struct sfs_buf *sfs_lruhead;		/* least recently used */
+static struct sfs_buf *sfs_lrutail;		/* most recently used */
+static struct wchan *sfs_bufwc;			/* waiting for any buffer */
+static struct wchan *sfs_syncwc;		/* the syncer sleeps here */
+static unsigned sfs_ndirty;			/* buffers now dirty */
+
+/* Read-ahead queue, also protected by sfs_buflock */
+static struct sfs_rareq sfs_raqueue[SFS_RAQUEUE];
+static unsigned sfs_rahead, sfs_racount;	/* ring of queued requests */
+static struct sfs_fs *sfs_rabusy;		/* volume being read for */
+static struct wchan *sfs_rawc;			/* read-ahead thread sleeps */
+static struct wchan *sfs_radonewc;		/* waiting for sfs_rabusy */
+
+/* Statistics, protected by sfs_buflock */
+static unsigned sfs_bufhits;
+static unsigned sfs_bufmisses;
+static unsigned sfs_bufevictions;
+static unsigned sfs_bufwrites;
+static unsigned sfs_bufclusters;
+static unsigned sfs_bufclusterblocks;
+static unsigned sfs_bufprefetches;
+static unsigned sfs_bufprefetchblocks;
+static unsigned sfs_bufradropped;
+
+static void sfs_buf_rathread(void *, unsigned long);
+
+////////////////////////////////////////////////////////////
+// Lists
+
+static
+void
+sfs_lru_remove(struct sfs_buf *b)
+{
+	if (b->b_lruprev != NULL) {
+		b->b_lruprev->b_lrunext = b->b_lrunext;
+	}
+	else {
+		sfs_lruhead = b->b_lrunext;
+	}
+	if (b->b_lrunext != NULL) {
+		b->b_lrunext->b_lruprev = b->b_lruprev;
+	}
+	else {
+		sfs_lrutail = b->b_lruprev;
+	}
+	b->b_lrunext = b->b_lruprev = NULL;
+}
+
+static
+void
+sfs_lru_addtail(struct sfs_buf *b)
+{
+	b->b_lrunext = NULL;
+	b->b_lruprev = sfs_lrutail;
+	if (sfs_lrutail != NULL) {
+		sfs_lrutail->b_lrunext = b;
+	}
+	else {
+		sfs_lruhead = b;
+	}
+	sfs_lrutail = b;
+}
+
+static
+void
+sfs_lru_addhead(struct sfs_buf *b)
+{
+	b->b_lruprev = NULL;
+	b->b_lrunext = sfs_lruhead;
+	if (sfs_lruhead != NULL) {
+		sfs_lruhead->b_lruprev = b;
+	}
+	else {
+		sfs_lrutail = b;
+	}
+	sfs_lruhead = b;
+}
+
+static
+struct sfs_buf *
+sfs_hash_find(struct sfs_fs *sfs, daddr_t block)
+{
+	struct sfs_buf *b;
+
+	b = sfs_bufhash[SFS_BUFHASHFN(sfs, block)];
+	for (; b != NULL; b = b->b_hashnext) {
+		if (b->b_fs == sfs && b->b_block == block) {
+			return b;
+		}
+	}
+	return NULL;
+}
+
+static
+void
+sfs_hash_insert(struct sfs_buf *b)
+{
+	unsigned h = SFS_BUFHASHFN(b->b_fs, b->b_block);
+
+	b->b_hashnext = sfs_bufhash[h];
+	sfs_bufhash[h] = b;
+}
+
+static
+void
+sfs_hash_remove(struct sfs_buf *b)
+{
+	struct sfs_buf **bp;
+
+	bp = &sfs_bufhash[SFS_BUFHASHFN(b->b_fs, b->b_block)];
+	for (; *bp != b; bp = &(*bp)->b_hashnext) {
+		KASSERT(*bp != NULL);
+	}
+	*bp = b->b_hashnext;
+	b->b_hashnext = NULL;
+}
+
+////////////////////////////////////////////////////////////
+// Setup
+
+/*
+ * Allocate the buffer pool. Called on every mount; only the first
+ * does anything. (Mounts are serialized by the vfs layer.)
+ */
+void
+sfs_buf_bootstrap(void)
+{
+	unsigned i;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (sfs_bufs != NULL) {
+		return;
+	}
+
+	sfs_bufwc = wchan_create("sfs_buf");
+	sfs_syncwc = wchan_create("sfs_syncer");
+	sfs_rawc = wchan_create("sfs_readahead");
+	sfs_radonewc = wchan_create("sfs_radone");
+	sfs_bufs = kmalloc(SFS_NBUF * sizeof(struct sfs_buf));
+	if (sfs_bufwc == NULL || sfs_syncwc == NULL || sfs_rawc == NULL ||
+	    sfs_radonewc == NULL || sfs_bufs == NULL) {
+		panic("sfs_buf_bootstrap: Out of memory\n");
+	}
+
+	for (i=0; i<SFS_NBUF; i++) {
+		struct sfs_buf *b = &sfs_bufs[i];
+
+		b->b_fs = NULL;
+		b->b_block = 0;
+		b->b_data = kmalloc(SFS_BLOCKSIZE);
+		b->b_wchan = wchan_create("sfs_buf");
+		if (b->b_data == NULL || b->b_wchan == NULL) {
+			panic("sfs_buf_bootstrap: Out of memory\n");
+		}
+		b->b_hashnext = NULL;
+		b->b_held = false;
+		b->b_dirty = false;
+		b->b_dirtytime = 0;
+		sfs_lru_addtail(b);
+	}
+
+	result = thread_fork("sfs_readahead", NULL, sfs_buf_rathread,
+			     NULL, 0);
+	if (result) {
+		panic("sfs_buf_bootstrap: thread_fork: %s\n",
+		      strerror(result));
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Getting and releasing buffers
+
+/*
+ * Write a held buffer to disk.
+ */
+static
+int
+sfs_buf_writeout(struct sfs_buf *b)
+{
+	int result;
+
+	KASSERT(b->b_held);
+	KASSERT(b->b_dirty);
+
+	result = sfs_writeblock(b->b_fs, b->b_block, b->b_data,
+				SFS_BLOCKSIZE);
+	if (result) {
+		return result;
+	}
+
+	spinlock_acquire(&sfs_buflock);
+	b->b_dirty = false;
+	sfs_ndirty--;
+	sfs_bufwrites++;
+	spinlock_release(&sfs_buflock);
+	return 0;
+}
+
+/*
+ * Forget what block a held buffer holds.
+ */
+static
+void
+sfs_buf_discard(struct sfs_buf *b)
+{
+	KASSERT(spinlock_do_i_hold(&sfs_buflock));
+	KASSERT(b->b_held);
+	KASSERT(!b->b_dirty);
+
+	if (b->b_fs != NULL) {
+		sfs_hash_remove(b);
+		b->b_fs = NULL;
+	}
+}
+
+/*
+ * Give up a held buffer. It goes on the LRU list as most recently
+ * used, or if REUSEFIRST as least recently used. Call with
+ * sfs_buflock held.
+ */
+static
+void
+sfs_buf_unhold(struct sfs_buf *b, bool reusefirst)
+{
+	KASSERT(spinlock_do_i_hold(&sfs_buflock));
+	KASSERT(b->b_held);
+
+	b->b_held = false;
+	if (reusefirst) {
+		sfs_lru_addhead(b);
+	}
+	else {
+		sfs_lru_addtail(b);
+	}
+	wchan_wakeall(b->b_wchan, &sfs_buflock);
+	wchan_wakeone(sfs_bufwc, &sfs_buflock);
+}
+
+/*
+ * Get the buffer for BLOCK of SFS, held. If DOREAD, its contents are
+ * read from disk if not already cached; otherwise the caller is about
+ * to overwrite the whole block, and a newly cached block is zeroed
+ * instead (so a write that fails partway doesn't leave garbage).
+ */
+static
+int
+sfs_buf_lookup(struct sfs_fs *sfs, daddr_t block, bool doread,
+	       struct sfs_buf **ret)
+{
+	struct sfs_buf *b;
+	int result;
+
+	KASSERT(sfs_bufs != NULL);
+
+	spinlock_acquire(&sfs_buflock);
+	while (1) {
+		b = sfs_hash_find(sfs, block);
+		if (b != NULL) {
+			if (b->b_held) {
+				wchan_sleep(b->b_wchan, &sfs_buflock);
+				continue;
+			}
+			sfs_lru_remove(b);
+			b->b_held = true;
+			sfs_bufhits++;
+			spinlock_release(&sfs_buflock);
+			*ret = b;
+			return 0;
+		}
+
+		/* Not cached; take the least recently used buffer */
+		b = sfs_lruhead;
+		if (b == NULL) {
+			/* every buffer is held; wait for one */
+			wchan_sleep(sfs_bufwc, &sfs_buflock);
+			continue;
+		}
+		sfs_lru_remove(b);
+		b->b_held = true;
+
+		if (!b->b_dirty) {
+			break;
+		}
+
+		/*
+		 * Dirty; write it out and start over, as someone may
+		 * have brought in our block in the meantime.
+		 */
+		spinlock_release(&sfs_buflock);
+		result = sfs_buf_writeout(b);
+		spinlock_acquire(&sfs_buflock);
+		/* now clean, it's still first in line */
+		sfs_buf_unhold(b, true);
+		if (result) {
+			spinlock_release(&sfs_buflock);
+			return result;
+		}
+	}
+
+	/* Give it its new identity before anyone else can look */
+	if (b->b_fs != NULL) {
+		sfs_hash_remove(b);
+		sfs_bufevictions++;
+	}
+	b->b_fs = sfs;
+	b->b_block = block;
+	sfs_hash_insert(b);
+	sfs_bufmisses++;
+	spinlock_release(&sfs_buflock);
+
+	if (doread) {
+		result = sfs_readblock(sfs, block, b->b_data, SFS_BLOCKSIZE);
+		if (result) {
+			spinlock_acquire(&sfs_buflock);
+			sfs_buf_discard(b);
+			sfs_buf_unhold(b, true);
+			spinlock_release(&sfs_buflock);
+			return result;
+		}
+	}
+	else {
+		bzero(b->b_data, SFS_BLOCKSIZE);
+	}
+
+	*ret = b;
+	return 0;
+}
+
+/*
+ * Get BLOCK of SFS with its contents, held.
+ */
+int
+sfs_buf_read(struct sfs_fs *sfs, daddr_t block, struct sfs_buf **ret)
+{
+	return sfs_buf_lookup(sfs, block, true, ret);
+}
+
+/*
+ * Get BLOCK of SFS, held, to be completely overwritten. If it wasn't
+ * cached, it comes back zeroed rather than read from disk.
+ */
+int
+sfs_buf_get(struct sfs_fs *sfs, daddr_t block, struct sfs_buf **ret)
+{
+	return sfs_buf_lookup(sfs, block, false, ret);
+}
+
+void *
+sfs_buf_data(struct sfs_buf *b)
+{
+	KASSERT(b->b_held);
+	return b->b_data;
+}
+
+/*
+ * Note that a held buffer has been changed. Its age counts from the
+ * first change since it was last written.
+ */
+void
+sfs_buf_markdirty(struct sfs_buf *b)
+{
+	struct timespec now;
+
+	KASSERT(b->b_held);
+
+	/* Only the holder sets b_dirty, so this is safe without the lock */
+	if (b->b_dirty) {
+		return;
+	}
+	gettime(&now);
+
+	spinlock_acquire(&sfs_buflock);
+	b->b_dirty = true;
+	b->b_dirtytime = now.tv_sec;
+	sfs_ndirty++;
+	if (sfs_ndirty > SFS_DIRTY_HIWAT) {
+		wchan_wakeone(sfs_syncwc, &sfs_buflock);
+	}
+	spinlock_release(&sfs_buflock);
+}
+
+/*
+ * Release a held buffer.
+ */
+void
+sfs_buf_release(struct sfs_buf *b)
+{
+	spinlock_acquire(&sfs_buflock);
+	sfs_buf_unhold(b, false);
+	spinlock_release(&sfs_buflock);
+}
+
+/*
+ * Release a held buffer after a write into it failed partway. If it
+ * was clean, it no longer matches the disk and nothing wants what's
+ * in it, so forget it and let the next user read the block afresh.
+ * If it was already dirty, keep it: the part that got written is
+ * counted as written, and the rest is unchanged.
+ */
+void
+sfs_buf_invalidate(struct sfs_buf *b)
+{
+	spinlock_acquire(&sfs_buflock);
+	if (!b->b_dirty) {
+		sfs_buf_discard(b);
+	}
+	sfs_buf_unhold(b, !b->b_dirty);
+	spinlock_release(&sfs_buflock);
+}
+
+////////////////////////////////////////////////////////////
+// Sync and unmount
+
+/*
+ * Write out every dirty buffer of SFS. Buffers that are held are
+ * waited for, so what their holders are doing gets written too.
+ */
+int
+sfs_buf_sync(struct sfs_fs *sfs)
+{
+	struct sfs_buf *b;
+	unsigned i;
+	int result;
+
+	KASSERT(sfs_bufs != NULL);
+
+	for (i=0; i<SFS_NBUF; i++) {
+		b = &sfs_bufs[i];
+
+		spinlock_acquire(&sfs_buflock);
+		while (b->b_fs == sfs && b->b_dirty && b->b_held) {
+			wchan_sleep(b->b_wchan, &sfs_buflock);
+		}
+		if (b->b_fs != sfs || !b->b_dirty) {
+			spinlock_release(&sfs_buflock);
+			continue;
+		}
+		sfs_lru_remove(b);
+		b->b_held = true;
+		spinlock_release(&sfs_buflock);
+
+		result = sfs_buf_writeout(b);
+
+		spinlock_acquire(&sfs_buflock);
+		sfs_buf_unhold(b, false);
+		spinlock_release(&sfs_buflock);
+
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Drop all buffers of SFS, which is going away; anything still dirty
+ * is lost. Nobody may be using the volume.
+ */
+void
+sfs_buf_detach(struct sfs_fs *sfs)
+{
+	struct sfs_rareq ra;
+	struct sfs_buf *b;
+	unsigned i, n;
+
+	KASSERT(sfs_bufs != NULL);
+
+	spinlock_acquire(&sfs_buflock);
+
+	/* Cancel queued read-ahead and wait out any in progress */
+	n = sfs_racount;
+	sfs_racount = 0;
+	for (i=0; i<n; i++) {
+		ra = sfs_raqueue[(sfs_rahead + i) % SFS_RAQUEUE];
+		if (ra.ra_fs != sfs) {
+			sfs_raqueue[(sfs_rahead + sfs_racount) % SFS_RAQUEUE]
+				= ra;
+			sfs_racount++;
+		}
+	}
+	while (sfs_rabusy == sfs) {
+		wchan_sleep(sfs_radonewc, &sfs_buflock);
+	}
+
+	for (i=0; i<SFS_NBUF; i++) {
+		b = &sfs_bufs[i];
+		if (b->b_fs != sfs) {
+			continue;
+		}
+		KASSERT(!b->b_held);
+		sfs_lru_remove(b);
+		b->b_held = true;
+		if (b->b_dirty) {
+			b->b_dirty = false;
+			sfs_ndirty--;
+		}
+		sfs_buf_discard(b);
+		sfs_buf_unhold(b, true);
+	}
+	spinlock_release(&sfs_buflock);
+}
+
+////////////////////////////////////////////////////////////
+// Syncer support
+
+/*
+ * Write back the dirty buffer B together with the dirty buffers
+ * nobody holds on either side of it, up to SFS_CLUSTER blocks, as
+ * one device request. Call with sfs_buflock held; it is dropped
+ * during the I/O.
+ */
+static
+int
+sfs_buf_writecluster(struct sfs_buf *b)
+{
+	struct sfs_buf *run[SFS_CLUSTER], *nb;
+	struct iovec iov[SFS_CLUSTER];
+	struct sfs_fs *sfs;
+	daddr_t first;
+	unsigned n, i;
+	int result;
+
+	KASSERT(spinlock_do_i_hold(&sfs_buflock));
+	KASSERT(!b->b_held);
+	KASSERT(b->b_dirty);
+
+	sfs = b->b_fs;
+
+	/* Find where the run starts... */
+	first = b->b_block;
+	for (n=1; first > 0 && n < SFS_CLUSTER; n++) {
+		nb = sfs_hash_find(sfs, first - 1);
+		if (nb == NULL || nb->b_held || !nb->b_dirty) {
+			break;
+		}
+		first--;
+	}
+
+	/* ...and take it from there, going forward as far as it goes. */
+	for (n=0; n<SFS_CLUSTER; n++) {
+		nb = sfs_hash_find(sfs, first + n);
+		if (nb == NULL || nb->b_held || !nb->b_dirty) {
+			break;
+		}
+		sfs_lru_remove(nb);
+		nb->b_held = true;
+		run[n] = nb;
+		iov[n].iov_kbase = nb->b_data;
+		iov[n].iov_len = SFS_BLOCKSIZE;
+	}
+	KASSERT(n > 0);
+	spinlock_release(&sfs_buflock);
+
+	result = sfs_writeblocks(sfs, first, iov, n);
+
+	spinlock_acquire(&sfs_buflock);
+	for (i=0; i<n; i++) {
+		if (result == 0) {
+			run[i]->b_dirty = false;
+			sfs_ndirty--;
+		}
+		sfs_buf_unhold(run[i], false);
+	}
+	if (result == 0) {
+		sfs_bufwrites += n;
+		sfs_bufclusters++;
+		sfs_bufclusterblocks += n;
+	}
+	return result;
+}
+
+/*
+ * For the syncer: write back every buffer that has been dirty for
+ * SFS_DIRTY_AGE seconds or more, oldest first. If more than
+ * SFS_DIRTY_HIWAT buffers are dirty, keep going with younger ones
+ * until no more than SFS_DIRTY_LOWAT are. Buffers someone holds are
+ * left for next time.
+ */
+void
+sfs_buf_flush(void)
+{
+	struct timespec now;
+	struct sfs_buf *b, *oldest;
+	bool pressure;
+	unsigned i;
+
+	KASSERT(sfs_bufs != NULL);
+
+	gettime(&now);
+
+	spinlock_acquire(&sfs_buflock);
+	pressure = sfs_ndirty > SFS_DIRTY_HIWAT;
+	while (1) {
+		oldest = NULL;
+		for (i=0; i<SFS_NBUF; i++) {
+			b = &sfs_bufs[i];
+			if (!b->b_dirty || b->b_held) {
+				continue;
+			}
+			if (oldest == NULL ||
+			    b->b_dirtytime < oldest->b_dirtytime) {
+				oldest = b;
+			}
+		}
+		if (oldest == NULL) {
+			break;
+		}
+		if (now.tv_sec - oldest->b_dirtytime < SFS_DIRTY_AGE &&
+		    !(pressure && sfs_ndirty > SFS_DIRTY_LOWAT)) {
+			break;
+		}
+		if (sfs_buf_writecluster(oldest)) {
+			/* sfs_rwblock has complained; try again next time */
+			break;
+		}
+	}
+	spinlock_release(&sfs_buflock);
+}
+
+/*
+ * For the syncer: sleep for TICKS hardclocks, or until too many
+ * buffers are dirty.
+ */
+void
+sfs_buf_syncwait(unsigned ticks)
+{
+	KASSERT(sfs_bufs != NULL);
+
+	spinlock_acquire(&sfs_buflock);
+	if (sfs_ndirty <= SFS_DIRTY_HIWAT) {
+		wchan_sleep_timeout(sfs_syncwc, &sfs_buflock, ticks);
+	}
+	spinlock_release(&sfs_buflock);
+}
+
+////////////////////////////////////////////////////////////
+// Prefetching
+
+/*
+ * Bring blocks BLOCK..BLOCK+NBLOCKS-1 of SFS into the cache, reading
+ * each run of blocks that aren't there yet with one device request.
+ * Stops early if there is no clean buffer to spare. Call with
+ * sfs_buflock held; it is dropped during the I/O.
+ */
+static
+int
+sfs_buf_readrun(struct sfs_fs *sfs, daddr_t block, unsigned nblocks)
+{
+	struct sfs_buf *run[SFS_CLUSTER], *b;
+	struct iovec iov[SFS_CLUSTER];
+	unsigned i, n, j;
+	int result;
+
+	KASSERT(spinlock_do_i_hold(&sfs_buflock));
+
+	i = 0;
+	while (i < nblocks) {
+		if (sfs_hash_find(sfs, block + i) != NULL) {
+			/* cached, or on its way */
+			i++;
+			continue;
+		}
+
+		/* Set up buffers for as many missing blocks as we can */
+		for (n=0; n<SFS_CLUSTER && i+n<nblocks; n++) {
+			if (sfs_hash_find(sfs, block + i + n) != NULL) {
+				break;
+			}
+			b = sfs_lruhead;
+			if (b == NULL || b->b_dirty) {
+				break;
+			}
+			sfs_lru_remove(b);
+			b->b_held = true;
+			if (b->b_fs != NULL) {
+				sfs_hash_remove(b);
+				sfs_bufevictions++;
+			}
+			b->b_fs = sfs;
+			b->b_block = block + i + n;
+			sfs_hash_insert(b);
+			run[n] = b;
+			iov[n].iov_kbase = b->b_data;
+			iov[n].iov_len = SFS_BLOCKSIZE;
+		}
+		if (n == 0) {
+			/* nothing to spare */
+			return 0;
+		}
+		spinlock_release(&sfs_buflock);
+
+		result = sfs_readblocks(sfs, block + i, iov, n);
+
+		spinlock_acquire(&sfs_buflock);
+		for (j=0; j<n; j++) {
+			if (result) {
+				sfs_buf_discard(run[j]);
+			}
+			sfs_buf_unhold(run[j], result != 0);
+		}
+		if (result) {
+			return result;
+		}
+		sfs_bufprefetches++;
+		sfs_bufprefetchblocks += n;
+		i += n;
+	}
+	return 0;
+}
+
+/*
+ * Read-ahead thread: works through the queue left by
+ * sfs_buf_prefetch.
+ */
+static
+void
+sfs_buf_rathread(void *junk1, unsigned long junk2)
+{
+	struct sfs_rareq ra;
+
+	(void)junk1;
+	(void)junk2;
+
+	spinlock_acquire(&sfs_buflock);
+	while (1) {
+		while (sfs_racount == 0) {
+			wchan_sleep(sfs_rawc, &sfs_buflock);
+		}
+		ra = sfs_raqueue[sfs_rahead];
+		sfs_rahead = (sfs_rahead + 1) % SFS_RAQUEUE;
+		sfs_racount--;
+
+		/* Keep sfs_buf_detach from pulling the volume away */
+		sfs_rabusy = ra.ra_fs;
+		/* errors are reported by sfs_rwblock; the reader retries */
+		sfs_buf_readrun(ra.ra_fs, ra.ra_block, ra.ra_nblocks);
+		sfs_rabusy = NULL;
+		wchan_wakeall(sfs_radonewc, &sfs_buflock);
+	}
+}
+
+/*
+ * Get blocks BLOCK..BLOCK+NBLOCKS-1 of SFS into the cache with as few
+ * device requests as possible, as a hint: nothing is held afterwards,
+ * and blocks that can't be read are simply left out. If ASYNC, the
+ * reads are queued for the read-ahead thread (or dropped, if it is
+ * too far behind) and this returns at once.
+ */
+void
+sfs_buf_prefetch(struct sfs_fs *sfs, daddr_t block, unsigned nblocks,
+		 bool async)
+{
+	struct sfs_rareq *ra;
+
+	KASSERT(sfs_bufs != NULL);
+
+	spinlock_acquire(&sfs_buflock);
+	if (!async) {
+		sfs_buf_readrun(sfs, block, nblocks);
+	}
+	else if (sfs_racount == SFS_RAQUEUE) {
+		sfs_bufradropped++;
+	}
+	else {
+		ra = &sfs_raqueue[(sfs_rahead + sfs_racount) % SFS_RAQUEUE];
+		ra->ra_fs = sfs;
+		ra->ra_block = block;
+		ra->ra_nblocks = nblocks;
+		sfs_racount++;
+		wchan_wakeone(sfs_rawc, &sfs_buflock);
+	}
+	spinlock_release(&sfs_buflock);
+}
+
+////////////////////////////////////////////////////////////
+// Statistics
+
+/*
+ * Print buffer cache statistics (the bc menu command).
+ */
+void
+sfs_buf_printstats(void)
+{
+	unsigned hits, misses, evictions, writes, clusters, clusterblocks;
+	unsigned prefetches, prefetchblocks, radropped;
+	unsigned used, dirty, held, i;
+
+	if (sfs_bufs == NULL) {
+		kprintf("sfs: buffer cache not in use (nothing mounted)\n");
+		return;
+	}
+
+	used = dirty = held = 0;
+	spinlock_acquire(&sfs_buflock);
+	for (i=0; i<SFS_NBUF; i++) {
+		if (sfs_bufs[i].b_fs != NULL) {
+			used++;
+		}
+		if (sfs_bufs[i].b_dirty) {
+			dirty++;
+		}
+		if (sfs_bufs[i].b_held) {
+			held++;
+		}
+	}
+	hits = sfs_bufhits;
+	misses = sfs_bufmisses;
+	evictions = sfs_bufevictions;
+	writes = sfs_bufwrites;
+	clusters = sfs_bufclusters;
+	clusterblocks = sfs_bufclusterblocks;
+	prefetches = sfs_bufprefetches;
+	prefetchblocks = sfs_bufprefetchblocks;
+	radropped = sfs_bufradropped;
+	spinlock_release(&sfs_buflock);
+
+	kprintf("sfs buffer cache: %u buffers, %u in use, %u dirty, "
+		"%u held\n", SFS_NBUF, used, dirty, held);
+	kprintf("    %u hits, %u misses", hits, misses);
+	if (hits + misses > 0) {
+		kprintf(" (%u%% hit rate)",
+			(unsigned)((hits * 100ULL) / (hits + misses)));
+	}
+	kprintf("\n    %u evictions, %u blocks written back\n",
+		evictions, writes);
+	kprintf("    %u syncer writes of %u blocks", clusters, clusterblocks);
+	if (clusters > 0) {
+		kprintf(" (%u.%u blocks per write)",
+			clusterblocks / clusters,
+			(clusterblocks * 10 / clusters) % 10);
+	}
+	kprintf("\n    %u prefetch reads of %u blocks, %u read-aheads "
+		"dropped\n", prefetches, prefetchblocks, radropped);
+}
@@ -31,6 +31,8 @@
  * SFS filesystem
  *
  * Directory I/O
+ *
+ * Everything here is called with the directory's sv_lock held.
  */
 #include <types.h>
 #include <kern/errno.h>
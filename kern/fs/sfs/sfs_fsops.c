@@ -38,9 +38,11 @@
 #include <lib.h>
 #include <array.h>
 #include <bitmap.h>
+#include <synch.h>
 #include <uio.h>
 #include <vfs.h>
 #include <device.h>
+#include <slab.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
@@ -106,19 +108,39 @@ sfs_freemapio(struct sfs_fs *sfs, enum uio_rw rw)
 }
 
 /*
- * Sync routine for the vnode table.
+ * Sync routine for the vnode table. This only gets the inodes into
+ * the buffer cache; sfs_sync writes out the cache afterwards.
+ *
+ * Each vnode's lock comes before the table lock, so we can't hold
+ * the table while syncing. Instead take a reference to each vnode in
+ * turn (which keeps it from being reclaimed) and let go of the
+ * table. Vnodes loaded or reclaimed meanwhile may be missed or
+ * visited twice, which is harmless.
  */
 static
 int
 sfs_sync_vnodes(struct sfs_fs *sfs)
 {
-	unsigned i, num;
+	struct vnode *v;
+	struct sfs_vnode *sv;
+	unsigned i;
+
+	for (i=0; ; i++) {
+		lock_acquire(sfs->sfs_vnlock);
+		if (i >= vnodearray_num(sfs->sfs_vnodes)) {
+			lock_release(sfs->sfs_vnlock);
+			break;
+		}
+		v = vnodearray_get(sfs->sfs_vnodes, i);
+		VOP_INCREF(v);
+		lock_release(sfs->sfs_vnlock);
 
-	/* Go over the array of loaded vnodes, syncing as we go. */
-	num = vnodearray_num(sfs->sfs_vnodes);
-	for (i=0; i<num; i++) {
-		struct vnode *v = vnodearray_get(sfs->sfs_vnodes, i);
-		VOP_FSYNC(v);
+		sv = v->vn_data;
+		lock_acquire(sv->sv_lock);
+		sfs_sync_inode(sv);
+		lock_release(sv->sv_lock);
+
+		VOP_DECREF(v);
 	}
 	return 0;
 }
@@ -132,13 +154,16 @@ sfs_sync_freemap(struct sfs_fs *sfs)
 {
 	int result;
 
+	lock_acquire(sfs->sfs_freemaplock);
 	if (sfs->sfs_freemapdirty) {
 		result = sfs_freemapio(sfs, UIO_WRITE);
 		if (result) {
+			lock_release(sfs->sfs_freemaplock);
 			return result;
 		}
 		sfs->sfs_freemapdirty = false;
 	}
+	lock_release(sfs->sfs_freemaplock);
 
 	return 0;
 }
@@ -152,17 +177,44 @@ sfs_sync_superblock(struct sfs_fs *sfs)
 {
 	int result;
 
+	lock_acquire(sfs->sfs_freemaplock);
 	if (sfs->sfs_superdirty) {
 		result = sfs_writeblock(sfs, SFS_SUPER_BLOCK, &sfs->sfs_sb,
 					sizeof(sfs->sfs_sb));
 		if (result) {
+			lock_release(sfs->sfs_freemaplock);
 			return result;
 		}
 		sfs->sfs_superdirty = false;
 	}
+	lock_release(sfs->sfs_freemaplock);
 	return 0;
 }
 
+/*
+ * Periodic sync for the syncer: get dirty inodes into the buffer
+ * cache (where they age like any other block) and write the freemap
+ * and superblock. Call with vfs_biglock held, so the volume can't be
+ * unmounted underneath.
+ */
+int
+sfs_sync_meta(struct sfs_fs *sfs)
+{
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	result = sfs_sync_vnodes(sfs);
+	if (result) {
+		return result;
+	}
+	result = sfs_sync_freemap(sfs);
+	if (result) {
+		return result;
+	}
+	return sfs_sync_superblock(sfs);
+}
+
 /*
  * Sync routine. This is what gets invoked if you do FS_SYNC on the
  * sfs filesystem structure.
@@ -174,8 +226,6 @@ sfs_sync(struct fs *fs)
 	struct sfs_fs *sfs;
 	int result;
 
-	vfs_biglock_acquire();
-
 	/*
 	 * Get the sfs_fs from the generic abstract fs.
 	 *
@@ -211,25 +261,27 @@ sfs_sync(struct fs *fs)
 	/* If any vnodes need to be written, write them. */
 	result = sfs_sync_vnodes(sfs);
 	if (result) {
-		vfs_biglock_release();
+		return result;
+	}
+
+	/* Write out everything dirty in the buffer cache. */
+	result = sfs_buf_sync(sfs);
+	if (result) {
 		return result;
 	}
 
 	/* If the free block map needs to be written, write it. */
 	result = sfs_sync_freemap(sfs);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
 	/* If the superblock needs to be written, write it. */
 	result = sfs_sync_superblock(sfs);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -243,13 +295,9 @@ const char *
 sfs_getvolname(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
-	const char *ret;
 
-	vfs_biglock_acquire();
-	ret = sfs->sfs_sb.sb_volname;
-	vfs_biglock_release();
-
-	return ret;
+	/* The superblock doesn't change while we're mounted */
+	return sfs->sfs_sb.sb_volname;
 }
 
 /*
@@ -262,7 +310,11 @@ sfs_fs_destroy(struct sfs_fs *sfs)
 	if (sfs->sfs_freemap != NULL) {
 		bitmap_destroy(sfs->sfs_freemap);
 	}
+	sfs_buf_detach(sfs);
 	vnodearray_destroy(sfs->sfs_vnodes);
+	lock_destroy(sfs->sfs_vnlock);
+	lock_destroy(sfs->sfs_freemaplock);
+	kmem_cache_destroy(sfs->sfs_vnodecache);
 	KASSERT(sfs->sfs_device == NULL);
 	kfree(sfs);
 }
@@ -278,18 +330,28 @@ sfs_unmount(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
 
-	vfs_biglock_acquire();
+	/* vfs_unmount holds the biglock, which keeps the syncer away */
+	KASSERT(vfs_biglock_do_i_hold());
 
-	/* Do we have any files open? If so, can't unmount. */
+	/*
+	 * Do we have any files open? If so, can't unmount. (New ones
+	 * can't be opened from here on, as opening goes through the
+	 * biglock too.)
+	 */
+	lock_acquire(sfs->sfs_vnlock);
 	if (vnodearray_num(sfs->sfs_vnodes) > 0) {
-		vfs_biglock_release();
+		lock_release(sfs->sfs_vnlock);
 		return EBUSY;
 	}
+	lock_release(sfs->sfs_vnlock);
 
 	/* We should have just had sfs_sync called. */
 	KASSERT(sfs->sfs_superdirty == false);
 	KASSERT(sfs->sfs_freemapdirty == false);
 
+	/* Take it away from the syncer */
+	sfs_syncer_remfs(sfs);
+
 	/* The vfs layer takes care of the device for us */
 	sfs->sfs_device = NULL;
 
@@ -297,7 +359,6 @@ sfs_unmount(struct fs *fs)
 	sfs_fs_destroy(sfs);
 
 	/* nothing else to do */
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -355,13 +416,38 @@ sfs_fs_create(void)
 	if (sfs->sfs_vnodes == NULL) {
 		goto cleanup_object;
 	}
+	sfs->sfs_vnlock = lock_create("sfs_vnodes");
+	if (sfs->sfs_vnlock == NULL) {
+		goto cleanup_vnodes;
+	}
 
 	/* freemap */
 	sfs->sfs_freemap = NULL;
 	sfs->sfs_freemapdirty = false;
+	sfs->sfs_freemaplock = lock_create("sfs_freemap");
+	if (sfs->sfs_freemaplock == NULL) {
+		goto cleanup_vnlock;
+	}
+
+	/* not yet known to the syncer */
+	sfs->sfs_syncnext = NULL;
+
+	/* in-memory inodes */
+	sfs->sfs_vnodecache = kmem_cache_create("sfs_vnode",
+						sizeof(struct sfs_vnode),
+						0, NULL);
+	if (sfs->sfs_vnodecache == NULL) {
+		goto cleanup_freemaplock;
+	}
 
 	return sfs;
 
+cleanup_freemaplock:
+	lock_destroy(sfs->sfs_freemaplock);
+cleanup_vnlock:
+	lock_destroy(sfs->sfs_vnlock);
+cleanup_vnodes:
+	vnodearray_destroy(sfs->sfs_vnodes);
 cleanup_object:
 	kfree(sfs);
 fail:
@@ -393,6 +479,9 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	/* We don't pass any options through mount */
 	(void)options;
 
+	/* Set up the buffer cache, if this is the first mount */
+	sfs_buf_bootstrap();
+
 	/*
 	 * We can't mount on devices with the wrong sector size.
 	 *
@@ -464,6 +553,15 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 		return result;
 	}
 
+	/* Have the syncer look after it */
+	result = sfs_syncer_addfs(sfs);
+	if (result) {
+		sfs->sfs_device = NULL;
+		sfs_fs_destroy(sfs);
+		vfs_biglock_release();
+		return result;
+	}
+
 	/* Hand back the abstract fs */
 	*ret = &sfs->sfs_absfs;
 
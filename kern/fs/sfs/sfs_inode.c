@@ -35,26 +35,33 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
 #include <vfs.h>
+#include <slab.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
 
 /*
- * Write an on-disk inode structure back out to disk.
+ * Write an on-disk inode structure back out to the buffer cache.
+ * The vnode must be locked, or (in sfs_reclaim) unreachable.
  */
 int
 sfs_sync_inode(struct sfs_vnode *sv)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *buf;
 	int result;
 
 	if (sv->sv_dirty) {
-		result = sfs_writeblock(sfs, sv->sv_ino, &sv->sv_i,
-					sizeof(sv->sv_i));
+		/* The inode fills its block, so no need to read it */
+		result = sfs_buf_get(sfs, sv->sv_ino, &buf);
 		if (result) {
 			return result;
 		}
+		memcpy(sfs_buf_data(buf), &sv->sv_i, sizeof(sv->sv_i));
+		sfs_buf_markdirty(buf);
+		sfs_buf_release(buf);
 		sv->sv_dirty = false;
 	}
 	return 0;
@@ -73,13 +80,13 @@ sfs_reclaim(struct vnode *v)
 	unsigned ix, i, num;
 	int result;
 
-	vfs_biglock_acquire();
-
 	/*
 	 * Make sure someone else hasn't picked up the vnode since the
-	 * decision was made to reclaim it. (You must also synchronize
-	 * this with sfs_loadvnode.)
+	 * decision was made to reclaim it. Holding the vnode table
+	 * keeps sfs_loadvnode (and the syncer) from finding it while
+	 * we decide.
 	 */
+	lock_acquire(sfs->sfs_vnlock);
 	spinlock_acquire(&v->vn_countlock);
 	if (v->vn_refcount != 1) {
 
@@ -88,16 +95,24 @@ sfs_reclaim(struct vnode *v)
 		v->vn_refcount--;
 
 		spinlock_release(&v->vn_countlock);
-		vfs_biglock_release();
+		lock_release(sfs->sfs_vnlock);
 		return EBUSY;
 	}
 	spinlock_release(&v->vn_countlock);
 
+	/*
+	 * Nobody else has the vnode, so it needs no locking of its
+	 * own from here on. Keep the table locked until we're done,
+	 * though: until the inode is in the buffer cache, loading it
+	 * afresh would see it out of date, and once the table is
+	 * empty the volume can be unmounted.
+	 */
+
 	/* If there are no on-disk references to the file either, erase it. */
 	if (sv->sv_i.sfi_linkcount == 0) {
 		result = sfs_itrunc(sv, 0);
 		if (result) {
-			vfs_biglock_release();
+			lock_release(sfs->sfs_vnlock);
 			return result;
 		}
 	}
@@ -105,7 +120,7 @@ sfs_reclaim(struct vnode *v)
 	/* Sync the inode to disk */
 	result = sfs_sync_inode(sv);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
 
@@ -133,10 +148,15 @@ sfs_reclaim(struct vnode *v)
 
 	vnode_cleanup(&sv->sv_absvn);
 
-	vfs_biglock_release();
+	/*
+	 * Release the storage for the vnode structure itself. Do it
+	 * before letting go of the vnode table: once the vnode is out
+	 * of the table, the fs (and its cache) could be unmounted.
+	 */
+	lock_destroy(sv->sv_lock);
+	kmem_cache_free(sfs->sfs_vnodecache, sv);
 
-	/* Release the storage for the vnode structure itself. */
-	kfree(sv);
+	lock_release(sfs->sfs_vnlock);
 
 	/* Done */
 	return 0;
@@ -152,10 +172,17 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 {
 	struct vnode *v;
 	struct sfs_vnode *sv;
+	struct sfs_buf *buf;
 	const struct vnode_ops *ops;
 	unsigned i, num;
 	int result;
 
+	/*
+	 * Hold the table throughout, so two threads loading the same
+	 * inode can't both miss and end up with two vnodes for it.
+	 */
+	lock_acquire(sfs->sfs_vnlock);
+
 	/* Look in the vnodes table */
 	num = vnodearray_num(sfs->sfs_vnodes);
 
@@ -177,6 +204,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 			KASSERT(forcetype==SFS_TYPE_INVAL);
 
 			VOP_INCREF(&sv->sv_absvn);
+			lock_release(sfs->sfs_vnlock);
 			*ret = sv;
 			return 0;
 		}
@@ -184,8 +212,9 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 
 	/* Didn't have it loaded; load it */
 
-	sv = kmalloc(sizeof(struct sfs_vnode));
+	sv = kmem_cache_alloc(sfs->sfs_vnodecache);
 	if (sv==NULL) {
+		lock_release(sfs->sfs_vnlock);
 		return ENOMEM;
 	}
 
@@ -196,11 +225,14 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	}
 
 	/* Read the block the inode is in */
-	result = sfs_readblock(sfs, ino, &sv->sv_i, sizeof(sv->sv_i));
+	result = sfs_buf_read(sfs, ino, &buf);
 	if (result) {
-		kfree(sv);
+		kmem_cache_free(sfs->sfs_vnodecache, sv);
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
+	memcpy(&sv->sv_i, sfs_buf_data(buf), sizeof(sv->sv_i));
+	sfs_buf_release(buf);
 
 	/* Not dirty yet */
 	sv->sv_dirty = false;
@@ -235,21 +267,37 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Call the common vnode initializer */
 	result = vnode_init(&sv->sv_absvn, ops, &sfs->sfs_absfs, sv);
 	if (result) {
-		kfree(sv);
+		kmem_cache_free(sfs->sfs_vnodecache, sv);
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
 
+	sv->sv_lock = lock_create("sfs_vnode");
+	if (sv->sv_lock == NULL) {
+		vnode_cleanup(&sv->sv_absvn);
+		kmem_cache_free(sfs->sfs_vnodecache, sv);
+		lock_release(sfs->sfs_vnlock);
+		return ENOMEM;
+	}
+
 	/* Set the other fields in our vnode structure */
 	sv->sv_ino = ino;
+	sv->sv_ranext = 0;
+	sv->sv_raend = 0;
+	sv->sv_rawindow = 0;
 
 	/* Add it to our table */
 	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_absvn, NULL);
 	if (result) {
+		lock_destroy(sv->sv_lock);
 		vnode_cleanup(&sv->sv_absvn);
-		kfree(sv);
+		kmem_cache_free(sfs->sfs_vnodecache, sv);
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
 
+	lock_release(sfs->sfs_vnlock);
+
 	/* Hand it back */
 	*ret = sv;
 	return 0;
@@ -296,25 +344,21 @@ sfs_getroot(struct fs *fs, struct vnode **ret)
 	struct sfs_vnode *sv;
 	int result;
 
-	vfs_biglock_acquire();
-
 	result = sfs_loadvnode(sfs, SFS_ROOTDIR_INO, SFS_TYPE_INVAL, &sv);
 	if (result) {
 		kprintf("sfs: %s: getroot: Cannot load root vnode\n",
 			sfs->sfs_sb.sb_volname);
-		vfs_biglock_release();
 		return result;
 	}
 
+	/* The type never changes, so no need to lock the vnode */
 	if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
 		kprintf("sfs: %s: getroot: not directory (type %u)\n",
 			sfs->sfs_sb.sb_volname, sv->sv_i.sfi_type);
-		vfs_biglock_release();
+		VOP_DECREF(&sv->sv_absvn);
 		return EINVAL;
 	}
 
-	vfs_biglock_release();
-
 	*ret = &sv->sv_absvn;
 	return 0;
 }
@@ -41,15 +41,26 @@
 #include <sfs.h>
 #include "sfsprivate.h"
 
+#define SFS_IO_CLUSTER	16	/* blocks of a read brought in at once */
+#define SFS_RA_MIN	4	/* first read-ahead window, in blocks */
+#define SFS_RA_MAX	32	/* largest read-ahead window */
+
 ////////////////////////////////////////////////////////////
 //
 // Basic block-level I/O routines
 
 /*
+ * These go straight to the device. Apart from the superblock and the
+ * freemap, which are kept in memory anyway, everything goes through
+ * the buffer cache (sfs_buf.c), which calls these in turn.
+ *
  * Note: sfs_readblock is used to read the superblock
  * early in mount, before sfs is fully (or even mostly)
  * initialized, and so may not use anything from sfs
  * except sfs_device.
+ *
+ * These don't need vfs_biglock: the device does its own locking,
+ * and the syncer uses sfs_writeblocks without it.
  */
 
 /*
@@ -62,8 +73,6 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 	int result;
 	int tries=0;
 
-	KASSERT(vfs_biglock_do_i_hold());
-
 	DEBUG(DB_SFS, "sfs: %s %llu\n",
 	      uio->uio_rw == UIO_READ ? "read" : "write",
 	      uio->uio_offset / SFS_BLOCKSIZE);
@@ -131,15 +140,55 @@ sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 	return sfs_rwblock(sfs, &ku);
 }
 
+/*
+ * Read or write NBLOCKS consecutive blocks starting at BLOCK, each
+ * into or out of its own buffer in IOV, as one device request.
+ */
+static
+int
+sfs_rwblocks(struct sfs_fs *sfs, daddr_t block, struct iovec *iov,
+	     unsigned nblocks, enum uio_rw rw)
+{
+	struct uio ku;
+	unsigned i;
+
+	for (i=0; i<nblocks; i++) {
+		KASSERT(iov[i].iov_len == SFS_BLOCKSIZE);
+	}
+
+	ku.uio_iov = iov;
+	ku.uio_iovcnt = nblocks;
+	ku.uio_offset = ((off_t)block) * SFS_BLOCKSIZE;
+	ku.uio_resid = nblocks * SFS_BLOCKSIZE;
+	ku.uio_segflg = UIO_SYSSPACE;
+	ku.uio_rw = rw;
+	ku.uio_space = NULL;
+	return sfs_rwblock(sfs, &ku);
+}
+
+int
+sfs_readblocks(struct sfs_fs *sfs, daddr_t block, struct iovec *iov,
+	       unsigned nblocks)
+{
+	return sfs_rwblocks(sfs, block, iov, nblocks, UIO_READ);
+}
+
+int
+sfs_writeblocks(struct sfs_fs *sfs, daddr_t block, struct iovec *iov,
+		unsigned nblocks)
+{
+	return sfs_rwblocks(sfs, block, iov, nblocks, UIO_WRITE);
+}
+
 ////////////////////////////////////////////////////////////
 //
 // File-level I/O
 
 /*
  * Do I/O to a block of a file that doesn't cover the whole block.  We
- * need to read in the original block first, even if we're writing, so
+ * need the original contents of the block, even if we're writing, so
  * we don't clobber the portion of the block we're not intending to
- * write over.
+ * write over; they come from the buffer cache.
  *
  * SKIPSTART is the number of bytes to skip past at the beginning of
  * the sector; LEN is the number of bytes to actually read or write.
@@ -150,16 +199,8 @@ int
 sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	      uint32_t skipstart, uint32_t len)
 {
-	/*
-	 * I/O buffer for handling partial sectors.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static char iobuf[SFS_BLOCKSIZE];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *buf;
 	daddr_t diskblock;
 	uint32_t fileblock;
 	int result;
@@ -169,9 +210,6 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 
 	KASSERT(skipstart + len <= SFS_BLOCKSIZE);
 
-	/* We're using a global static buffer; it had better be locked */
-	KASSERT(vfs_biglock_do_i_hold());
-
 	/* Compute the block offset of this block in the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
 
@@ -184,40 +222,30 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	if (diskblock == 0) {
 		/*
 		 * There was no block mapped at this point in the file.
-		 * Zero the buffer.
+		 * Read zeros.
 		 */
 		KASSERT(uio->uio_rw == UIO_READ);
-		bzero(iobuf, sizeof(iobuf));
-	}
-	else {
-		/*
-		 * Read the block.
-		 */
-		result = sfs_readblock(sfs, diskblock, iobuf, sizeof(iobuf));
-		if (result) {
-			return result;
-		}
+		return uiomovezeros(len, uio);
 	}
 
-	/*
-	 * Now perform the requested operation into/out of the buffer.
-	 */
-	result = uiomove(iobuf+skipstart, len, uio);
+	/* Get the block */
+	result = sfs_buf_read(sfs, diskblock, &buf);
 	if (result) {
 		return result;
 	}
 
 	/*
-	 * If it was a write, write back the modified block.
+	 * Now perform the requested operation into/out of the buffer.
+	 * If it was a write, the block is now dirty (even if uiomove
+	 * failed partway).
 	 */
+	result = uiomove((char *)sfs_buf_data(buf) + skipstart, len, uio);
 	if (uio->uio_rw == UIO_WRITE) {
-		result = sfs_writeblock(sfs, diskblock, iobuf, sizeof(iobuf));
-		if (result) {
-			return result;
-		}
+		sfs_buf_markdirty(buf);
 	}
+	sfs_buf_release(buf);
 
-	return 0;
+	return result;
 }
 
 /*
@@ -228,14 +256,11 @@ int
 sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *buf;
 	daddr_t diskblock;
 	uint32_t fileblock;
 	int result;
 	bool doalloc = (uio->uio_rw==UIO_WRITE);
-	off_t saveoff;
-	off_t diskoff;
-	off_t saveres;
-	off_t diskres;
 
 	/* Get the block number within the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
@@ -258,35 +283,137 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 	}
 
 	/*
-	 * Do the I/O directly to the uio region. Save the uio_offset,
-	 * and substitute one that makes sense to the device.
+	 * Go through the buffer cache. When writing, the whole block
+	 * gets replaced, so there's no need to read it first.
 	 */
-	saveoff = uio->uio_offset;
-	diskoff = diskblock * SFS_BLOCKSIZE;
-	uio->uio_offset = diskoff;
+	if (uio->uio_rw == UIO_READ) {
+		result = sfs_buf_read(sfs, diskblock, &buf);
+	}
+	else {
+		result = sfs_buf_get(sfs, diskblock, &buf);
+	}
+	if (result) {
+		return result;
+	}
 
-	/*
-	 * Temporarily set the residue to be one block size.
-	 */
-	KASSERT(uio->uio_resid >= SFS_BLOCKSIZE);
-	saveres = uio->uio_resid;
-	diskres = SFS_BLOCKSIZE;
-	uio->uio_resid = diskres;
+	result = uiomove(sfs_buf_data(buf), SFS_BLOCKSIZE, uio);
+	if (result && uio->uio_rw == UIO_WRITE) {
+		/*
+		 * Don't write out a block that's only partly the
+		 * caller's data (and, if it wasn't cached, partly
+		 * zeros in place of what's on disk).
+		 */
+		sfs_buf_invalidate(buf);
+		return result;
+	}
+	if (uio->uio_rw == UIO_WRITE) {
+		sfs_buf_markdirty(buf);
+	}
+	sfs_buf_release(buf);
 
-	result = sfs_rwblock(sfs, uio);
+	return result;
+}
 
-	/*
-	 * Now, restore the original uio_offset and uio_resid and update
-	 * them by the amount of I/O done.
-	 */
-	uio->uio_offset = (uio->uio_offset - diskoff) + saveoff;
-	uio->uio_resid = (uio->uio_resid - diskres) + saveres;
+/*
+ * Get file blocks FILEBLOCK..FILEBLOCK+NBLOCKS-1 of SV into the
+ * buffer cache, merging the ones that are next to each other on
+ * disk into single requests. Holes and blocks past EOF are skipped.
+ * If ASYNC, the reads are left to the read-ahead thread.
+ *
+ * This is only a hint, so errors are ignored: whoever needs the
+ * block will go to the disk for it and get the error then.
+ */
+static
+void
+sfs_prefetch(struct sfs_vnode *sv, uint32_t fileblock, uint32_t nblocks,
+	     bool async)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	uint32_t endblock, i;
+	daddr_t diskblock, run;
+	unsigned runlen;
 
-	return result;
+	endblock = DIVROUNDUP(sv->sv_i.sfi_size, SFS_BLOCKSIZE);
+	if (fileblock >= endblock) {
+		return;
+	}
+	if (nblocks > endblock - fileblock) {
+		nblocks = endblock - fileblock;
+	}
+
+	run = 0;
+	runlen = 0;
+	for (i=0; i<nblocks; i++) {
+		if (sfs_bmap(sv, fileblock + i, false, &diskblock)) {
+			break;
+		}
+		if (runlen > 0 && diskblock == run + runlen) {
+			runlen++;
+			continue;
+		}
+		if (runlen > 0) {
+			sfs_buf_prefetch(sfs, run, runlen, async);
+		}
+		run = diskblock;
+		runlen = (diskblock != 0) ? 1 : 0;
+	}
+	if (runlen > 0) {
+		sfs_buf_prefetch(sfs, run, runlen, async);
+	}
+}
+
+/*
+ * Sequential read detection, called at the start of each read. If
+ * this read picks up where the last one on SV left off (or in the
+ * block where it left off), the file is probably being read straight
+ * through: double the read-ahead window and, once less than half a
+ * window is left in hand, queue reads for the blocks after this
+ * request that haven't been asked for yet. Otherwise, stop reading
+ * ahead.
+ */
+static
+void
+sfs_readahead(struct sfs_vnode *sv, struct uio *uio)
+{
+	uint32_t first, next, start, end;
+
+	KASSERT(uio->uio_resid > 0);
+
+	first = uio->uio_offset / SFS_BLOCKSIZE;
+	next = DIVROUNDUP(uio->uio_offset + uio->uio_resid, SFS_BLOCKSIZE);
+
+	if (first == sv->sv_ranext || first + 1 == sv->sv_ranext) {
+		if (sv->sv_rawindow == 0) {
+			sv->sv_rawindow = SFS_RA_MIN;
+		}
+		else if (sv->sv_rawindow < SFS_RA_MAX) {
+			sv->sv_rawindow *= 2;
+		}
+	}
+	else {
+		sv->sv_rawindow = 0;
+		sv->sv_raend = 0;
+	}
+	sv->sv_ranext = next;
+
+	if (sv->sv_rawindow == 0) {
+		return;
+	}
+	if (sv->sv_raend > next + sv->sv_rawindow / 2) {
+		/* still well ahead; wait so as to issue bigger requests */
+		return;
+	}
+	start = next > sv->sv_raend ? next : sv->sv_raend;
+	end = next + sv->sv_rawindow;
+	if (start < end) {
+		sfs_prefetch(sv, start, end - start, true);
+		sv->sv_raend = end;
+	}
 }
 
 /*
  * Do I/O of a whole region of data, whether or not it's block-aligned.
+ * The caller holds the vnode's lock.
  */
 int
 sfs_io(struct sfs_vnode *sv, struct uio *uio)
@@ -317,6 +444,10 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 			KASSERT(uio->uio_resid > extraresid);
 			uio->uio_resid -= extraresid;
 		}
+
+		if (uio->uio_resid > 0) {
+			sfs_readahead(sv, uio);
+		}
 	}
 
 	/*
@@ -353,6 +484,12 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	KASSERT(uio->uio_offset % SFS_BLOCKSIZE == 0);
 	nblocks = uio->uio_resid / SFS_BLOCKSIZE;
 	for (i=0; i<nblocks; i++) {
+		if (uio->uio_rw == UIO_READ && i % SFS_IO_CLUSTER == 0) {
+			/* Read the next stretch in as few requests as we can */
+			sfs_prefetch(sv, uio->uio_offset / SFS_BLOCKSIZE,
+				     nblocks - i < SFS_IO_CLUSTER ?
+				     nblocks - i : SFS_IO_CLUSTER, false);
+		}
 		result = sfs_blockio(sv, uio);
 		if (result) {
 			goto out;
@@ -407,6 +544,8 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 	   enum uio_rw rw)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *buf;
+	char *blockdata;
 	off_t endpos;
 	uint32_t vnblock;
 	uint32_t blockoffset;
@@ -414,18 +553,6 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 	bool doalloc;
 	int result;
 
-	/*
-	 * I/O buffer for metadata ops.
-	 *
-	 * Note: in real life (and when you've done the fs assignment) you
-	 * would get space from the disk buffer cache for this, not use a
-	 * static area.
-	 */
-	static char metaiobuf[SFS_BLOCKSIZE];
-
-	/* We're using a global static buffer; it had better be locked */
-	KASSERT(vfs_biglock_do_i_hold());
-
 	/* Figure out which block of the vnode (directory, whatever) this is */
 	vnblock = actualpos / SFS_BLOCKSIZE;
 	blockoffset = actualpos % SFS_BLOCKSIZE;
@@ -446,26 +573,21 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 		return 0;
 	}
 
-	/* Read the block */
-	result = sfs_readblock(sfs, diskblock, metaiobuf, sizeof(metaiobuf));
+	/* Get the block */
+	result = sfs_buf_read(sfs, diskblock, &buf);
 	if (result) {
 		return result;
 	}
+	blockdata = sfs_buf_data(buf);
 
 	if (rw == UIO_READ) {
 		/* Copy out the selected region */
-		memcpy(data, metaiobuf + blockoffset, len);
+		memcpy(data, blockdata + blockoffset, len);
 	}
 	else {
 		/* Update the selected region */
-		memcpy(metaiobuf + blockoffset, data, len);
-
-		/* Write the block back */
-		result = sfs_writeblock(sfs, diskblock,
-					metaiobuf, sizeof(metaiobuf));
-		if (result) {
-			return result;
-		}
+		memcpy(blockdata + blockoffset, data, len);
+		sfs_buf_markdirty(buf);
 
 		/* Update the vnode size if needed */
 		endpos = actualpos + len;
@@ -474,6 +596,7 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 			sv->sv_dirty = true;
 		}
 	}
+	sfs_buf_release(buf);
 
 	/* Done */
 	return 0;
@@ -0,0 +1,104 @@
+/*
+ * SFS filesystem
+ *
+ * Syncer.
+ *
+ * Writes only dirty the buffer cache, and inode and freemap changes
+ * stay in memory, so without help nothing would reach the disk
+ * until the next sync. This thread bounds how much a crash can lose:
+ *
+ *    - every SFS_SYNCER_METASECS seconds it copies the dirty inodes
+ *      of each mounted volume into the buffer cache and writes out
+ *      the freemap and superblock (sfs_sync_meta);
+ *
+ *    - every second (or sooner, if too many buffers are dirty) it
+ *      writes back the buffers that have been dirty long enough
+ *      (sfs_buf_flush).
+ *
+ * so a change is on disk within about SFS_SYNCER_METASECS +
+ * SFS_DIRTY_AGE seconds. There is one syncer for all volumes,
+ * started at the first mount. The list of volumes is protected by
+ * vfs_biglock.
+ */
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <vfs.h>
+#include <sfs.h>
+#include "sfsprivate.h"
+
+#define SFS_SYNCER_METASECS	5	/* seconds between inode syncs */
+
+static struct sfs_fs *sfs_syncvols;	/* mounted volumes */
+static bool sfs_syncer_started;
+
+static
+void
+sfs_syncer(void *junk1, unsigned long junk2)
+{
+	struct timespec now;
+	time_t lastmeta = 0;
+	struct sfs_fs *sfs;
+
+	(void)junk1;
+	(void)junk2;
+
+	while (1) {
+		sfs_buf_syncwait(HZ);
+
+		gettime(&now);
+		if (now.tv_sec - lastmeta >= SFS_SYNCER_METASECS) {
+			vfs_biglock_acquire();
+			for (sfs = sfs_syncvols; sfs != NULL;
+			     sfs = sfs->sfs_syncnext) {
+				/* errors are reported by sfs_rwblock */
+				sfs_sync_meta(sfs);
+			}
+			vfs_biglock_release();
+			lastmeta = now.tv_sec;
+		}
+
+		sfs_buf_flush();
+	}
+}
+
+/*
+ * Add a newly mounted volume, starting the syncer if need be.
+ */
+int
+sfs_syncer_addfs(struct sfs_fs *sfs)
+{
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (!sfs_syncer_started) {
+		result = thread_fork("sfs_syncer", NULL, sfs_syncer, NULL, 0);
+		if (result) {
+			return result;
+		}
+		sfs_syncer_started = true;
+	}
+
+	sfs->sfs_syncnext = sfs_syncvols;
+	sfs_syncvols = sfs;
+	return 0;
+}
+
+/*
+ * Remove a volume that is being unmounted.
+ */
+void
+sfs_syncer_remfs(struct sfs_fs *sfs)
+{
+	struct sfs_fs **sp;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	for (sp = &sfs_syncvols; *sp != sfs; sp = &(*sp)->sfs_syncnext) {
+		KASSERT(*sp != NULL);
+	}
+	*sp = sfs->sfs_syncnext;
+	sfs->sfs_syncnext = NULL;
+}
@@ -38,10 +38,93 @@
 #include <stat.h>
 #include <lib.h>
 #include <uio.h>
+#include <copyinout.h>
+#include <synch.h>
 #include <vfs.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
+/* Size of the kernel buffer user I/O is copied through */
+#define SFS_BOUNCESIZE	(4 * SFS_BLOCKSIZE)
+
+////////////////////////////////////////////////////////////
+// User I/O
+
+/*
+ * Read or write a user buffer. This can't be done with uiomove under
+ * the vnode lock: touching a user page can fault, and paging in may
+ * read a file (perhaps this same one) through VOP_READ. So copy
+ * through a kernel buffer, with the lock held only for the kernel
+ * side, SFS_BOUNCESIZE bytes at a time. The user's uio is only
+ * advanced over what actually got transferred.
+ */
+static
+int
+sfs_userio(struct sfs_vnode *sv, struct uio *uio)
+{
+	struct iovec kiov, *iov;
+	struct uio ku;
+	char *buf;
+	size_t len, done;
+	int result = 0;
+
+	buf = kmalloc(SFS_BOUNCESIZE);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+
+	while (uio->uio_resid > 0) {
+		/* Work within one iovec at a time */
+		iov = uio->uio_iov;
+		if (iov->iov_len == 0) {
+			KASSERT(uio->uio_iovcnt > 1);
+			uio->uio_iov++;
+			uio->uio_iovcnt--;
+			continue;
+		}
+		len = iov->iov_len;
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+		if (len > SFS_BOUNCESIZE) {
+			len = SFS_BOUNCESIZE;
+		}
+
+		if (uio->uio_rw == UIO_WRITE) {
+			result = copyin(iov->iov_ubase, buf, len);
+			if (result) {
+				break;
+			}
+		}
+
+		uio_kinit(&kiov, &ku, buf, len, uio->uio_offset, uio->uio_rw);
+		lock_acquire(sv->sv_lock);
+		result = sfs_io(sv, &ku);
+		lock_release(sv->sv_lock);
+		done = len - ku.uio_resid;
+
+		if (uio->uio_rw == UIO_READ && done > 0) {
+			if (copyout(buf, iov->iov_ubase, done)) {
+				result = EFAULT;
+				break;
+			}
+		}
+
+		iov->iov_ubase += done;
+		iov->iov_len -= done;
+		uio->uio_resid -= done;
+		uio->uio_offset += done;
+
+		if (result || done < len) {
+			/* error, or end of file */
+			break;
+		}
+	}
+
+	kfree(buf);
+	return result;
+}
+
 ////////////////////////////////////////////////////////////
 // Vnode operations.
 
@@ -102,9 +185,13 @@ sfs_read(struct vnode *v, struct uio *uio)
 
 	KASSERT(uio->uio_rw==UIO_READ);
 
-	vfs_biglock_acquire();
+	if (uio->uio_segflg != UIO_SYSSPACE) {
+		return sfs_userio(sv, uio);
+	}
+
+	lock_acquire(sv->sv_lock);
 	result = sfs_io(sv, uio);
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
 
 	return result;
 }
@@ -121,9 +208,13 @@ sfs_write(struct vnode *v, struct uio *uio)
 
 	KASSERT(uio->uio_rw==UIO_WRITE);
 
-	vfs_biglock_acquire();
+	if (uio->uio_segflg != UIO_SYSSPACE) {
+		return sfs_userio(sv, uio);
+	}
+
+	lock_acquire(sv->sv_lock);
 	result = sfs_io(sv, uio);
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
 
 	return result;
 }
@@ -164,8 +255,10 @@ sfs_stat(struct vnode *v, struct stat *statbuf)
 		return result;
 	}
 
+	lock_acquire(sv->sv_lock);
 	statbuf->st_size = sv->sv_i.sfi_size;
 	statbuf->st_nlink = sv->sv_i.sfi_linkcount;
+	lock_release(sv->sv_lock);
 
 	/* We don't support this yet */
 	statbuf->st_blocks = 0;
@@ -185,16 +278,13 @@ sfs_gettype(struct vnode *v, uint32_t *ret)
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = v->vn_fs->fs_data;
 
-	vfs_biglock_acquire();
-
+	/* The type is fixed when the inode is made; no lock needed. */
 	switch (sv->sv_i.sfi_type) {
 	case SFS_TYPE_FILE:
 		*ret = S_IFREG;
-		vfs_biglock_release();
 		return 0;
 	case SFS_TYPE_DIR:
 		*ret = S_IFDIR;
-		vfs_biglock_release();
 		return 0;
 	}
 	panic("sfs: %s: gettype: Invalid inode type (inode %u, type %u)\n",
@@ -224,9 +314,17 @@ sfs_fsync(struct vnode *v)
 	struct sfs_vnode *sv = v->vn_data;
 	int result;
 
-	vfs_biglock_acquire();
+	lock_acquire(sv->sv_lock);
 	result = sfs_sync_inode(sv);
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
+	if (result == 0) {
+		/*
+		 * The buffer cache doesn't know which blocks are
+		 * this file's, so write out the whole volume's.
+		 * That needs no vnode lock.
+		 */
+		result = sfs_buf_sync(sv->sv_absvn.vn_fs->fs_data);
+	}
 
 	return result;
 }
@@ -250,8 +348,13 @@ int
 sfs_truncate(struct vnode *v, off_t len)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	int result;
 
-	return sfs_itrunc(sv, len);
+	lock_acquire(sv->sv_lock);
+	result = sfs_itrunc(sv, len);
+	lock_release(sv->sv_lock);
+
+	return result;
 }
 
 /*
@@ -289,18 +392,18 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	uint32_t ino;
 	int result;
 
-	vfs_biglock_acquire();
+	lock_acquire(sv->sv_lock);
 
 	/* Look up the name */
 	result = sfs_dir_findname(sv, name, &ino, NULL, NULL);
 	if (result!=0 && result!=ENOENT) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
 	/* If it exists and we didn't want it to, fail */
 	if (result==0 && excl) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return EEXIST;
 	}
 
@@ -308,18 +411,18 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 		/* We got something; load its vnode and return */
 		result = sfs_loadvnode(sfs, ino, SFS_TYPE_INVAL, &newguy);
 		if (result) {
-			vfs_biglock_release();
+			lock_release(sv->sv_lock);
 			return result;
 		}
 		*ret = &newguy->sv_absvn;
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return 0;
 	}
 
 	/* Didn't exist - create it */
 	result = sfs_makeobj(sfs, SFS_TYPE_FILE, &newguy);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
@@ -330,19 +433,21 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	result = sfs_dir_link(sv, name, newguy->sv_ino, NULL);
 	if (result) {
 		VOP_DECREF(&newguy->sv_absvn);
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
 	/* Update the linkcount of the new file */
+	lock_acquire(newguy->sv_lock);
 	newguy->sv_i.sfi_linkcount++;
 
 	/* and consequently mark it dirty. */
 	newguy->sv_dirty = true;
+	lock_release(newguy->sv_lock);
 
 	*ret = &newguy->sv_absvn;
 
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
 	return 0;
 }
 
@@ -361,26 +466,27 @@ sfs_link(struct vnode *dir, const char *name, struct vnode *file)
 
 	KASSERT(file->vn_fs == dir->vn_fs);
 
-	vfs_biglock_acquire();
-
 	/* Hard links to directories aren't allowed. */
 	if (f->sv_i.sfi_type == SFS_TYPE_DIR) {
-		vfs_biglock_release();
 		return EINVAL;
 	}
 
+	lock_acquire(sv->sv_lock);
+
 	/* Create the link */
 	result = sfs_dir_link(sv, name, f->sv_ino, NULL);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
 	/* and update the link count, marking the inode dirty */
+	lock_acquire(f->sv_lock);
 	f->sv_i.sfi_linkcount++;
 	f->sv_dirty = true;
+	lock_release(f->sv_lock);
 
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
 	return 0;
 }
 
@@ -396,12 +502,12 @@ sfs_remove(struct vnode *dir, const char *name)
 	int slot;
 	int result;
 
-	vfs_biglock_acquire();
+	lock_acquire(sv->sv_lock);
 
 	/* Look for the file and fetch a vnode for it. */
 	result = sfs_lookonce(sv, name, &victim, &slot);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
@@ -409,15 +515,22 @@ sfs_remove(struct vnode *dir, const char *name)
 	result = sfs_dir_unlink(sv, slot);
 	if (result==0) {
 		/* If we succeeded, decrement the link count. */
+		lock_acquire(victim->sv_lock);
 		KASSERT(victim->sv_i.sfi_linkcount > 0);
 		victim->sv_i.sfi_linkcount--;
 		victim->sv_dirty = true;
+		lock_release(victim->sv_lock);
 	}
 
-	/* Discard the reference that sfs_lookonce got us */
+	lock_release(sv->sv_lock);
+
+	/*
+	 * Discard the reference that sfs_lookonce got us. If this was
+	 * the last one, reclaim frees the file, which shouldn't keep
+	 * the directory locked.
+	 */
 	VOP_DECREF(&victim->sv_absvn);
 
-	vfs_biglock_release();
 	return result;
 }
 
@@ -438,15 +551,15 @@ sfs_rename(struct vnode *d1, const char *n1,
 	int slot1, slot2;
 	int result, result2;
 
-	vfs_biglock_acquire();
-
 	KASSERT(d1==d2);
 	KASSERT(sv->sv_ino == SFS_ROOTDIR_INO);
 
+	lock_acquire(sv->sv_lock);
+
 	/* Look up the old name of the file and get its inode and slot number*/
 	result = sfs_lookonce(sv, n1, &g1, &slot1);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
@@ -467,8 +580,10 @@ sfs_rename(struct vnode *d1, const char *n1,
 	}
 
 	/* Increment the link count, and mark inode dirty */
+	lock_acquire(g1->sv_lock);
 	g1->sv_i.sfi_linkcount++;
 	g1->sv_dirty = true;
+	lock_release(g1->sv_lock);
 
 	/* Unlink the old slot */
 	result = sfs_dir_unlink(sv, slot1);
@@ -480,14 +595,17 @@ sfs_rename(struct vnode *d1, const char *n1,
 	 * Decrement the link count again, and mark the inode dirty again,
 	 * in case it's been synced behind our back.
 	 */
+	lock_acquire(g1->sv_lock);
 	KASSERT(g1->sv_i.sfi_linkcount>0);
 	g1->sv_i.sfi_linkcount--;
 	g1->sv_dirty = true;
+	lock_release(g1->sv_lock);
+
+	lock_release(sv->sv_lock);
 
 	/* Let go of the reference to g1 */
 	VOP_DECREF(&g1->sv_absvn);
 
-	vfs_biglock_release();
 	return 0;
 
  puke_harder:
@@ -503,11 +621,13 @@ sfs_rename(struct vnode *d1, const char *n1,
 		panic("sfs: %s: rename: Cannot recover\n",
 		      sfs->sfs_sb.sb_volname);
 	}
+	lock_acquire(g1->sv_lock);
 	g1->sv_i.sfi_linkcount--;
+	lock_release(g1->sv_lock);
  puke:
+	lock_release(sv->sv_lock);
 	/* Let go of the reference to g1 */
 	VOP_DECREF(&g1->sv_absvn);
-	vfs_biglock_release();
 	return result;
 }
 
@@ -525,15 +645,12 @@ sfs_lookparent(struct vnode *v, char *path, struct vnode **ret,
 {
 	struct sfs_vnode *sv = v->vn_data;
 
-	vfs_biglock_acquire();
-
+	/* Only the (fixed) type is looked at; no lock needed. */
 	if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
-		vfs_biglock_release();
 		return ENOTDIR;
 	}
 
 	if (strlen(path)+1 > buflen) {
-		vfs_biglock_release();
 		return ENAMETOOLONG;
 	}
 	strcpy(buf, path);
@@ -541,7 +658,6 @@ sfs_lookparent(struct vnode *v, char *path, struct vnode **ret,
 	VOP_INCREF(&sv->sv_absvn);
 	*ret = &sv->sv_absvn;
 
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -559,22 +675,18 @@ sfs_lookup(struct vnode *v, char *path, struct vnode **ret)
 	struct sfs_vnode *final;
 	int result;
 
-	vfs_biglock_acquire();
-
 	if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
-		vfs_biglock_release();
 		return ENOTDIR;
 	}
 
+	lock_acquire(sv->sv_lock);
 	result = sfs_lookonce(sv, path, &final, NULL);
+	lock_release(sv->sv_lock);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
 	*ret = &final->sv_absvn;
-
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -42,6 +42,22 @@ extern const struct vnode_ops sfs_dirops;
     uio_kinit(iov, uio, ptr, SFS_BLOCKSIZE, ((off_t)(block))*SFS_BLOCKSIZE, rw)
 
 
+/* Functions in sfs_buf.c */
+struct sfs_buf;		/* Opaque */
+void sfs_buf_bootstrap(void);
+int sfs_buf_read(struct sfs_fs *sfs, daddr_t block, struct sfs_buf **ret);
+int sfs_buf_get(struct sfs_fs *sfs, daddr_t block, struct sfs_buf **ret);
+void *sfs_buf_data(struct sfs_buf *buf);
+void sfs_buf_markdirty(struct sfs_buf *buf);
+void sfs_buf_release(struct sfs_buf *buf);
+void sfs_buf_invalidate(struct sfs_buf *buf);
+int sfs_buf_sync(struct sfs_fs *sfs);
+void sfs_buf_detach(struct sfs_fs *sfs);
+void sfs_buf_flush(void);
+void sfs_buf_syncwait(unsigned ticks);
+void sfs_buf_prefetch(struct sfs_fs *sfs, daddr_t block, unsigned nblocks,
+		bool async);
+
 /* Functions in sfs_balloc.c */
 int sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock);
 void sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock);
@@ -70,12 +86,23 @@ int sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 int sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret);
 int sfs_getroot(struct fs *fs, struct vnode **ret);
 
+/* Functions in sfs_fsops.c */
+int sfs_sync_meta(struct sfs_fs *sfs);
+
 /* Functions in sfs_io.c */
 int sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len);
 int sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len);
+int sfs_readblocks(struct sfs_fs *sfs, daddr_t block, struct iovec *iov,
+		unsigned nblocks);
+int sfs_writeblocks(struct sfs_fs *sfs, daddr_t block, struct iovec *iov,
+		unsigned nblocks);
 int sfs_io(struct sfs_vnode *sv, struct uio *uio);
 int sfs_metaio(struct sfs_vnode *sv, off_t pos, void *data, size_t len,
 	       enum uio_rw rw);
 
+/* Functions in sfs_syncer.c */
+int sfs_syncer_addfs(struct sfs_fs *sfs);
+void sfs_syncer_remfs(struct sfs_fs *sfs);
+
 
 #endif /* _SFSPRIVATE_H_ */
@@ -36,9 +36,43 @@
 
 
 #include <vm.h>
+#include <spinlock.h>
 #include "opt-dumbvm.h"
 
 struct vnode;
+struct pagetable;
+struct cpu;
+
+
+#if !OPT_DUMBVM
+/*
+ * A region of the address space (code, data, stack).
+ *
+ * Pages are not allocated when a segment is defined; vm_fault fills
+ * them in on first touch. If seg_vnode is set, the bytes from
+ * seg_fbase to seg_fbase+seg_filesize are read from that vnode,
+ * starting at file offset seg_offset; everything else is zero-filled.
+ */
+struct segment {
+        vaddr_t seg_base;               /* first page (page-aligned) */
+        size_t seg_npages;              /* length in pages */
+        int seg_perm;                   /* SEG_R | SEG_W | SEG_X */
+        struct vnode *seg_vnode;        /* backing executable, or NULL */
+        off_t seg_offset;               /* file offset of seg_fbase */
+        vaddr_t seg_fbase;              /* first file-backed address */
+        size_t seg_filesize;            /* number of file-backed bytes */
+};
+
+#define SEG_R   0x4
+#define SEG_W   0x2
+#define SEG_X   0x1
+
+/* ELF files normally have two or three loadable segments, plus the stack. */
+#define AS_MAXSEGS      8
+
+/* 4M of user stack; like every other page, only allocated when touched. */
+#define AS_STACKPAGES   1024
+#endif
 
 
 /*
@@ -58,7 +92,15 @@ struct addrspace {
         size_t as_npages2;
         paddr_t as_stackpbase;
 #else
-        /* Put stuff here for your VM system */
+        struct segment as_segs[AS_MAXSEGS]; /* defined regions */
+        unsigned as_nsegs;                  /* number in use */
+        struct pagetable *as_pt;            /* virtual -> physical */
+        struct spinlock as_ptlock;          /* protects as_pt entries */
+        bool as_dying;                      /* being destroyed; coremap.c */
+        unsigned as_evicting;               /* pages being evicted; coremap.c */
+        unsigned as_asid;                   /* TLB address space ID... */
+        unsigned as_asidgen;                /* ...of this generation... */
+        struct cpu *as_asidcpu;             /* ...on this cpu */
 #endif
 };
 
@@ -99,6 +141,17 @@ struct addrspace {
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
  *
+ *    as_define_backing - record that part of a region defined with
+ *                as_define_region is to be read from a file when it
+ *                is first touched. (Not available with dumbvm.)
+ *
+ *    as_find_segment - return the region containing a virtual address,
+ *                or NULL. (Not available with dumbvm.)
+ *
+ *    as_fill_page - fill a freshly allocated physical page with the
+ *                contents the page at a given virtual address should
+ *                start out with. (Not available with dumbvm.)
+ *
  * Note that when using dumbvm, addrspace.c is not used and these
  * functions are found in dumbvm.c.
  */
@@ -118,6 +171,15 @@ int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
 
+#if !OPT_DUMBVM
+int               as_define_backing(struct addrspace *as,
+                                    vaddr_t vaddr, size_t filesize,
+                                    struct vnode *v, off_t offset);
+struct segment   *as_find_segment(struct addrspace *as, vaddr_t vaddr);
+int               as_fill_page(struct addrspace *as, vaddr_t vaddr,
+                               paddr_t paddr);
+#endif
+
 
 /*
  * Functions in loadelf.c
@@ -0,0 +1,76 @@
+#ifndef _CALLOUT_H_
+#define _CALLOUT_H_
+
+/*
+ * Callouts: functions to be called after a given number of hardclock
+ * ticks (1/HZ seconds each).
+ *
+ * Each cpu keeps its pending callouts in a hierarchical timer wheel
+ * (see callout.c), advanced by hardclock, so scheduling, cancelling,
+ * and running a callout are all constant time. A callout runs on the
+ * cpu that scheduled it, from hardclock, that is, in an interrupt
+ * handler: it may not sleep, and must not take spinlocks that anyone
+ * holds while calling callout_drain on it.
+ *
+ * The struct callout belongs to the caller and may live anywhere,
+ * including on the stack, as long as it is not pending or running
+ * when it goes away; callout_stop followed (if that fails) by
+ * callout_drain takes care of that.
+ *
+ * Functions:
+ *
+ *    callout_init     - set up C to call FUNC(ARG).
+ *
+ *    callout_schedule - arrange for C to run after TICKS ticks, on
+ *                       the current cpu. It runs at the hardclock
+ *                       after TICKS full ticks have gone by, so the
+ *                       actual delay is between TICKS and TICKS+1
+ *                       ticks. C must not already be pending. Delays
+ *                       longer than CALLOUT_MAXTICKS are cut to that.
+ *
+ *    callout_stop     - cancel C if it is pending. Returns true if it
+ *                       was, false if it was not scheduled or has
+ *                       already started running.
+ *
+ *    callout_drain    - wait until C is not running. May not be
+ *                       called from a callout or with spinlocks held.
+ *
+ *    callout_cpu_init - set up the timer wheel of a new cpu.
+ *
+ *    callout_tick     - advance the current cpu's wheel by one tick
+ *                       and run what is due. Called by hardclock.
+ *
+ *    callout_next     - how many hardclocks the current cpu can go
+ *                       without one that has something to do, counting
+ *                       the one that does (so 1 means the very next).
+ *                       Returns CALLOUT_MAXTICKS if nothing is
+ *                       pending. Used to stretch the timer while idle.
+ */
+
+struct cpu;
+struct callout_wheel;
+
+struct callout {
+	struct callout *co_next;	/* on a wheel slot */
+	struct callout **co_prevp;	/* what points to us */
+	struct callout_wheel *co_wheel;	/* last wheel we were put on */
+	uint32_t co_expire;		/* wheel time to run at */
+	bool co_pending;		/* on a wheel, not run yet */
+	void (*co_func)(void *);
+	void *co_arg;
+};
+
+/* 2^24 ticks; about 46 hours at HZ=100 */
+#define CALLOUT_MAXTICKS	0xffffff
+
+void callout_init(struct callout *c, void (*func)(void *), void *arg);
+void callout_schedule(struct callout *c, unsigned ticks);
+bool callout_stop(struct callout *c);
+void callout_drain(struct callout *c);
+
+void callout_cpu_init(struct cpu *c);
+void callout_tick(void);
+unsigned callout_next(void);
+
+
+#endif /* _CALLOUT_H_ */
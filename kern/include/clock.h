@@ -38,8 +38,10 @@
 
 
 /*
- * hardclock() is called on every CPU HZ times a second, possibly only
- * when the CPU is not idle, for scheduling.
+ * hardclock() is called on every CPU HZ times a second, for scheduling
+ * and callouts. An idle CPU may stop its timer until its next callout
+ * is due; the hardclocks it skipped are then made up all at once when
+ * it wakes up.
  */
 
 /* hardclocks per second */
@@ -48,12 +50,6 @@
 void hardclock_bootstrap(void);
 void hardclock(void);
 
-/*
- * timerclock() is called on one CPU once a second to allow simple
- * timed operations. (This is a fairly simpleminded interface.)
- */
-void timerclock(void);
-
 /*
  * gettime() may be used to fetch the current time of day.
  */
@@ -79,5 +75,11 @@ void timespec_sub(const struct timespec *t1,
  */
 void clocksleep(int seconds);
 
+/*
+ * clocksleep_ticks() suspends execution for at least TICKS hardclocks,
+ * that is, TICKS/HZ seconds.
+ */
+void clocksleep_ticks(unsigned ticks);
+
 
 #endif /* _CLOCK_H_ */
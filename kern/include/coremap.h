@@ -0,0 +1,94 @@
+#ifndef _COREMAP_H_
+#define _COREMAP_H_
+
+/*
+ * Coremap: bookkeeping for every physical page frame.
+ *
+ * The coremap is set up by vm_bootstrap and from then on hands out
+ * all physical memory, both kernel pages (alloc_kpages/free_kpages)
+ * and pages of user address spaces.
+ *
+ * Functions:
+ *
+ *    coremap_bootstrap   - take over physical memory from ram.c.
+ *
+ *    coremap_alloc_upage - allocate one frame for the user page at
+ *                          VADDR of address space AS. The contents
+ *                          are not cleared, and the frame is pinned
+ *                          (cannot be evicted) until the caller
+ *                          calls coremap_unpin_upage. Returns 0 if
+ *                          no memory; the caller may then evict
+ *                          something and retry.
+ *
+ *    coremap_unpin_upage - make a frame from coremap_alloc_upage
+ *                          eligible for eviction.
+ *
+ *    coremap_free_upage  - drop one reference to a frame from
+ *                          coremap_alloc_upage; the frame is freed
+ *                          when the last reference goes away.
+ *
+ *    coremap_share_upage - add a reference to a user frame, for a
+ *                          copy-on-write mapping in another address
+ *                          space.
+ *
+ *    coremap_claim_upage - if nobody else references the frame, make
+ *                          AS/VADDR its owner and return true; if it
+ *                          is still shared, return false.
+ *
+ *    coremap_reference_upage - note that AS is using the frame at
+ *                          VADDR, for the page replacement clock. If
+ *                          the frame was shared but AS is now its only
+ *                          user, AS becomes its owner again, so it can
+ *                          be evicted. Call with AS's as_ptlock held.
+ *                          
+ *
+ *    coremap_printstats  - print free memory and fragmentation.
+ *
+ * Eviction (used by vm.c):
+ *
+ *    coremap_pick_victim - choose a frame to evict and return its
+ *                          address and owner. The frame is marked
+ *                          busy, and the owner cannot finish
+ *                          as_destroy until coremap_evict_done.
+ *                          Returns false if nothing can be evicted.
+ *
+ *    coremap_evict_check - with the owner's as_ptlock held, check
+ *                          that the victim was not shared in the
+ *                          meantime.
+ *
+ *    coremap_evict_done  - finish with a victim: free the frame if
+ *                          EVICTED, otherwise just unmark it.
+ *
+ *    coremap_as_dying    - called by as_destroy before tearing down
+ *                          the page table: stop choosing victims from
+ *                          AS and wait for evictions in progress.
+ *
+ *    coremap_pager_wait  - sleep until free memory runs low.
+ *
+ *    coremap_pager_wanted - true while the pager should keep evicting.
+ */
+
+#include <machine/vm.h>
+
+struct addrspace;
+
+void coremap_bootstrap(void);
+paddr_t coremap_alloc_upage(struct addrspace *as, vaddr_t vaddr);
+void coremap_unpin_upage(paddr_t paddr);
+void coremap_free_upage(paddr_t paddr);
+void coremap_share_upage(paddr_t paddr);
+bool coremap_claim_upage(paddr_t paddr, struct addrspace *as, vaddr_t vaddr);
+void coremap_reference_upage(paddr_t paddr, struct addrspace *as,
+			     vaddr_t vaddr);
+void coremap_printstats(void);
+
+bool coremap_pick_victim(paddr_t *paddr, struct addrspace **as,
+			 vaddr_t *vaddr);
+bool coremap_evict_check(paddr_t paddr, struct addrspace *as);
+void coremap_evict_done(paddr_t paddr, struct addrspace *as, bool evicted);
+void coremap_as_dying(struct addrspace *as);
+void coremap_pager_wait(void);
+bool coremap_pager_wanted(void);
+
+
+#endif /* _COREMAP_H_ */
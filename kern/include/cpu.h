@@ -36,6 +36,18 @@
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
 
+/*
+ * Number of priority levels, and so of run queues per cpu, of the
+ * multilevel feedback queue scheduler (see thread.c). Level 0 is the
+ * highest priority.
+ */
+#define SCHED_NPRIO 4
+
+/*
+ * Number of free pages each cpu may keep for itself; see c_pagecache.
+ */
+#define CPU_PAGECACHE 16
+
 /*
  * Per-cpu structure
  *
@@ -62,12 +74,75 @@ struct cpu {
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
 
+	/*
+	 * Protected by c_pagecache_lock, which only this cpu takes
+	 * except when memory runs short and the coremap drains every
+	 * cpu's cache.
+	 *
+	 * Free pages held back by the coremap (vm/coremap.c) so that
+	 * most single-page kernel allocations and frees don't need
+	 * the global coremap lock.
+	 */
+	unsigned c_npagecache;			/* pages in c_pagecache */
+	paddr_t c_pagecache[CPU_PAGECACHE];	/* free physical pages */
+	struct spinlock c_pagecache_lock;
+
+	/*
+	 * Accessed only by this cpu, with interrupts off, except that
+	 * the statistics may be read (unlocked) for printing.
+	 *
+	 * TLB replacement state and counters for the VM system.
+	 */
+	unsigned c_tlbvictim;		/* next TLB slot to replace */
+	unsigned c_tlbfaults;		/* TLB misses handled by vm_fault */
+	unsigned c_tlbreloads;		/* ...satisfied from the page table */
+	unsigned c_tlbevictions;	/* valid TLB entries replaced */
+	unsigned c_tlbinvalidations;	/* TLB entries/flushes invalidated */
+
+	/*
+	 * Accessed only by this cpu, with interrupts off.
+	 *
+	 * Address space ID allocation for the TLB (paging VM only).
+	 */
+	struct addrspace *c_curas;	/* address space last activated */
+	unsigned c_curasid;		/* ASID of the current address space */
+	unsigned c_asidnext;		/* next ASID to hand out */
+	unsigned c_asidgen;		/* bumped each time ASIDs run out */
+
+	/*
+	 * Accessed only by this cpu, with interrupts off.
+	 *
+	 * Tickless idle (see mainbus_idle_timer): if nonzero, the timer
+	 * has been set to go off this many ticks after the last one
+	 * instead of every tick.
+	 */
+	unsigned c_idleticks;
+
+	/*
+	 * Accessed only by this cpu, with interrupts off.
+	 *
+	 * Cycles on the on-chip counter already counted as hardclocks,
+	 * after a tickless idle ended early without restarting it.
+	 */
+	uint32_t c_timerskew;
+
+	/*
+	 * Accessed only by this cpu, with interrupts off.
+	 *
+	 * Exited threads kept, stack and all, for thread_fork to reuse
+	 * (see thread_cache_get in thread.c).
+	 */
+	struct threadlist c_threadcache;
+
 	/*
 	 * Accessed by other cpus.
-	 * Protected by the runqueue lock.
+	 * Protected by the runqueue lock, except that other cpus may
+	 * read c_isidle and c_runcount without it, as hints for load
+	 * balancing.
 	 */
-	bool c_isidle;			/* True if this cpu is idle */
-	struct threadlist c_runqueue;	/* Run queue for this cpu */
+	volatile bool c_isidle;		/* True if this cpu is idle */
+	struct threadlist c_runqueue[SCHED_NPRIO]; /* Run queues, by priority */
+	volatile unsigned c_runcount;	/* Threads on all of c_runqueue[] */
 	struct spinlock c_runqueue_lock;
 
 	/*
@@ -88,6 +163,11 @@ struct cpu {
 	unsigned c_numshootdown;
 	struct spinlock c_ipi_lock;
 
+	/*
+	 * Accessed by other cpus. Protected inside callout.c.
+	 */
+	struct callout_wheel *c_callouts;	/* Pending callouts */
+
 	/*
 	 * Accessed by other cpus. Protected inside hangman.c.
 	 */
@@ -112,11 +192,26 @@ void cpu_machdep_init(struct cpu *);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
 
+/*
+ * cpu_count returns the number of cpus in the system; cpu_get returns
+ * cpu number N (0 <= N < cpu_count()). Both are only meaningful once
+ * all cpus have been found, i.e. after thread_start_cpus.
+ */
+unsigned cpu_count(void);
+struct cpu *cpu_get(unsigned n);
+
 /*
  * Produce a string describing the CPU type.
  */
 void cpu_identify(char *buf, size_t max);
 
+/*
+ * Count the current CPU's cycles. The count wraps, so only differences
+ * between nearby readings are meaningful; and each CPU has its own, so
+ * readings from different CPUs may not agree exactly.
+ */
+uint32_t cpu_cycles(void);
+
 /*
  * Hardware-level interrupt on/off, for the current CPU.
  *
@@ -47,11 +47,14 @@ struct emufs_vnode {
 	uint32_t ev_handle;		/* file handle */
 };
 
+struct kmem_cache;
+
 struct emufs_fs {
 	struct fs ef_fs;		/* abstract filesystem structure */
 	struct emu_softc *ef_emu;	/* device */
 	struct emufs_vnode *ef_root;	/* root vnode */
 	struct vnodearray *ef_vnodes;	/* table of loaded vnodes */
+	struct kmem_cache *ef_vnodecache; /* emufs_vnodes come from here */
 };
 
 
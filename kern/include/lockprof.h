@@ -0,0 +1,99 @@
+#ifndef _LOCKPROF_H_
+#define _LOCKPROF_H_
+
+/*
+ * Lock contention profiler. Enable with "options lockprof" in the
+ * kernel config; otherwise everything here compiles to nothing.
+ *
+ * Spinlocks, sleep locks, and CVs each carry a struct lockprof that
+ * counts acquisitions, how many of them had to wait, and how long
+ * they waited in total and at most, in cycles. For CVs every cv_wait
+ * counts as a contended acquisition and the wait is the time slept.
+ *
+ * The counters are only updated by the thread that just got the lock
+ * (for a CV, the lock passed to cv_wait), so the lock itself protects
+ * them and the uncontended path costs only an increment and a store. A lock is entered
+ * into a global list the first time it is contended, so that
+ * lockprof_printstats can find it; lockprof_cleanup takes it out.
+ *
+ * For each contended lock we also remember who made us wait (the
+ * thread that held it last) and where we waited from (the return
+ * address of the acquire call, which can be looked up with nm).
+ * Spinlocks have no names, so they are shown by address and call
+ * site.
+ */
+
+#include "opt-lockprof.h"
+
+#define LOCKPROF_SPINLOCK	0
+#define LOCKPROF_LOCK		1
+#define LOCKPROF_CV		2
+
+#if OPT_LOCKPROF
+
+#define LOCKPROF_NAMELEN	16
+
+struct lockprof {
+	const char *lp_name;		/* NULL for anonymous spinlocks */
+	unsigned lp_kind;		/* LOCKPROF_* */
+	unsigned lp_acquires;		/* times acquired */
+	unsigned lp_contended;		/* times we had to wait */
+	uint64_t lp_waitcycles;		/* total cycles spent waiting */
+	uint32_t lp_maxwait;		/* longest single wait */
+	const char *lp_holder;		/* name of last thread to acquire */
+	const void *lp_site;		/* caller of last contended acquire */
+	char lp_blocker[LOCKPROF_NAMELEN]; /* who held it then */
+	bool lp_registered;		/* on the list of contended locks */
+	struct lockprof *lp_prev;
+	struct lockprof *lp_next;
+};
+
+void lockprof_init(struct lockprof *lp, const char *name, unsigned kind);
+void lockprof_cleanup(struct lockprof *lp);
+void lockprof_contended(struct lockprof *lp, uint32_t start,
+			const void *site);
+void lockprof_printstats(void);
+void lockprof_reset(void);
+
+#define LOCKPROF(sym)			struct lockprof sym
+#define LOCKPROF_INIT(lp, n, k)		lockprof_init(lp, n, k)
+#define LOCKPROF_CLEANUP(lp)		lockprof_cleanup(lp)
+
+/* For SPINLOCK_INITIALIZER; note the trailing comma. */
+#define LOCKPROF_INITIALIZER \
+	{ NULL, LOCKPROF_SPINLOCK, 0, 0, 0, 0, NULL, NULL, "", false, \
+	  NULL, NULL },
+
+/*
+ * Declare and take the timestamp for a wait. The low bit is forced on
+ * so that zero can mean "didn't wait".
+ */
+#define LOCKPROF_TIMESTAMP(sym)		uint32_t sym = 0
+#define LOCKPROF_START(sym)		((sym) = cpu_cycles() | 1)
+
+/*
+ * Note that the current thread now holds the lock. Must be called
+ * with the lock held, from the acquire function itself.
+ */
+#define LOCKPROF_ACQUIRED(lp, start) do {				\
+		if ((start) != 0) {					\
+			lockprof_contended(lp, start,			\
+					   __builtin_return_address(0)); \
+		}							\
+		(lp)->lp_acquires++;					\
+		(lp)->lp_holder = curthread->t_name;			\
+	} while (0)
+
+#else
+
+#define LOCKPROF(sym)
+#define LOCKPROF_INIT(lp, n, k)
+#define LOCKPROF_CLEANUP(lp)
+#define LOCKPROF_INITIALIZER
+#define LOCKPROF_TIMESTAMP(sym)
+#define LOCKPROF_START(sym)
+#define LOCKPROF_ACQUIRED(lp, start)
+
+#endif
+
+#endif /* _LOCKPROF_H_ */
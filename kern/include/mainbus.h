@@ -52,6 +52,14 @@ void mainbus_interrupt(struct trapframe *);
 /* XXX this interface is not adequately MI */
 size_t mainbus_ramsize(void);
 
+/*
+ * Called by an idle cpu, with interrupts off, just before idling: the
+ * next TICKS-1 hardclocks have nothing to do, so the timer may skip
+ * them. The hardclocks are made up (all at once) at the next
+ * interrupt, whatever it is.
+ */
+void mainbus_idle_timer(unsigned ticks);
+
 /* Switch on an inter-processor interrupt. (Low-level.) */
 void mainbus_send_ipi(struct cpu *target);
 
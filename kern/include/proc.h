@@ -122,6 +122,12 @@ struct proc {
 /* This is the process structure for the kernel and for kernel-only threads. */
 extern struct proc *kproc;
 
+#if OPT_C2
+/* Object cache for the trapframe copy sys_fork passes to the child. */
+struct kmem_cache;
+extern struct kmem_cache *proc_tfcache;
+#endif
+
 /* Call once during system startup to allocate data structures. */
 void proc_bootstrap(void);
 
@@ -152,7 +158,7 @@ struct proc *proc_search_pid(pid_t pid);
 void proc_signal_end(struct proc *proc);
 void proc_file_table_copy(struct proc *psrc, struct proc *pdest);
 int check_is_child(pid_t pid);
-int proc_verify_pid(void);
+bool proc_pids_exhausted(void);
 struct proc * check_is_terminated(struct proc *p);
 #endif
 #endif 
\ No newline at end of file
@@ -0,0 +1,104 @@
+#ifndef _PT_H_
+#define _PT_H_
+
+/*
+ * Page tables for user address spaces.
+ *
+ * This is a two-level table: the top 10 bits of a virtual address
+ * index the directory, the next 10 bits index a second-level table
+ * of page table entries, and the low 12 bits are the page offset.
+ * Second-level tables (one page each) are only allocated for the
+ * parts of kuseg that are actually in use, so a small process pays
+ * for a directory plus a couple of tables.
+ *
+ * Only kuseg (the lower half of the address space) is mapped through
+ * the page table, so the directory only has 512 entries.
+ */
+
+#include <machine/vm.h>
+
+#define PT_L1_INDEX(va)  (((va) >> 22) & 0x3ff)
+#define PT_L2_INDEX(va)  (((va) >> 12) & 0x3ff)
+#define PT_MKVADDR(l1, l2) (((vaddr_t)(l1) << 22) | ((vaddr_t)(l2) << 12))
+
+#define PT_L1_SIZE  (USERSPACETOP >> 22)	/* directory entries */
+#define PT_L2_SIZE  1024			/* entries per table */
+
+/*
+ * Page table entry.
+ *
+ * When PTE_VALID is set the page is resident and PTE_FRAME holds its
+ * physical address. PTE_WRITE says whether the page may be mapped
+ * writable in the TLB. A valid page in a writable segment without
+ * PTE_WRITE is shared copy-on-write; vm_fault copies it on the first
+ * write.
+ *
+ * When PTE_SWAPPED is set instead, the page is on the swap device and
+ * PTE_FRAME holds the swap slot number (shifted like an address).
+ * PTE_EVICTING marks a page the pager is in the middle of writing
+ * out; anyone who wants it must wait (pt_wait) until it is swapped.
+ * Likewise PTE_SWAPIN (set along with PTE_SWAPPED) marks a page a
+ * fault is reading back in, so that nobody else reads the swap slot,
+ * which is freed as soon as the page is resident.
+ *
+ * Page table entries of an address space are protected by its
+ * as_ptlock, although the owning thread may read them without it:
+ * the pager only ever changes entries of resident pages, and only
+ * from PTE_VALID to PTE_EVICTING and on to PTE_SWAPPED.
+ */
+typedef uint32_t pte_t;
+
+#define PTE_FRAME    0xfffff000	/* physical page address, or swap slot */
+#define PTE_VALID    0x00000001	/* page is resident */
+#define PTE_WRITE    0x00000002	/* page may be written */
+#define PTE_SWAPPED  0x00000004	/* page is in swap */
+#define PTE_EVICTING 0x00000008	/* page is on its way to swap */
+#define PTE_SWAPIN   0x00000010	/* page is on its way back from swap */
+
+#define PTE_SLOT(pte)     ((unsigned)((pte) >> 12))
+#define PTE_MKSWAP(slot)  (((pte_t)(slot) << 12) | PTE_SWAPPED)
+
+struct pagetable {
+	pte_t *pt_dir[PT_L1_SIZE];	/* second-level tables, or NULL */
+};
+
+struct addrspace;
+
+/*
+ * Functions in pt.c:
+ *
+ *    pt_bootstrap - initialize; called from vm_bootstrap.
+ *
+ *    pt_create  - create an empty page table. Returns NULL if out of
+ *                 memory.
+ *
+ *    pt_destroy - free a page table, dropping its reference to every
+ *                 resident page it maps and releasing its swap.
+ *
+ *    pt_lookup  - return a pointer to the entry for VADDR. If the
+ *                 second-level table does not exist, it is created
+ *                 when CREATE is true; otherwise NULL is returned.
+ *                 Also returns NULL if out of memory.
+ *
+ *    pt_copy    - fill the (empty) page table of NEWAS with the same
+ *                 mappings as that of OLDAS. Resident pages are
+ *                 shared, not copied: both tables lose PTE_WRITE,
+ *                 and the caller must flush any writable TLB entries
+ *                 for OLDAS. Swapped pages are read into new frames
+ *                 for NEWAS.
+ *
+ *    pt_wait    - with AS's as_ptlock held, sleep until *PTE is not
+ *                 PTE_EVICTING or PTE_SWAPIN.
+ *
+ *    pt_wakeup  - with AS's as_ptlock held, wake threads in pt_wait.
+ */
+void pt_bootstrap(void);
+struct pagetable *pt_create(void);
+void pt_destroy(struct pagetable *pt);
+pte_t *pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create);
+int pt_copy(struct addrspace *oldas, struct addrspace *newas);
+void pt_wait(struct addrspace *as, pte_t *pte);
+void pt_wakeup(struct addrspace *as);
+
+
+#endif /* _PT_H_ */
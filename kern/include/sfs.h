@@ -42,12 +42,46 @@
 #include <fs.h>
 #include <vnode.h>
 
+struct kmem_cache;
+struct lock;
+
 /*
  * Get on-disk structures and constants that are made available to
  * userland for the benefit of mksfs, dumpsfs, etc.
  */
 #include <kern/sfs.h>
 
+/*
+ * Locking
+ *
+ * Each vnode has a lock, sv_lock, covering its inode (sv_i and
+ * sv_dirty), its read-ahead state, and (through sfs_bmap) its
+ * indirect block. sv_ino and sv_i.sfi_type never change once the
+ * vnode is loaded and may be read without it.
+ *
+ * Each volume has a lock for its table of loaded vnodes, sfs_vnlock,
+ * and one for its freemap (and superblock), sfs_freemaplock. The
+ * rest of struct sfs_fs doesn't change while the volume is mounted.
+ * Buffers in the buffer cache are held exclusively by whoever is
+ * using them; see sfs_buf.c.
+ *
+ * The lock order is:
+ *
+ *    vfs_biglock (now used only by the vfs layer, mount/unmount
+ *        and the syncer's list of volumes)
+ *    the directory's sv_lock
+ *    a file's sv_lock
+ *    sfs_vnlock
+ *    sfs_freemaplock
+ *    held buffers
+ *
+ * Nothing here may take vfs_biglock while holding any of the others.
+ * Nor may anything fault on user memory while holding a vnode lock
+ * or a buffer: paging in can read a file, which takes its vnode lock
+ * and buffers. User I/O goes through a kernel buffer (sfs_userio).
+ * A vnode being reclaimed has no other references and is not locked.
+ */
+
 /*
  * In-memory inode
  */
@@ -55,7 +89,11 @@ struct sfs_vnode {
 	struct vnode sv_absvn;          /* abstract vnode structure */
 	struct sfs_dinode sv_i;		/* copy of on-disk inode */
 	uint32_t sv_ino;                /* inode number */
+	struct lock *sv_lock;           /* see above */
 	bool sv_dirty;                  /* true if sv_i modified */
+	uint32_t sv_ranext;             /* where a sequential read goes next */
+	uint32_t sv_raend;              /* read-ahead issued up to here */
+	uint32_t sv_rawindow;           /* read-ahead size, 0 if not sequential */
 };
 
 /*
@@ -67,8 +105,12 @@ struct sfs_fs {
 	bool sfs_superdirty;            /* true if superblock modified */
 	struct device *sfs_device;      /* device mounted on */
 	struct vnodearray *sfs_vnodes;  /* vnodes loaded into memory */
+	struct lock *sfs_vnlock;        /* protects sfs_vnodes */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	bool sfs_freemapdirty;          /* true if freemap modified */
+	struct lock *sfs_freemaplock;   /* protects freemap and superblock */
+	struct kmem_cache *sfs_vnodecache; /* sfs_vnodes come from here */
+	struct sfs_fs *sfs_syncnext;    /* next volume for the syncer */
 };
 
 /*
@@ -76,5 +118,10 @@ struct sfs_fs {
  */
 int sfs_mount(const char *device);
 
+/*
+ * Print buffer cache statistics
+ */
+void sfs_buf_printstats(void);
+
 
 #endif /* _SFS_H_ */
@@ -0,0 +1,51 @@
+#ifndef _SLAB_H_
+#define _SLAB_H_
+
+/*
+ * Object caches (slab allocator).
+ *
+ * A cache hands out objects of one fixed size, carved out of whole
+ * pages ("slabs") so there is no rounding up to the next kmalloc
+ * size class. Each cpu keeps a small magazine of free objects, so
+ * most allocations and frees touch no lock at all; the slabs behind
+ * the magazines are protected by a per-cache spinlock.
+ *
+ * If a constructor is given, it is run once on each object when its
+ * slab is first set up, not on every allocation. Objects must be
+ * handed back to kmem_cache_free in their constructed state, so
+ * that fields which come back the same every time (a spinlock, a
+ * zeroed table) need not be set up again.
+ *
+ * Functions:
+ *
+ *    kmem_cache_create  - create a cache called NAME of objects of
+ *                         SIZE bytes, aligned to ALIGN (a power of
+ *                         two, or 0 for pointer alignment), with
+ *                         optional constructor CTOR. Objects should
+ *                         be well under a page. Returns NULL if out
+ *                         of memory. May be called before the thread
+ *                         system is up.
+ *
+ *    kmem_cache_destroy - destroy a cache. Every object must have
+ *                         been freed.
+ *
+ *    kmem_cache_alloc   - allocate an object; NULL if out of memory.
+ *                         May sleep, like kmalloc.
+ *
+ *    kmem_cache_free    - free an object from kmem_cache_alloc.
+ *
+ *    kmem_cache_printstats - print usage for all caches (the kh menu
+ *                         command).
+ */
+
+struct kmem_cache;
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     size_t align, void (*ctor)(void *obj));
+void kmem_cache_destroy(struct kmem_cache *kc);
+void *kmem_cache_alloc(struct kmem_cache *kc);
+void kmem_cache_free(struct kmem_cache *kc, void *obj);
+void kmem_cache_printstats(void);
+
+
+#endif /* _SLAB_H_ */
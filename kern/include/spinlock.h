@@ -37,6 +37,7 @@
 
 #include <cdefs.h>
 #include <hangman.h>
+#include <lockprof.h>
 
 /* Inlining support - for making sure an out-of-line copy gets built */
 #ifndef SPINLOCK_INLINE
@@ -54,21 +55,34 @@
  * This structure is made public so spinlocks do not have to be
  * malloc'd; however, code that uses spinlocks should not look inside
  * the structure directly but always use the spinlock API functions.
+ *
+ * Spinlocks are ticket locks: a cpu wanting the lock takes the next
+ * ticket number from splk_next and spins until splk_serving reaches
+ * it. This hands the lock out in arrival order, so no cpu can be
+ * starved by others that happen to win the race more often.
  */
 struct spinlock {
-	volatile spinlock_data_t splk_lock; /* Memory word where we spin. */
+	volatile spinlock_data_t splk_next; /* Next ticket to hand out. */
+	volatile spinlock_data_t splk_serving; /* Ticket holding the lock. */
 	struct cpu *splk_holder;	    /* CPU holding this lock. */
+	LOCKPROF(splk_prof);		    /* Contention profiler hook. */
 	HANGMAN_LOCKABLE(splk_hangman);     /* Deadlock detector hook. */
 };
 
 /*
  * Initializer for cases where a spinlock needs to be static or global.
+ * (LOCKPROF_INITIALIZER brings its own trailing comma, so that it can
+ * vanish entirely.)
  */
 #ifdef OPT_HANGMAN
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL, \
+#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, \
+				  SPINLOCK_DATA_INITIALIZER, NULL, \
+				  LOCKPROF_INITIALIZER \
 				  HANGMAN_LOCKABLE_INITIALIZER }
 #else
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, \
+				  SPINLOCK_DATA_INITIALIZER, NULL, \
+				  LOCKPROF_INITIALIZER }
 #endif
 
 /*
@@ -0,0 +1,42 @@
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+/*
+ * Swap space for the paging VM system.
+ *
+ * Pages evicted from memory are written to a raw disk device, one
+ * page per slot; a bitmap records which slots are in use. If the
+ * device is missing, the system simply runs without swap.
+ *
+ * Functions:
+ *
+ *    swap_bootstrap - open the swap device. Called from vm_bootstrap.
+ *
+ *    swap_enabled   - true if there is a swap device.
+ *
+ *    swap_alloc     - reserve a free slot. Returns ENOSPC if full.
+ *
+ *    swap_free      - release a slot.
+ *
+ *    swap_in        - read slot SLOT into the physical page PADDR.
+ *
+ *    swap_out       - write the physical page PADDR to slot SLOT.
+ *
+ *    swap_printstats - print swap usage.
+ */
+
+#include <machine/vm.h>
+
+/* The swap device; the second disk, accessed raw. */
+#define SWAP_DEVICE "lhd1raw:"
+
+void swap_bootstrap(void);
+bool swap_enabled(void);
+int swap_alloc(unsigned *slot);
+void swap_free(unsigned slot);
+int swap_in(paddr_t paddr, unsigned slot);
+int swap_out(paddr_t paddr, unsigned slot);
+void swap_printstats(void);
+
+
+#endif /* _SWAP_H_ */
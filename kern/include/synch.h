@@ -37,6 +37,7 @@
 
 
 #include <spinlock.h>
+#include <hangman.h>
 
 /* ------------------------------------------------------------- */
 /* G.Cabodi - 2019 - implementing locks and CVs */
@@ -82,6 +83,12 @@ void V(struct semaphore *);
  *
  * The name field is for easier debugging. A copy of the name is
  * (should be) made internally.
+ *
+ * A lock made with lock_create_adaptive is an adaptive mutex: a thread
+ * that finds it held spins for a while, as long as the holder is
+ * running on another cpu, before going to sleep. This is cheaper than
+ * a context switch when the lock is only ever held briefly. Otherwise
+ * it behaves like any other lock.
  */
 struct lock {
         char *lk_name;
@@ -95,12 +102,21 @@ struct lock {
 #endif
 	struct spinlock lk_lock;
         volatile struct thread *lk_owner;
+	bool lk_adaptive;		/* spin before sleeping */
+	LOCKPROF(lk_prof);		/* contention profiler hook */
 #endif
 };
 
 struct lock *lock_create(const char *name);
+struct lock *lock_create_adaptive(const char *name);
 void lock_destroy(struct lock *);
 
+/*
+ * Locks come from an object cache (see slab.h); synch_bootstrap
+ * creates it, and must be called before the first lock_create.
+ */
+void synch_bootstrap(void);
+
 /*
  * Operations:
  *    lock_acquire - Get the lock. Only one thread can hold the lock at the
@@ -138,6 +154,7 @@ struct cv {
 #if OPT_SYNCH
 	struct wchan *cv_wchan;
 	struct spinlock cv_lock;
+	LOCKPROF(cv_prof);		/* contention profiler hook */
 #endif
 };
 
@@ -148,18 +165,70 @@ void cv_destroy(struct cv *);
  * Operations:
  *    cv_wait      - Release the supplied lock, go to sleep, and, after
  *                   waking up again, re-acquire the lock.
+ *    cv_timedwait - Like cv_wait, but wake up anyway after TICKS
+ *                   hardclocks (1/HZ seconds each). Returns 0 if
+ *                   signalled, ETIMEDOUT if the time ran out.
  *    cv_signal    - Wake up one thread that's sleeping on this CV.
  *    cv_broadcast - Wake up all threads sleeping on this CV.
  *
- * For all three operations, the current thread must hold the lock passed
+ * For all these operations, the current thread must hold the lock passed
  * in. Note that under normal circumstances the same lock should be used
  * on all operations with any particular CV.
  *
  * These operations must be atomic. You get to write them.
  */
 void cv_wait(struct cv *cv, struct lock *lock);
+int cv_timedwait(struct cv *cv, struct lock *lock, unsigned ticks);
 void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
 
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers may hold the lock at once, or one writer.
+ * Writers take precedence: once a writer is waiting, new readers wait
+ * behind it, so a steady stream of readers can't starve writers.
+ *
+ * Writers are tracked as holders for the hangman deadlock detector;
+ * readers, of which there can be many, are only tracked while
+ * waiting.
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+
+struct rwlock {
+        char *rwlock_name;
+	struct spinlock rw_lock;	/* protects the fields below */
+	struct wchan *rw_readwc;	/* readers waiting */
+	struct wchan *rw_writewc;	/* writers waiting */
+	unsigned rw_readers;		/* readers holding the lock */
+	unsigned rw_writerswaiting;	/* writers waiting for it */
+	struct thread *rw_writer;	/* writer holding it, if any */
+	HANGMAN_LOCKABLE(rw_hangman);	/* Deadlock detector hook */
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading. Other threads may
+ *                           also hold it for reading at the same time.
+ *    rwlock_release_read  - Free a read hold of the lock.
+ *    rwlock_acquire_write - Get the lock for writing. No other thread
+ *                           holds it, for reading or writing, meanwhile.
+ *    rwlock_release_write - Free the write hold of the lock. Only the
+ *                           thread holding it may do this.
+ *    rwlock_do_i_hold_write - Return true if the current thread holds
+ *                           the lock for writing.
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+bool rwlock_do_i_hold_write(struct rwlock *);
+
+
 #endif /* _SYNCH_H_ */
\ No newline at end of file
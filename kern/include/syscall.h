@@ -61,6 +61,7 @@ __DEAD void enter_new_process(int argc, userptr_t argv, userptr_t env,
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_nanosleep(const_userptr_t user_req, userptr_t user_rem);
 #if OPT_C2
 struct openfile;
 void openfileIncrRefCount(struct openfile *of);
@@ -73,6 +74,10 @@ int sys_getcwd(char *buf, size_t buflen, int32_t *retval);
 
 int sys_write(int fd, userptr_t buf_ptr, size_t size,int *err);
 int sys_read(int fd, userptr_t buf_ptr, size_t size, int *err);
+int sys_pwrite(int fd, userptr_t buf_ptr, size_t size, off_t pos, int *err);
+int sys_pread(int fd, userptr_t buf_ptr, size_t size, off_t pos, int *err);
+int sys_writev(int fd, userptr_t iov_ptr, int iovcnt, int *err);
+int sys_readv(int fd, userptr_t iov_ptr, int iovcnt, int *err);
 void sys__exit(int status);
 int sys_waitpid(pid_t pid, userptr_t statusp, int options,int *err);
 pid_t sys_getpid(void);
@@ -50,10 +50,16 @@ int threadlisttest(int, char **);
 int threadtest(int, char **);
 int threadtest2(int, char **);
 int threadtest3(int, char **);
+int threadtest4(int, char **);
 int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
 int cvtest2(int, char **);
+int lockbench(int, char **);
+int spinbench(int, char **);
+int timedwaittest(int, char **);
+int rwtest(int, char **);
+int rwtest2(int, char **);
 
 /* semaphore unit tests */
 int semu1(int, char **);
@@ -86,6 +92,8 @@ int writestress(int, char **);
 int writestress2(int, char **);
 int longstress(int, char **);
 int createstress(int, char **);
+int readspeed(int, char **);
+int writescale(int, char **);
 int printfile(int, char **);
 
 /* other tests */
@@ -93,6 +101,7 @@ int kmalloctest(int, char **);
 int kmallocstress(int, char **);
 int kmalloctest3(int, char **);
 int kmalloctest4(int, char **);
+int kmalloctest5(int, char **);
 int nettest(int, char **);
 
 /* Routine for running a user-level program. */
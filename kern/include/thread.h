@@ -64,6 +64,9 @@ typedef enum {
 	S_ZOMBIE,	/* zombie; exited but not yet deleted */
 } threadstate_t;
 
+/* Names shorter than this are kept in the thread structure itself. */
+#define THREAD_NAMELEN 32
+
 /* Thread structure. */
 struct thread {
 	/*
@@ -73,6 +76,7 @@ struct thread {
 	char *t_name;			/* Name of this thread */
 	const char *t_wchan_name;	/* Name of wait channel, if sleeping */
 	threadstate_t t_state;		/* State this thread is in */
+	char t_namebuf[THREAD_NAMELEN];	/* t_name, unless it is too long */
 
 	/*
 	 * Thread subsystem internal fields.
@@ -102,6 +106,22 @@ struct thread {
 	int t_curspl;			/* Current spl*() state */
 	int t_iplhigh_count;		/* # of times IPL has been raised */
 
+	/*
+	 * Scheduler fields. Changed only by the thread itself, or with
+	 * its cpu's run queue lock held while it is not running.
+	 */
+	unsigned t_priority;		/* 0 (highest) .. SCHED_NPRIO-1 */
+	unsigned t_ticks;		/* hardclocks used of current quantum */
+	unsigned t_cputicks;		/* hardclocks used in total */
+	unsigned t_lastran;		/* t_cpu's c_hardclocks when it ran */
+
+	/*
+	 * Set by wchan_sleep_timeout while the thread is on a wait
+	 * channel, and cleared by whoever takes it off. Protected by
+	 * the wchan's spinlock.
+	 */
+	bool t_timedsleep;
+
 	/*
 	 * Public fields
 	 */
@@ -160,14 +180,22 @@ void thread_yield(void);
 
 void thread_destroy(struct thread *thread);
 
+/*
+ * Charge the current hardclock to the current thread. Returns true if
+ * it should yield, because its quantum ran out (and something else is
+ * waiting to run) or a higher-priority thread is waiting. Called from
+ * the timer interrupt.
+ */
+bool thread_tick(void);
+
 /*
  * Reshuffle the run queue. Called from the timer interrupt.
  */
 void schedule(void);
 
 /*
- * Potentially migrate ready threads to other CPUs. Called from the
- * timer interrupt.
+ * Make sure idle CPUs notice if this one has threads waiting to run.
+ * Called from the timer interrupt.
  */
 void thread_consider_migration(void);
 
@@ -58,5 +58,36 @@ void free_kpages(vaddr_t addr);
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown(const struct tlbshootdown *);
 
+/*
+ * Machine-dependent TLB operations used by the paging VM (not dumbvm).
+ *
+ *    vmtlb_activate   - make AS the address space translated on this
+ *                       CPU.
+ *    vmtlb_flushas    - forget every translation belonging to AS on
+ *                       every CPU, except that a CPU where AS is
+ *                       active must also call this itself.
+ *    vmtlb_flush      - invalidate every entry on this CPU.
+ *    vmtlb_load       - install VADDR -> ELO for the current address
+ *                       space, where ELO is a machine-format TLB low
+ *                       word.
+ *    vmtlb_invalidate - drop VADDR of the current address space from
+ *                       this CPU, if present.
+ */
+struct addrspace;
+void vmtlb_activate(struct addrspace *as);
+void vmtlb_flushas(struct addrspace *as);
+void vmtlb_flush(void);
+void vmtlb_load(vaddr_t vaddr, uint32_t elo);
+void vmtlb_invalidate(vaddr_t vaddr);
+
+/* Print per-cpu TLB statistics (paging VM only) */
+void vm_printtlbstats(void);
+
+/*
+ * Allocate a frame for a user page, evicting if necessary (paging VM
+ * only). See coremap_alloc_upage.
+ */
+paddr_t vm_alloc_upage(struct addrspace *as, vaddr_t vaddr);
+
 
 #endif /* _VM_H_ */
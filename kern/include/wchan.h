@@ -66,6 +66,14 @@ bool wchan_isempty(struct wchan *wc, struct spinlock *lk);
  */
 void wchan_sleep(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Like wchan_sleep, but wake up on our own after TICKS hardclocks
+ * (1/HZ seconds each) if nobody else has. Returns 0 if woken up,
+ * ETIMEDOUT if the time ran out.
+ */
+int wchan_sleep_timeout(struct wchan *wc, struct spinlock *lk,
+			unsigned ticks);
+
 /*
  * Wake up one thread, or all threads, sleeping on a wait channel.
  * The associated spinlock should be locked.
@@ -41,10 +41,19 @@
 #include <proc.h>
 #include <vfs.h>
 #include <sfs.h>
+#include <slab.h>
 #include <syscall.h>
 #include <test.h>
+#include <lockprof.h>
 #include "opt-sfs.h"
 #include "opt-net.h"
+#include "opt-dumbvm.h"
+#include "opt-lockprof.h"
+#if !OPT_DUMBVM
+#include <vm.h>
+#include <coremap.h>
+#include <swap.h>
+#endif
 
 /*
  * In-kernel menu and command dispatcher.
@@ -463,6 +472,7 @@ cmd_kheapstats(int nargs, char **args)
 	(void)args;
 
 	kheap_printstats();
+	kmem_cache_printstats();
 
 	return 0;
 }
@@ -496,6 +506,66 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+#if OPT_LOCKPROF
+static
+int
+cmd_lockprof(int nargs, char **args)
+{
+	if (nargs == 1) {
+		lockprof_printstats();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		lockprof_reset();
+	}
+	else {
+		kprintf("Usage: lp [reset]\n");
+	}
+
+	return 0;
+}
+#endif
+
+#if OPT_SFS
+static
+int
+cmd_bufstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	sfs_buf_printstats();
+
+	return 0;
+}
+#endif
+
+#if !OPT_DUMBVM
+static
+int
+cmd_coremapstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	coremap_printstats();
+	swap_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_tlbstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	vm_printtlbstats();
+
+	return 0;
+}
+#endif
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -562,9 +632,11 @@ static const char *testmenu[] = {
 	"[km2] kmalloc stress test           ",
 	"[km3] Large kmalloc test            ",
 	"[km4] Multipage kmalloc test        ",
+	"[km5] Page allocation throughput    ",
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
+	"[tt4] Thread fork/exit benchmark    ",
 #if OPT_NET
 	"[net] Network test                  ",
 #endif
@@ -572,6 +644,11 @@ static const char *testmenu[] = {
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
 	"[sy4] CV test #2            (1)     ",
+	"[sy5] Lock contention benchmark     ",
+	"[sy6] Spinlock fairness benchmark   ",
+	"[sy7] CV timed wait test    (1)     ",
+	"[rwt1] Rwlock stress test           ",
+	"[rwt2] Rwlock reader scalability    ",
 	"[semu1-22] Semaphore unit tests     ",
 	"[fs1] Filesystem test               ",
 	"[fs2] FS read stress                ",
@@ -579,6 +656,8 @@ static const char *testmenu[] = {
 	"[fs4] FS write stress 2             ",
 	"[fs5] FS long stress                ",
 	"[fs6] FS create stress              ",
+	"[fs7] FS sequential read speed      ",
+	"[fs8] FS write scaling              ",
 	NULL
 };
 
@@ -603,6 +682,16 @@ static const char *mainmenu[] = {
 	"[kh] Kernel heap stats              ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+#if OPT_LOCKPROF
+	"[lp] Lock contention stats          ",
+#endif
+#if OPT_SFS
+	"[bc] SFS buffer cache stats         ",
+#endif
+#if !OPT_DUMBVM
+	"[cm] Physical memory stats          ",
+	"[tlb] TLB stats                     ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -654,6 +743,16 @@ static struct {
 	{ "kh",         cmd_kheapstats },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+#if OPT_LOCKPROF
+	{ "lp",         cmd_lockprof },
+#endif
+#if OPT_SFS
+	{ "bc",         cmd_bufstats },
+#endif
+#if !OPT_DUMBVM
+	{ "cm",         cmd_coremapstats },
+	{ "tlb",        cmd_tlbstats },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -664,18 +763,25 @@ static struct {
 	{ "km2",	kmallocstress },
 	{ "km3",	kmalloctest3 },
 	{ "km4",	kmalloctest4 },
+	{ "km5",	kmalloctest5 },
 #if OPT_NET
 	{ "net",	nettest },
 #endif
 	{ "tt1",	threadtest },
 	{ "tt2",	threadtest2 },
 	{ "tt3",	threadtest3 },
+	{ "tt4",	threadtest4 },
 	{ "sy1",	semtest },
 
 	/* synchronization assignment tests */
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
 	{ "sy4",	cvtest2 },
+	{ "sy5",	lockbench },
+	{ "sy6",	spinbench },
+	{ "sy7",	timedwaittest },
+	{ "rwt1",	rwtest },
+	{ "rwt2",	rwtest2 },
 
 	/* semaphore unit tests */
 	{ "semu1",	semu1 },
@@ -708,6 +814,8 @@ static struct {
 	{ "fs4",	writestress2 },
 	{ "fs5",	longstress },
 	{ "fs6",	createstress },
+	{ "fs7",	readspeed },
+	{ "fs8",	writescale },
 
 	{ NULL, NULL }
 };
@@ -43,6 +43,8 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
+#include <limits.h>
 #include <spl.h>
 #include <proc.h>
 #include <current.h>
@@ -50,17 +52,41 @@
 #include <vnode.h>
 #include <syscall.h>
 #include <thread.h>
+#include <slab.h>
+
+/* Process structures come from their own object cache. */
+static struct kmem_cache *proc_cache;
 
 #if OPT_C2
 #include <synch.h>
 #include <kern/fcntl.h>
 #include <vfs.h>
+#include <mips/trapframe.h>
+
+/* Copies of the parent's trapframe that sys_fork hands to the child. */
+struct kmem_cache *proc_tfcache;
+
+/*
+ * The pid table maps pids to processes. Pids are small and dense, so
+ * the table is simply an array indexed by pid; it starts small and is
+ * doubled (up to PID_MAX) whenever it fills up. The free pids are kept
+ * on a FIFO list threaded through the unused slots, so allocating and
+ * releasing a pid are O(1), and a released pid is reused as late as
+ * possible.
+ */
+#define PIDTABLE_INITSIZE 64
+
+struct pidslot {
+  struct proc *ps_proc;   /* NULL if free */
+  pid_t ps_nextfree;      /* next pid on the free list, or 0 */
+};
 
-#define MAX_PROC 100
 static struct _processTable {
   int active;           /* initial value 0 */
-  struct proc *proc[MAX_PROC+1]; /* [0] not used. pids are >= 1 */
-  int last_i;           /* index of last allocated pid */
+  struct pidslot *slots; /* [0, PID_MIN) not used */
+  unsigned size;        /* number of slots */
+  pid_t freehead;       /* oldest free pid, or 0 */
+  pid_t freetail;       /* newest free pid, or 0 */
   struct spinlock lk;	/* Lock for this table */
 } processTable;
 
@@ -104,6 +130,98 @@ static int proc_remove_proc(struct proc *this, struct proc *father) {
     return -1;
 }
 
+#if OPT_C2
+/*
+ * Append PID to the free list. Call with the table locked.
+ */
+static void
+pidtable_putfree(pid_t pid) {
+  processTable.slots[pid].ps_proc = NULL;
+  processTable.slots[pid].ps_nextfree = 0;
+  if (processTable.freetail == 0) {
+    processTable.freehead = pid;
+  }
+  else {
+    processTable.slots[processTable.freetail].ps_nextfree = pid;
+  }
+  processTable.freetail = pid;
+}
+
+/*
+ * Grow the table to NEWSLOTS, of NEWSIZE entries. Call with the table
+ * locked; returns the array to kfree once the lock is released (the old
+ * one, or NEWSLOTS itself if someone else grew the table meanwhile).
+ */
+static struct pidslot *
+pidtable_grow(struct pidslot *newslots, unsigned newsize) {
+  struct pidslot *oldslots;
+  unsigned i;
+
+  if (newsize <= processTable.size) {
+    return newslots;
+  }
+  for (i=0; i<processTable.size; i++) {
+    newslots[i] = processTable.slots[i];
+  }
+  oldslots = processTable.slots;
+  processTable.slots = newslots;
+  i = processTable.size < PID_MIN ? PID_MIN : processTable.size;
+  processTable.size = newsize;
+  for (; i<newsize; i++) {
+    pidtable_putfree(i);
+  }
+  return oldslots;
+}
+
+/*
+ * Give PROC a pid. Returns 0 if all PID_MAX pids are in use (or the
+ * table can't grow).
+ */
+static pid_t
+pidtable_alloc(struct proc *proc) {
+  struct pidslot *newslots;
+  unsigned newsize;
+  pid_t pid;
+
+  spinlock_acquire(&processTable.lk);
+  while (processTable.freehead == 0) {
+    if (processTable.size > PID_MAX) {
+      spinlock_release(&processTable.lk);
+      return 0;
+    }
+    newsize = processTable.size * 2;
+    if (newsize < PIDTABLE_INITSIZE) {
+      newsize = PIDTABLE_INITSIZE;
+    }
+    if (newsize > PID_MAX + 1) {
+      newsize = PID_MAX + 1;
+    }
+    /* can't allocate with the spinlock held */
+    spinlock_release(&processTable.lk);
+    newslots = kmalloc(newsize * sizeof(struct pidslot));
+    if (newslots == NULL) {
+      return 0;
+    }
+    spinlock_acquire(&processTable.lk);
+    newslots = pidtable_grow(newslots, newsize);
+    spinlock_release(&processTable.lk);
+    kfree(newslots);
+    spinlock_acquire(&processTable.lk);
+  }
+
+  pid = processTable.freehead;
+  processTable.freehead = processTable.slots[pid].ps_nextfree;
+  if (processTable.freehead == 0) {
+    processTable.freetail = 0;
+  }
+  KASSERT(processTable.slots[pid].ps_proc == NULL);
+  processTable.slots[pid].ps_proc = proc;
+  spinlock_release(&processTable.lk);
+
+  return pid;
+}
+#endif
+
 /*
  * G.Cabodi - 2019
  * Initialize support for pid/waitpid.
@@ -111,13 +229,15 @@ static int proc_remove_proc(struct proc *this, struct proc *father) {
 struct proc *
 proc_search_pid(pid_t pid) {
 #if OPT_C2
-  struct proc *p;
-  if(pid>MAX_PROC){
-	return NULL;
+  struct proc *p = NULL;
+
+  spinlock_acquire(&processTable.lk);
+  if (pid >= PID_MIN && (unsigned)pid < processTable.size) {
+    p = processTable.slots[pid].ps_proc;
   }
-  KASSERT(pid>=0&&pid<MAX_PROC);
-  p = processTable.proc[pid];
-  KASSERT(p->p_pid==pid);
+  /* check under the lock: once it's dropped, p may be freed and reused */
+  KASSERT(p == NULL || p->p_pid == pid);
+  spinlock_release(&processTable.lk);
   return p;
 #else
   (void)pid;
@@ -128,29 +248,14 @@ proc_search_pid(pid_t pid) {
 /*
  * G.Cabodi - 2019
  * Initialize support for pid/waitpid.
+ * Returns ENPROC if no pid is available.
  */
-static void
+static int
 proc_init_waitpid(struct proc *proc, const char *name) {
 #if OPT_C2
-  /* search a free index in table using a circular strategy */
-  int i;
-  spinlock_acquire(&processTable.lk);
-  i = processTable.last_i+1;
-  proc->p_pid = 0;
-  if (i>MAX_PROC) i=1;
-  while (i!=processTable.last_i) {
-    if (processTable.proc[i] == NULL) {
-      processTable.proc[i] = proc;
-      processTable.last_i = i;
-      proc->p_pid = i;
-      break;
-    }
-    i++;
-    if (i>MAX_PROC) i=1;
-  }
-  spinlock_release(&processTable.lk);
-  if (proc->p_pid==0) {
-    panic("too many processes. proc table is full\n");
+  proc->p_pid = pidtable_alloc(proc);
+  if (proc->p_pid == 0) {
+    return ENPROC;
   }
   proc->p_status = 0;
 #if USE_SEMAPHORE_FOR_WAITPID
@@ -163,30 +268,22 @@ proc_init_waitpid(struct proc *proc, const char *name) {
   (void)proc;
   (void)name;
 #endif
+  return 0;
 }
+#if OPT_C2
 /*
- * Verify if there's a pid available for a new process to be created
+ * Check whether every pid is in use. Only meant for choosing an error
+ * code after proc creation failed; the answer may be stale by the time
+ * it is returned.
  */
-#if OPT_C2
-int proc_verify_pid(){
-  int i,pid=0;
+bool
+proc_pids_exhausted(void) {
+  bool full;
+
   spinlock_acquire(&processTable.lk);
-  i = processTable.last_i+1;
-  if (i>MAX_PROC) i=1;
-  while (i!=processTable.last_i) {
-    if (processTable.proc[i] == NULL) {
-    	//No assignment needed
-      	pid = i;
-      	break;
-    }
-    i++;
-    if (i>MAX_PROC) i=1;
-  }
+  full = processTable.freehead == 0 && processTable.size > PID_MAX;
   spinlock_release(&processTable.lk);
-  if (pid==0) {
-    return -1;
-  }
-  return 0;
+  return full;
 }
 #endif
 /*
@@ -197,11 +294,12 @@ static void
 proc_end_waitpid(struct proc *proc) {
 #if OPT_C2
   /* remove the process from the table */
-  int i;
+  pid_t pid;
   spinlock_acquire(&processTable.lk);
-  i = proc->p_pid;
-  KASSERT(i>0 && i<=MAX_PROC);
-  processTable.proc[i] = NULL;
+  pid = proc->p_pid;
+  KASSERT(pid >= PID_MIN && (unsigned)pid < processTable.size);
+  KASSERT(processTable.slots[pid].ps_proc == proc);
+  pidtable_putfree(pid);
   spinlock_release(&processTable.lk);
 
 #if USE_SEMAPHORE_FOR_WAITPID
@@ -242,7 +340,7 @@ static int std_init(struct proc *proc, int fd, int mode) {
 
 	/* Values initialization */
 	proc->fileTable[fd]->offset = 0;
-	proc->fileTable[fd]->lock = lock_create("std");
+	proc->fileTable[fd]->lock = lock_create_adaptive("std");
 	if (proc->fileTable[fd]->lock == NULL) {
 		vfs_close(proc->fileTable[fd]->vn);
 		kfree(proc->fileTable[fd]);
@@ -264,13 +362,13 @@ proc_create(const char *name)
 {
 	struct proc *proc;
 
-	proc = kmalloc(sizeof(*proc));
+	proc = kmem_cache_alloc(proc_cache);
 	if (proc == NULL) {
 		return NULL;
 	}
 	proc->p_name = kstrdup(name);
 	if (proc->p_name == NULL) {
-		kfree(proc);
+		kmem_cache_free(proc_cache, proc);
 		return NULL;
 	}
 
@@ -285,7 +383,12 @@ proc_create(const char *name)
 	/* VFS fields */
 	proc->p_cwd = NULL;
 	proc->p_terminated = 0; // Initialize it to zero, it is set to 1 once the process terminates
-	proc_init_waitpid(proc, name);
+	if (proc_init_waitpid(proc, name)) {
+		spinlock_cleanup(&proc->p_lock);
+		kfree(proc->p_name);
+		kmem_cache_free(proc_cache, proc);
+		return NULL;
+	}
 
 #if OPT_C2
 	bzero(proc->fileTable, OPEN_MAX * sizeof(struct openfile *));
@@ -428,8 +531,10 @@ proc_destroy(struct proc *proc)
 
 	proc_end_waitpid(proc);
 
+	/* takes p_lock off the lockprof list, if it got there */
+	spinlock_cleanup(&proc->p_lock);
 	kfree(proc->p_name);
-	kfree(proc);
+	kmem_cache_free(proc_cache, proc);
 }
 
 /*
@@ -438,13 +543,24 @@ proc_destroy(struct proc *proc)
 void
 proc_bootstrap(void)
 {
+	proc_cache = kmem_cache_create("proc", sizeof(struct proc), 0, NULL);
+	if (proc_cache == NULL) {
+		panic("proc_bootstrap: Out of memory\n");
+	}
+#if OPT_C2
+	proc_tfcache = kmem_cache_create("trapframe",
+					 sizeof(struct trapframe), 0, NULL);
+	if (proc_tfcache == NULL) {
+		panic("proc_bootstrap: Out of memory\n");
+	}
+	/* the table itself is allocated on first use */
+	spinlock_init(&processTable.lk);
+#endif
 	kproc = proc_create("[kernel]");
 	if (kproc == NULL) {
 		panic("proc_create for kproc failed\n");
 	}
 #if OPT_C2
-	spinlock_init(&processTable.lk);
-	/* kernel process is not registered in the table */
 	processTable.active = 1;
 #endif
 }
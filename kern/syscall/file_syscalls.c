@@ -23,6 +23,9 @@
 /* max num of system wide open files */
 #define SYSTEM_OPEN_MAX (10*OPEN_MAX)
 
+/* largest readv/writev total whose size fits in the return value */
+#define RWV_MAX 0x7fffffff
+
 
 
 struct openfile systemFileTable[SYSTEM_OPEN_MAX];
@@ -32,120 +35,198 @@ void openfileIncrRefCount(struct openfile *of) {
         of->countRef++;
 }
 
-int sys_write(int fd, userptr_t buf_ptr, size_t size, int *err) {
-    struct iovec iov;
-    struct uio ku;
-    int result, nwrite;
-    struct vnode *vn;
-    struct openfile *of;
-    void *kbuf;
+/*
+ * read and write move data directly between the file and the user
+ * buffer: the uio is built over the user's memory (UIO_USERSPACE), so
+ * uiomove does the copyin/copyout page by page and no kernel bounce
+ * buffer is needed, whatever the size of the transfer. A bad user
+ * pointer shows up as EFAULT from the VOP.
+ *
+ * readv/writev do the same over several user buffers in one VOP call;
+ * pread/pwrite take the offset as an argument and so leave the shared
+ * file offset, and the openfile lock that protects it, alone.
+ */
 
+/*
+ * Get the open file FD, checking that it is open for RW.
+ */
+static int file_get(int fd, enum uio_rw rw, struct openfile **ret) {
+    struct openfile *of;
 
-    if (fd < 0 || fd > OPEN_MAX){
-        *err = EBADF;
-        return -1;
-    } 
+    if (fd < 0 || fd >= OPEN_MAX) {
+        return EBADF;
+    }
     of = curproc->fileTable[fd];
-    if (of == NULL){
-        *err=EBADF;
-        return -1;
+    if (of == NULL || of->vn == NULL) {
+        return EBADF;
     }
-    if(of->mode_open != O_WRONLY && of->mode_open!=O_RDWR){
-        *err= EBADF;
-        return -1;
+    if (rw == UIO_READ) {
+        if (of->mode_open != O_RDONLY && of->mode_open != O_RDWR) {
+            return EBADF;
+        }
+    } else {
+        if (of->mode_open != O_WRONLY && of->mode_open != O_RDWR) {
+            return EBADF;
+        }
     }
-    vn = of->vn;
-    if (vn == NULL){
-        *err=EBADF;
-        return -1;
-    } 
+    *ret = of;
+    return 0;
+}
 
-    
-    kbuf = kmalloc(size);
-    if(kbuf==NULL){
-        *err = ENOMEM;
-        return -1;
+/*
+ * Set up U to transfer RESID bytes between the user buffers IOV[0..IOVCNT)
+ * and the file at POS.
+ */
+static void file_uinit(struct uio *u, struct iovec *iov, unsigned iovcnt,
+                       size_t resid, off_t pos, enum uio_rw rw) {
+    u->uio_iov = iov;
+    u->uio_iovcnt = iovcnt;
+    u->uio_resid = resid;
+    u->uio_offset = pos;
+    u->uio_segflg = UIO_USERSPACE;
+    u->uio_rw = rw;
+    u->uio_space = proc_getas();
+}
+
+/*
+ * Do the transfer U on OF. Unless POSITIONAL, it starts at, and
+ * advances, the file's offset. Returns the number of bytes moved, or -1
+ * with *err set.
+ */
+static int file_rw(struct openfile *of, struct uio *u, bool positional,
+                   int *err) {
+    size_t size;
+    int result;
+
+    size = u->uio_resid;
+
+    if (positional) {
+        if (!VOP_ISSEEKABLE(of->vn)) {
+            *err = ESPIPE;
+            return -1;
+        }
+        if (u->uio_offset < 0) {
+            *err = EINVAL;
+            return -1;
+        }
+    } else {
+        lock_acquire(of->lock);
+        u->uio_offset = of->offset;
     }
-    if(copyin(buf_ptr, kbuf, size)){
-        *err=EFAULT; //buf is outside the accessible address space
-        kfree(kbuf);
-        return -1;
+
+    if (u->uio_rw == UIO_READ) {
+        result = VOP_READ(of->vn, u);
+    } else {
+        result = VOP_WRITE(of->vn, u);
+    }
+
+    if (!positional) {
+        if (result == 0) {
+            of->offset = u->uio_offset;
+        }
+        lock_release(of->lock);
     }
-    lock_acquire(of->lock); //writing acquiring the lock to be the only one doing it
-    uio_kinit(&iov, &ku, kbuf, size, of->offset, UIO_WRITE);
-    
-    result = VOP_WRITE(vn, &ku);
     if (result) {
-        kfree(kbuf);
-        *err=result;
+        *err = result;
         return -1;
     }
-    kfree(kbuf);
-    of->offset = ku.uio_offset;
-    nwrite = size - ku.uio_resid;
-    lock_release(of->lock);
-    return nwrite;
+    return size - u->uio_resid;
 }
 
-int sys_read(int fd, userptr_t buf_ptr, size_t size, int *err) {
+/*
+ * Common part of read/write and pread/pwrite.
+ */
+static int file_rw1(int fd, userptr_t buf_ptr, size_t size, bool positional,
+                    off_t pos, enum uio_rw rw, int *err) {
     struct iovec iov;
-    struct uio ku;
-    int result, nread;
-    struct vnode *vn;
+    struct uio u;
     struct openfile *of;
-    void *kbuf;
+    int result;
 
-    if (fd < 0 || fd >= OPEN_MAX) {
-        *err = EBADF;
-        return -1;
-    } 
-    of = curproc->fileTable[fd];
-    if (of == NULL) {
-        *err = EBADF;
+    result = file_get(fd, rw, &of);
+    if (result) {
+        *err = result;
         return -1;
     }
-    if (of->mode_open != O_RDONLY && of->mode_open != O_RDWR) {
-        *err = EBADF;
+
+    iov.iov_ubase = buf_ptr;
+    iov.iov_len = size;
+    file_uinit(&u, &iov, 1, size, pos, rw);
+
+    return file_rw(of, &u, positional, err);
+}
+
+/*
+ * Common part of readv/writev.
+ */
+static int file_rwv(int fd, userptr_t iov_ptr, int iovcnt, enum uio_rw rw,
+                    int *err) {
+    struct iovec *iov;
+    struct uio u;
+    struct openfile *of;
+    size_t resid;
+    int i, result, ret;
+
+    result = file_get(fd, rw, &of);
+    if (result) {
+        *err = result;
         return -1;
     }
-    vn = of->vn;
-    if (vn == NULL) {
-        *err = EBADF;
+    if (iovcnt <= 0 || iovcnt > IOV_MAX) {
+        *err = EINVAL;
         return -1;
     }
 
-   
-    kbuf = kmalloc(size);
-    if (kbuf == NULL) {
+    iov = kmalloc(iovcnt * sizeof(struct iovec));
+    if (iov == NULL) {
         *err = ENOMEM;
         return -1;
     }
-    //Trying to copy the content of the user buffer in a Kernel buffer to make it check its validity
-    if (copyin(buf_ptr, kbuf, size)) {
-        kfree(kbuf);
-        *err = EFAULT;
-        return -1;
-    }
-
-    lock_acquire(of->lock);
-
-    uio_kinit(&iov, &ku, kbuf, size, of->offset, UIO_READ);
-    result = VOP_READ(vn, &ku);
-
+    result = copyin(iov_ptr, iov, iovcnt * sizeof(struct iovec));
     if (result) {
-        kfree(kbuf);
+        kfree(iov);
         *err = result;
         return -1;
     }
-    of->offset = ku.uio_offset;
-    nread = size - ku.uio_resid;
-    if (copyout(kbuf, buf_ptr, nread)) {
-        *err = EFAULT;
-        return -1;
+
+    resid = 0;
+    for (i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len > RWV_MAX - resid) {
+            kfree(iov);
+            *err = EINVAL;
+            return -1;
+        }
+        resid += iov[i].iov_len;
     }
-    lock_release(of->lock);
-    kfree(kbuf);
-    return nread;
+
+    file_uinit(&u, iov, iovcnt, resid, 0, rw);
+    ret = file_rw(of, &u, false, err);
+    kfree(iov);
+    return ret;
+}
+
+int sys_write(int fd, userptr_t buf_ptr, size_t size, int *err) {
+    return file_rw1(fd, buf_ptr, size, false, 0, UIO_WRITE, err);
+}
+
+int sys_read(int fd, userptr_t buf_ptr, size_t size, int *err) {
+    return file_rw1(fd, buf_ptr, size, false, 0, UIO_READ, err);
+}
+
+int sys_pwrite(int fd, userptr_t buf_ptr, size_t size, off_t pos, int *err) {
+    return file_rw1(fd, buf_ptr, size, true, pos, UIO_WRITE, err);
+}
+
+int sys_pread(int fd, userptr_t buf_ptr, size_t size, off_t pos, int *err) {
+    return file_rw1(fd, buf_ptr, size, true, pos, UIO_READ, err);
+}
+
+int sys_writev(int fd, userptr_t iov_ptr, int iovcnt, int *err) {
+    return file_rwv(fd, iov_ptr, iovcnt, UIO_WRITE, err);
+}
+
+int sys_readv(int fd, userptr_t iov_ptr, int iovcnt, int *err) {
+    return file_rwv(fd, iov_ptr, iovcnt, UIO_READ, err);
 }
 
 
@@ -246,7 +327,7 @@ int sys_open(userptr_t path, int openflags, mode_t mode, int *errp) {
             return EINVAL;
     }
 
-    of->lock = lock_create("file_lock");
+    of->lock = lock_create_adaptive("file_lock");
     if (of->lock == NULL) {
         curproc->fileTable[fd] = NULL;
         vfs_close(v);
@@ -60,6 +60,7 @@
 #include <vnode.h>
 #include <elf.h>
 
+#if OPT_DUMBVM
 /*
  * Load a segment at virtual address VADDR. The segment in memory
  * extends from VADDR up to (but not including) VADDR+MEMSIZE. The
@@ -144,6 +145,7 @@ load_segment(struct addrspace *as, struct vnode *v,
 
 	return result;
 }
+#endif /* OPT_DUMBVM */
 
 /*
  * Load an ELF executable user program into the current address space.
@@ -288,9 +290,23 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 			return ENOEXEC;
 		}
 
+#if OPT_DUMBVM
 		result = load_segment(as, v, ph.p_offset, ph.p_vaddr,
 				      ph.p_memsz, ph.p_filesz,
 				      ph.p_flags & PF_X);
+#else
+		/*
+		 * Don't read anything now; just tell the VM system
+		 * where the pages come from so vm_fault can load
+		 * them when they are first touched.
+		 */
+		if (ph.p_filesz > ph.p_memsz) {
+			kprintf("ELF: warning: segment filesize > segment memsize\n");
+			ph.p_filesz = ph.p_memsz;
+		}
+		result = as_define_backing(as, ph.p_vaddr, ph.p_filesz,
+					   v, ph.p_offset);
+#endif
 		if (result) {
 			return result;
 		}
@@ -18,6 +18,7 @@
 #include <mips/trapframe.h>
 #include <current.h>
 #include <synch.h>
+#include <slab.h>
 #include <kern/wait.h>
 
 
@@ -140,9 +141,11 @@ sys_getpid(void)
 #if OPT_C2
 static void
 call_enter_forked_process(void *tfv, unsigned long dummy) {
-  struct trapframe *tf = (struct trapframe *)tfv;
+  /* take our own copy so the cached one can go back right away */
+  struct trapframe tf = *(struct trapframe *)tfv;
   (void)dummy;
-  enter_forked_process(tf); 
+  kmem_cache_free(proc_tfcache, tfv);
+  enter_forked_process(&tf); 
   panic("enter_forked_process returned (should not happen)\n");
 }
 
@@ -150,14 +153,11 @@ int sys_fork(struct trapframe *ctf, pid_t *retval) {
   struct trapframe *tf_child;
   struct proc *newp;
   int result;
-  /*It's not acceptable that it crashes if there are already too many processes, It has to return the correct error*/
   KASSERT(curproc != NULL);
-  if(proc_verify_pid()==-1){ 
-    return ENPROC; 
-  }
+  /*It's not acceptable that it crashes if there are already too many processes, It has to return the correct error*/
   newp = proc_create_runprogram(curproc->p_name);
   if (newp == NULL) {
-    return ENOMEM;
+    return proc_pids_exhausted() ? ENPROC : ENOMEM;
   }
 
   /* done here as we need to duplicate the address space 
@@ -171,7 +171,7 @@ int sys_fork(struct trapframe *ctf, pid_t *retval) {
   proc_file_table_copy(newp,curproc);
 
   /* we need a copy of the parent's trapframe */
-  tf_child = kmalloc(sizeof(struct trapframe));
+  tf_child = kmem_cache_alloc(proc_tfcache);
   if(tf_child == NULL){
     proc_destroy(newp);
     return ENOMEM; 
@@ -182,6 +182,8 @@ int sys_fork(struct trapframe *ctf, pid_t *retval) {
   
   struct child_node *newChild = kmalloc(sizeof(struct child_node));
   if(newChild == NULL){
+    kmem_cache_free(proc_tfcache, tf_child);
+    proc_destroy(newp);
     return ENOMEM;
   }
   //Chil added to the children list of the father
@@ -198,7 +200,7 @@ int sys_fork(struct trapframe *ctf, pid_t *retval) {
 
   if (result){
     proc_destroy(newp);
-    kfree(tf_child);
+    kmem_cache_free(proc_tfcache, tf_child);
     return ENOMEM;
   }
 
@@ -28,6 +28,7 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <clock.h>
 #include <copyinout.h>
 #include <syscall.h>
@@ -56,3 +57,37 @@ sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
 
 	return 0;
 }
+
+/*
+ * Sleep for the time in the timespec at USER_REQ, rounded up to whole
+ * hardclock ticks. Nothing can interrupt the sleep, so the time left,
+ * which would go to USER_REM, is never reported.
+ */
+int
+sys_nanosleep(const_userptr_t user_req, userptr_t user_rem)
+{
+	struct timespec req;
+	uint64_t ticks;
+	unsigned chunk;
+	int result;
+
+	(void)user_rem;
+
+	result = copyin(user_req, &req, sizeof(req));
+	if (result) {
+		return result;
+	}
+	if (req.tv_sec < 0 || req.tv_nsec < 0 || req.tv_nsec >= 1000000000) {
+		return EINVAL;
+	}
+
+	ticks = (uint64_t)req.tv_sec * HZ +
+		(req.tv_nsec + 1000000000 / HZ - 1) / (1000000000 / HZ);
+	while (ticks > 0) {
+		chunk = ticks < 0xffffffff ? ticks : 0xffffffff;
+		clocksleep_ticks(chunk);
+		ticks -= chunk;
+	}
+
+	return 0;
+}
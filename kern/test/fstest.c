@@ -42,6 +42,7 @@
 #include <kern/errno.h>
 #include <kern/fcntl.h>
 #include <lib.h>
+#include <clock.h>
 #include <uio.h>
 #include <thread.h>
 #include <synch.h>
@@ -56,6 +57,8 @@
 #define NTHREADS 12
 #define NLONG    32
 #define NCREATE  24
+#define SPEEDSIZE  (384*1024)
+#define SPEEDCHUNK 4096
 
 static struct semaphore *threadsem = NULL;
 
@@ -674,6 +677,207 @@ docreatestress(const char *filesys)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Sequential read speed: write a file several times the size of the
+ * buffer cache, then time reading it back from the start, so most
+ * of it has to come off the disk.
+ */
+
+static
+int
+readspeed_rw(struct vnode *vn, char *buf, enum uio_rw rw,
+	     unsigned long *msecs)
+{
+	struct timespec before, after;
+	struct iovec iov;
+	struct uio ku;
+	off_t pos;
+	unsigned i;
+	int err;
+
+	gettime(&before);
+	for (pos = 0; pos < SPEEDSIZE; pos += SPEEDCHUNK) {
+		if (rw == UIO_WRITE) {
+			for (i=0; i<SPEEDCHUNK; i++) {
+				buf[i] = (pos + i) % 251;
+			}
+		}
+		uio_kinit(&iov, &ku, buf, SPEEDCHUNK, pos, rw);
+		err = (rw == UIO_WRITE) ? VOP_WRITE(vn, &ku) : VOP_READ(vn, &ku);
+		if (err) {
+			kprintf("readspeed: %s error: %s\n",
+				rw == UIO_WRITE ? "Write" : "Read",
+				strerror(err));
+			return -1;
+		}
+		if (ku.uio_resid > 0) {
+			kprintf("readspeed: Short %s at %lu\n",
+				rw == UIO_WRITE ? "write" : "read",
+				(unsigned long) pos);
+			return -1;
+		}
+		if (rw == UIO_READ) {
+			for (i=0; i<SPEEDCHUNK; i++) {
+				if (buf[i] != (char)((pos + i) % 251)) {
+					kprintf("readspeed: Test failed: "
+						"byte %lu mismatched\n",
+						(unsigned long)(pos + i));
+					return -1;
+				}
+			}
+		}
+	}
+	gettime(&after);
+
+	timespec_sub(&after, &before, &after);
+	*msecs = after.tv_sec * 1000 + after.tv_nsec / 1000000;
+	return 0;
+}
+
+static
+void
+doreadspeed(const char *filesys)
+{
+	struct vnode *vn;
+	unsigned long msecs;
+	char name[32];
+	char *buf;
+	int err;
+
+	kprintf("*** Starting fs read speed test on %s:\n", filesys);
+
+	buf = kmalloc(SPEEDCHUNK);
+	if (buf == NULL) {
+		kprintf("*** Out of memory\n");
+		return;
+	}
+
+	fstest_makename(name, sizeof(name), filesys, "");
+	err = vfs_open(name, O_RDWR|O_CREAT|O_TRUNC, 0664, &vn);
+	if (err) {
+		kprintf("Could not create test file: %s\n", strerror(err));
+		kprintf("*** Test failed\n");
+		kfree(buf);
+		return;
+	}
+
+	if (readspeed_rw(vn, buf, UIO_WRITE, &msecs)) {
+		vfs_close(vn);
+		kfree(buf);
+		fstest_remove(filesys, "");
+		kprintf("*** Test failed\n");
+		return;
+	}
+	kprintf("readspeed: %u KB written in %lu ms\n",
+		SPEEDSIZE / 1024, msecs);
+
+	if (readspeed_rw(vn, buf, UIO_READ, &msecs)) {
+		vfs_close(vn);
+		kfree(buf);
+		fstest_remove(filesys, "");
+		kprintf("*** Test failed\n");
+		return;
+	}
+	kprintf("readspeed: %u KB read in %lu ms", SPEEDSIZE / 1024, msecs);
+	if (msecs > 0) {
+		kprintf(" (%lu KB/s)", (SPEEDSIZE / 1024) * 1000UL / msecs);
+	}
+	kprintf("\n");
+
+	vfs_close(vn);
+	kfree(buf);
+
+	if (fstest_remove(filesys, "")) {
+		kprintf("*** Test failed\n");
+		return;
+	}
+
+	kprintf("*** fs read speed test done\n");
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Write scaling: write NTHREADS files one after another, then the
+ * same files from NTHREADS threads at once, and compare the times.
+ * With per-file locking in the filesystem the second should be
+ * faster, since the threads' disk waits overlap.
+ */
+
+static
+int
+writescale_one(const char *filesys, unsigned long num)
+{
+	char numstr[8];
+
+	snprintf(numstr, sizeof(numstr), "%lu", num);
+	if (fstest_write(filesys, numstr, 1, 0)) {
+		return -1;
+	}
+	if (fstest_remove(filesys, numstr)) {
+		return -1;
+	}
+	return 0;
+}
+
+static
+void
+writescale_thread(void *fs, unsigned long num)
+{
+	if (writescale_one(fs, num)) {
+		kprintf("*** Thread %lu: failed\n", num);
+	}
+	V(threadsem);
+}
+
+static
+void
+dowritescale(const char *filesys)
+{
+	struct timespec before, after, serial, parallel;
+	int i, err;
+
+	init_threadsem();
+
+	kprintf("*** Starting fs write scaling test on %s:\n", filesys);
+
+	gettime(&before);
+	for (i=0; i<NTHREADS; i++) {
+		if (writescale_one(filesys, i)) {
+			kprintf("*** Test failed\n");
+			return;
+		}
+	}
+	gettime(&after);
+	timespec_sub(&after, &before, &serial);
+
+	gettime(&before);
+	for (i=0; i<NTHREADS; i++) {
+		err = thread_fork("writescale", NULL,
+				  writescale_thread, (char *)filesys, i);
+		if (err) {
+			panic("thread_fork failed %s\n", strerror(err));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(threadsem);
+	}
+	gettime(&after);
+	timespec_sub(&after, &before, &parallel);
+
+	kprintf("writescale: %d files, 1 thread: %lu ms\n", NTHREADS,
+		(unsigned long)(serial.tv_sec * 1000 +
+				serial.tv_nsec / 1000000));
+	kprintf("writescale: %d files, %d threads: %lu ms\n",
+		NTHREADS, NTHREADS,
+		(unsigned long)(parallel.tv_sec * 1000 +
+				parallel.tv_nsec / 1000000));
+
+	kprintf("*** fs write scaling test done\n");
+}
+
+////////////////////////////////////////////////////////////
+
 static
 int
 checkfilesystem(int nargs, char **args)
@@ -681,7 +885,7 @@ checkfilesystem(int nargs, char **args)
 	char *device;
 
 	if (nargs != 2) {
-		kprintf("Usage: fs[123456] filesystem:\n");
+		kprintf("Usage: fs[12345678] filesystem:\n");
 		return EINVAL;
 	}
 
@@ -714,6 +918,8 @@ DEFTEST(writestress);
 DEFTEST(writestress2);
 DEFTEST(longstress);
 DEFTEST(createstress);
+DEFTEST(readspeed);
+DEFTEST(writescale);
 
 ////////////////////////////////////////////////////////////
 
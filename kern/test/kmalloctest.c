@@ -35,6 +35,7 @@
 #include <lib.h>
 #include <thread.h>
 #include <synch.h>
+#include <clock.h>
 #include <vm.h> /* for PAGE_SIZE */
 #include <test.h>
 
@@ -378,3 +379,95 @@ kmalloctest4(int nargs, char **args)
 	kprintf("Multipage kmalloc test done\n");
 	return 0;
 }
+
+////////////////////////////////////////////////////////////
+// km5
+
+/*
+ * Page allocator throughput: NTHREADS threads each repeatedly grab
+ * KM5_PAGES single pages straight from alloc_kpages and give them
+ * back, and we report how many page allocations per second the
+ * system as a whole managed. Run it with more than one cpu to see
+ * how well single-page allocation scales.
+ */
+
+#define KM5_ROUNDS  2000
+#define KM5_PAGES   8
+
+static
+void
+kmalloctest5thread(void *sm, unsigned long num)
+{
+	struct semaphore *sem = sm;
+	vaddr_t pages[KM5_PAGES];
+	unsigned i, j;
+
+	for (i=0; i<KM5_ROUNDS; i++) {
+		for (j=0; j<KM5_PAGES; j++) {
+			pages[j] = alloc_kpages(1);
+			if (pages[j] == 0) {
+				panic("kmalloctest5: thread %lu: "
+				      "out of pages\n", num);
+			}
+			/* touch it, so it's a real page */
+			*(volatile unsigned *)pages[j] = num;
+		}
+		for (j=0; j<KM5_PAGES; j++) {
+			free_kpages(pages[j]);
+		}
+	}
+
+	V(sem);
+}
+
+int
+kmalloctest5(int nargs, char **args)
+{
+	struct semaphore *sem;
+	struct timespec before, after;
+	unsigned long msecs, total;
+	unsigned i;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting page allocation throughput test...\n");
+
+	sem = sem_create("kmalloctest5", 0);
+	if (sem == NULL) {
+		panic("kmalloctest5: sem_create failed\n");
+	}
+
+	gettime(&before);
+
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("kmalloctest5", NULL,
+				     kmalloctest5thread, sem, i);
+		if (result) {
+			panic("kmalloctest5: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	for (i=0; i<NTHREADS; i++) {
+		P(sem);
+	}
+
+	gettime(&after);
+	timespec_sub(&after, &before, &after);
+
+	sem_destroy(sem);
+
+	total = (unsigned long)NTHREADS * KM5_ROUNDS * KM5_PAGES;
+	msecs = after.tv_sec * 1000 + after.tv_nsec / 1000000;
+	kprintf("%lu page allocations in %llu.%09lu seconds",
+		total, (unsigned long long)after.tv_sec,
+		(unsigned long)after.tv_nsec);
+	if (msecs > 0) {
+		kprintf(" (%lu per second)", total * 1000 / msecs);
+	}
+	kprintf("\n");
+	kprintf("Page allocation throughput test done\n");
+	return 0;
+}
@@ -0,0 +1,257 @@
+/*
+ * Reader-writer lock tests.
+ *
+ * rwt1 is a stress test: readers check that a set of values is
+ * consistent while writers change them, under the rwlock.
+ *
+ * rwt2 measures how reading scales: the same read-only workload is
+ * run once with everyone taking the lock for reading and once with
+ * everyone taking it for writing (that is, exclusively). With more
+ * than one cpu, the first should be faster by roughly the number of
+ * cpus.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+#define RWT_READERS	12
+#define RWT_WRITERS	4
+#define RWT_LOOPS	400
+#define RWT_NVALS	16
+
+static struct rwlock *rwt_lock;
+static struct semaphore *rwt_donesem;
+static volatile unsigned long rwt_vals[RWT_NVALS];
+static volatile unsigned rwt_maxreaders;
+static volatile bool rwt_failed;
+
+static
+void
+rwt_init(void)
+{
+	unsigned i;
+
+	rwt_lock = rwlock_create("rwtest");
+	rwt_donesem = sem_create("rwtest-done", 0);
+	if (rwt_lock == NULL || rwt_donesem == NULL) {
+		panic("rwtest: out of memory\n");
+	}
+	for (i=0; i<RWT_NVALS; i++) {
+		rwt_vals[i] = 0;
+	}
+	rwt_maxreaders = 0;
+	rwt_failed = false;
+}
+
+static
+void
+rwt_cleanup(void)
+{
+	sem_destroy(rwt_donesem);
+	rwlock_destroy(rwt_lock);
+	rwt_donesem = NULL;
+	rwt_lock = NULL;
+}
+
+/* Spin a little, to widen the windows for races. */
+static
+void
+rwt_delay(unsigned long n)
+{
+	volatile unsigned long junk;
+	unsigned long i;
+
+	for (i=0; i<n; i++) {
+		junk = i;
+	}
+	(void)junk;
+}
+
+////////////////////////////////////////////////////////////
+// rwt1
+
+static
+void
+rwt1reader(void *junk, unsigned long num)
+{
+	unsigned long first;
+	unsigned i, j;
+
+	(void)junk;
+
+	for (i=0; i<RWT_LOOPS; i++) {
+		rwlock_acquire_read(rwt_lock);
+		/* peek at the count; racy, only for the report */
+		if (rwt_lock->rw_readers > rwt_maxreaders) {
+			rwt_maxreaders = rwt_lock->rw_readers;
+		}
+		first = rwt_vals[0];
+		for (j=1; j<RWT_NVALS; j++) {
+			if (rwt_vals[j] != first) {
+				kprintf("rwt1: reader %lu: value %u is %lu, "
+					"expected %lu\n", num, j,
+					rwt_vals[j], first);
+				rwt_failed = true;
+				break;
+			}
+			rwt_delay(10);
+		}
+		rwlock_release_read(rwt_lock);
+		rwt_delay(num * 10);
+	}
+	V(rwt_donesem);
+}
+
+static
+void
+rwt1writer(void *junk, unsigned long num)
+{
+	unsigned i, j;
+
+	(void)junk;
+
+	for (i=0; i<RWT_LOOPS/4; i++) {
+		rwlock_acquire_write(rwt_lock);
+		KASSERT(rwlock_do_i_hold_write(rwt_lock));
+		if (rwt_lock->rw_readers != 0) {
+			kprintf("rwt1: writer %lu: %u readers present\n",
+				num, rwt_lock->rw_readers);
+			rwt_failed = true;
+		}
+		for (j=0; j<RWT_NVALS; j++) {
+			rwt_vals[j]++;
+			rwt_delay(10);
+		}
+		rwlock_release_write(rwt_lock);
+		rwt_delay(500);
+	}
+	V(rwt_donesem);
+}
+
+int
+rwtest(int nargs, char **args)
+{
+	unsigned i;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting rwlock stress test...\n");
+	rwt_init();
+
+	for (i=0; i<RWT_READERS + RWT_WRITERS; i++) {
+		if (i < RWT_READERS) {
+			result = thread_fork("rwt1", NULL, rwt1reader,
+					     NULL, i);
+		}
+		else {
+			result = thread_fork("rwt1", NULL, rwt1writer,
+					     NULL, i);
+		}
+		if (result) {
+			panic("rwt1: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<RWT_READERS + RWT_WRITERS; i++) {
+		P(rwt_donesem);
+	}
+
+	if (rwt_vals[0] != RWT_WRITERS * (RWT_LOOPS/4)) {
+		kprintf("rwt1: %lu writes seen, expected %u\n",
+			rwt_vals[0], RWT_WRITERS * (RWT_LOOPS/4));
+		rwt_failed = true;
+	}
+	kprintf("rwt1: up to %u concurrent readers seen\n", rwt_maxreaders);
+	kprintf("%s\n", rwt_failed ? "Test failed" : "Test passed");
+
+	rwt_cleanup();
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// rwt2
+
+#define RWT2_LOOPS	1000
+
+static
+void
+rwt2thread(void *junk, unsigned long exclusive)
+{
+	unsigned i;
+
+	(void)junk;
+
+	for (i=0; i<RWT2_LOOPS; i++) {
+		if (exclusive) {
+			rwlock_acquire_write(rwt_lock);
+		}
+		else {
+			rwlock_acquire_read(rwt_lock);
+		}
+		/* a read-side critical section of some length */
+		rwt_delay(200);
+		if (exclusive) {
+			rwlock_release_write(rwt_lock);
+		}
+		else {
+			rwlock_release_read(rwt_lock);
+		}
+	}
+	V(rwt_donesem);
+}
+
+static
+unsigned long
+rwt2run(bool exclusive)
+{
+	struct timespec before, after;
+	unsigned i;
+	int result;
+
+	gettime(&before);
+	for (i=0; i<RWT_READERS; i++) {
+		result = thread_fork("rwt2", NULL, rwt2thread,
+				     NULL, exclusive);
+		if (result) {
+			panic("rwt2: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<RWT_READERS; i++) {
+		P(rwt_donesem);
+	}
+	gettime(&after);
+
+	timespec_sub(&after, &before, &after);
+	return after.tv_sec * 1000 + after.tv_nsec / 1000000;
+}
+
+int
+rwtest2(int nargs, char **args)
+{
+	unsigned long shared, exclusive;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting rwlock reader scalability test...\n");
+	rwt_init();
+
+	shared = rwt2run(false);
+	exclusive = rwt2run(true);
+
+	kprintf("rwt2: %u threads x %u critical sections:\n",
+		RWT_READERS, RWT2_LOOPS);
+	kprintf("rwt2:    shared (read) locking:    %lu ms\n", shared);
+	kprintf("rwt2:    exclusive (write) locking: %lu ms\n", exclusive);
+
+	rwt_cleanup();
+	kprintf("rwt2 done.\n");
+	return 0;
+}
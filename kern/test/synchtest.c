@@ -32,8 +32,11 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <clock.h>
+#include <cpu.h>
+#include <spinlock.h>
 #include <thread.h>
 #include <synch.h>
 #include <test.h>
@@ -399,3 +402,317 @@ cvtest2(int nargs, char **args)
 	kprintf("cvtest2 done\n");
 	return 0;
 }
+
+////////////////////////////////////////////////////////////
+// sy5
+
+/*
+ * Lock contention benchmark: LB_THREADS threads each take a shared
+ * lock LB_LOOPS times, holding it only for a few instructions, first
+ * with an ordinary (sleeping) lock and then with an adaptive one. The
+ * time for each is printed. With more than one cpu the adaptive lock
+ * should win, since most waits are shorter than a context switch.
+ */
+
+#define LB_THREADS	8
+#define LB_LOOPS	2000
+
+static struct lock *lblock;
+static volatile unsigned long lbcounter;
+
+static
+void
+lockbenchthread(void *sm, unsigned long num)
+{
+	struct semaphore *sem = sm;
+	volatile unsigned long junk;
+	unsigned i, j;
+
+	(void)num;
+
+	for (i=0; i<LB_LOOPS; i++) {
+		lock_acquire(lblock);
+		lbcounter++;
+		lock_release(lblock);
+
+		/* a little work outside the lock */
+		for (j=0; j<20; j++) {
+			junk = j;
+		}
+	}
+	(void)junk;
+	V(sem);
+}
+
+static
+void
+lockbench1(const char *what, struct lock *lk, struct semaphore *sem)
+{
+	struct timespec before, after;
+	unsigned long msecs;
+	unsigned i;
+	int result;
+
+	lblock = lk;
+	lbcounter = 0;
+
+	gettime(&before);
+	for (i=0; i<LB_THREADS; i++) {
+		result = thread_fork("lockbench", NULL, lockbenchthread,
+				     sem, i);
+		if (result) {
+			panic("lockbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<LB_THREADS; i++) {
+		P(sem);
+	}
+	gettime(&after);
+
+	if (lbcounter != LB_THREADS * LB_LOOPS) {
+		kprintf("lockbench: %s: counter is %lu, expected %u\n",
+			what, lbcounter, LB_THREADS * LB_LOOPS);
+		kprintf("Test failed\n");
+	}
+
+	timespec_sub(&after, &before, &after);
+	msecs = after.tv_sec * 1000 + after.tv_nsec / 1000000;
+	kprintf("%s lock: %u acquisitions in %lu ms\n",
+		what, LB_THREADS * LB_LOOPS, msecs);
+}
+
+int
+lockbench(int nargs, char **args)
+{
+	struct semaphore *sem;
+	struct lock *sleeplock, *adaptivelock;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting lock contention benchmark...\n");
+
+	sem = sem_create("lockbench", 0);
+	sleeplock = lock_create("lockbench-sleep");
+	adaptivelock = lock_create_adaptive("lockbench-adaptive");
+	if (sem == NULL || sleeplock == NULL || adaptivelock == NULL) {
+		panic("lockbench: out of memory\n");
+	}
+
+	lockbench1("sleeping", sleeplock, sem);
+	lockbench1("adaptive", adaptivelock, sem);
+
+	lock_destroy(adaptivelock);
+	lock_destroy(sleeplock);
+	sem_destroy(sem);
+
+	kprintf("Lock contention benchmark done.\n");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// sy6
+
+/*
+ * Spinlock fairness benchmark: one thread per cpu (at least two)
+ * hammers a shared spinlock until SB_TOTAL acquisitions have been made
+ * in all. We report the overall rate and how the acquisitions were
+ * split between the threads. With a fair lock, threads that get a cpu
+ * to themselves should get close to equal shares.
+ */
+
+#define SB_MAXTHREADS	32
+#define SB_TOTAL	200000
+
+static struct spinlock sblock = SPINLOCK_INITIALIZER;
+static volatile unsigned long sbtotal;
+static unsigned long sbcounts[SB_MAXTHREADS];
+
+static
+void
+spinbenchthread(void *sm, unsigned long num)
+{
+	struct semaphore *sem = sm;
+	bool done;
+
+	done = false;
+	while (!done) {
+		spinlock_acquire(&sblock);
+		if (sbtotal < SB_TOTAL) {
+			sbtotal++;
+			sbcounts[num]++;
+		}
+		else {
+			done = true;
+		}
+		spinlock_release(&sblock);
+	}
+	V(sem);
+}
+
+int
+spinbench(int nargs, char **args)
+{
+	struct semaphore *sem;
+	struct timespec before, after;
+	unsigned long msecs, min, max;
+	unsigned i, nthreads;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	nthreads = cpu_count();
+	if (nthreads < 2) {
+		nthreads = 2;
+	}
+	if (nthreads > SB_MAXTHREADS) {
+		nthreads = SB_MAXTHREADS;
+	}
+
+	kprintf("Starting spinlock benchmark with %u threads...\n", nthreads);
+
+	sem = sem_create("spinbench", 0);
+	if (sem == NULL) {
+		panic("spinbench: sem_create failed\n");
+	}
+	sbtotal = 0;
+	for (i=0; i<nthreads; i++) {
+		sbcounts[i] = 0;
+	}
+
+	gettime(&before);
+	for (i=0; i<nthreads; i++) {
+		result = thread_fork("spinbench", NULL, spinbenchthread,
+				     sem, i);
+		if (result) {
+			panic("spinbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<nthreads; i++) {
+		P(sem);
+	}
+	gettime(&after);
+	sem_destroy(sem);
+
+	timespec_sub(&after, &before, &after);
+	msecs = after.tv_sec * 1000 + after.tv_nsec / 1000000;
+
+	min = max = sbcounts[0];
+	for (i=0; i<nthreads; i++) {
+		kprintf("  thread %u: %lu acquisitions\n", i, sbcounts[i]);
+		if (sbcounts[i] < min) {
+			min = sbcounts[i];
+		}
+		if (sbcounts[i] > max) {
+			max = sbcounts[i];
+		}
+	}
+	kprintf("%u acquisitions in %lu ms", SB_TOTAL, msecs);
+	if (msecs > 0) {
+		kprintf(" (%lu per second)", SB_TOTAL / msecs * 1000);
+	}
+	kprintf("\n");
+	kprintf("Fewest/most per thread: %lu/%lu\n", min, max);
+
+	kprintf("Spinlock benchmark done.\n");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// sy7
+
+/*
+ * Timed CV wait test: check that cv_timedwait times out on time when
+ * nobody signals, and returns early, without a timeout, when someone
+ * does.
+ */
+
+static volatile bool tw_signalled;
+static volatile int tw_result;
+
+static
+unsigned long
+tw_msecs(const struct timespec *before)
+{
+	struct timespec now;
+
+	gettime(&now);
+	timespec_sub(&now, before, &now);
+	return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static
+void
+timedwaitthread(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	lock_acquire(testlock);
+	tw_result = 0;
+	while (!tw_signalled && tw_result == 0) {
+		tw_result = cv_timedwait(testcv, testlock, 10 * HZ);
+	}
+	lock_release(testlock);
+	V(donesem);
+}
+
+int
+timedwaittest(int nargs, char **args)
+{
+	static const unsigned ticks[] = { 1, 5, 20 };
+	struct timespec before;
+	unsigned long msecs, min;
+	unsigned i;
+	bool failed = false;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	kprintf("Starting timed CV wait test...\n");
+
+	for (i=0; i<sizeof(ticks)/sizeof(ticks[0]); i++) {
+		lock_acquire(testlock);
+		gettime(&before);
+		result = cv_timedwait(testcv, testlock, ticks[i]);
+		msecs = tw_msecs(&before);
+		lock_release(testlock);
+
+		min = ticks[i] * 1000 / HZ;
+		kprintf("%u ticks: %s after %lu ms (want %lu-%lu)\n",
+			ticks[i], result == ETIMEDOUT ? "timed out" : "woke",
+			msecs, min, min + 2 * 1000 / HZ);
+		if (result != ETIMEDOUT || msecs < min ||
+		    msecs > min + 2 * 1000 / HZ) {
+			failed = true;
+		}
+	}
+
+	tw_signalled = false;
+	result = thread_fork("timedwait", NULL, timedwaitthread, NULL, 0);
+	if (result) {
+		panic("timedwaittest: thread_fork failed: %s\n",
+		      strerror(result));
+	}
+	clocksleep_ticks(5);
+	gettime(&before);
+	lock_acquire(testlock);
+	tw_signalled = true;
+	cv_signal(testcv, testlock);
+	lock_release(testlock);
+	P(donesem);
+	msecs = tw_msecs(&before);
+	kprintf("signalled: %s after %lu ms\n",
+		tw_result == ETIMEDOUT ? "timed out" : "woke", msecs);
+	if (tw_result != 0 || msecs >= 1000) {
+		failed = true;
+	}
+
+	kprintf("%s\n", failed ? "Test failed" : "Test passed");
+	return 0;
+}
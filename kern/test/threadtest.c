@@ -32,6 +32,7 @@
  */
 #include <types.h>
 #include <lib.h>
+#include <clock.h>
 #include <thread.h>
 #include <synch.h>
 #include <test.h>
@@ -144,3 +145,61 @@ threadtest2(int nargs, char **args)
 
 	return 0;
 }
+
+/*
+ * Fork/exit benchmark: fork batches of NTHREADS threads that exit
+ * right away, and report how many forks per second that comes to.
+ * Mostly measures thread_fork, thread_exit, and the thread cache.
+ */
+#define TT4_ROUNDS	500
+
+static
+void
+exitthread(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	V(tsem);
+}
+
+int
+threadtest4(int nargs, char **args)
+{
+	struct timespec before, after;
+	unsigned long msecs;
+	int i, j, result;
+
+	(void)nargs;
+	(void)args;
+
+	init_sem();
+	kprintf("Starting thread fork/exit benchmark...\n");
+
+	gettime(&before);
+	for (i=0; i<TT4_ROUNDS; i++) {
+		for (j=0; j<NTHREADS; j++) {
+			result = thread_fork("tt4", NULL, exitthread,
+					     NULL, j);
+			if (result) {
+				panic("threadtest4: thread_fork failed %s\n",
+				      strerror(result));
+			}
+		}
+		for (j=0; j<NTHREADS; j++) {
+			P(tsem);
+		}
+	}
+	gettime(&after);
+
+	timespec_sub(&after, &before, &after);
+	msecs = after.tv_sec * 1000 + after.tv_nsec / 1000000;
+	kprintf("tt4: %u threads in %lu ms", TT4_ROUNDS * NTHREADS, msecs);
+	if (msecs > 0) {
+		kprintf(" (%lu forks/sec)",
+			TT4_ROUNDS * NTHREADS * 1000UL / msecs);
+	}
+	kprintf("\nThread fork/exit benchmark done.\n");
+
+	return 0;
+}
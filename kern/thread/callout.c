@@ -0,0 +1,295 @@
+/*
+ * Callouts, on per-cpu hierarchical timer wheels. See callout.h.
+ *
+ * A wheel has CW_LEVELS levels of CW_SLOTS slots each. Level 0 holds
+ * callouts due within the next CW_SLOTS ticks, one slot per tick.
+ * Each slot of level 1 covers CW_SLOTS ticks, each slot of level 2
+ * CW_SLOTS^2 ticks, and so on. Whenever level 0 wraps around, the
+ * next slot of level 1 is emptied and its callouts are put back in,
+ * now landing on level 0 (and likewise level 2 into level 1 when
+ * level 1 wraps, etc.). So a callout moves at most CW_LEVELS-1 times
+ * before it runs, and each tick looks at one slot.
+ *
+ * Wheel time (cw_now) is the next tick to be processed. It wraps;
+ * everything is done with differences, which stay under 2^24.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <current.h>
+#include <callout.h>
+
+#define CW_BITS		6
+#define CW_SLOTS	(1 << CW_BITS)
+#define CW_MASK		(CW_SLOTS - 1)
+#define CW_LEVELS	4
+
+/* Slot of level L that time T falls in. */
+#define CW_INDEX(t, l)	(((t) >> ((l) * CW_BITS)) & CW_MASK)
+
+struct callout_wheel {
+	struct spinlock cw_lock;
+	uint32_t cw_now;			/* next tick to process */
+	struct callout *cw_running;		/* callout being run */
+	struct callout *cw_slots[CW_LEVELS][CW_SLOTS];
+};
+
+void
+callout_init(struct callout *c, void (*func)(void *), void *arg)
+{
+	c->co_next = NULL;
+	c->co_prevp = NULL;
+	c->co_wheel = NULL;
+	c->co_expire = 0;
+	c->co_pending = false;
+	c->co_func = func;
+	c->co_arg = arg;
+}
+
+void
+callout_cpu_init(struct cpu *c)
+{
+	struct callout_wheel *w;
+	unsigned i, j;
+
+	w = kmalloc(sizeof(*w));
+	if (w == NULL) {
+		panic("callout_cpu_init: Out of memory\n");
+	}
+	spinlock_init(&w->cw_lock);
+	w->cw_now = 0;
+	w->cw_running = NULL;
+	for (i=0; i<CW_LEVELS; i++) {
+		for (j=0; j<CW_SLOTS; j++) {
+			w->cw_slots[i][j] = NULL;
+		}
+	}
+	c->c_callouts = w;
+}
+
+/*
+ * List handling. A slot is a singly linked list with back pointers,
+ * so a callout can be unlinked without knowing which slot it is in.
+ */
+static
+void
+callout_link(struct callout **head, struct callout *c)
+{
+	c->co_next = *head;
+	c->co_prevp = head;
+	if (*head != NULL) {
+		(*head)->co_prevp = &c->co_next;
+	}
+	*head = c;
+}
+
+static
+void
+callout_unlink(struct callout *c)
+{
+	*c->co_prevp = c->co_next;
+	if (c->co_next != NULL) {
+		c->co_next->co_prevp = c->co_prevp;
+	}
+	c->co_next = NULL;
+	c->co_prevp = NULL;
+}
+
+/*
+ * Put C in the slot for its expiry time. Wheel locked.
+ */
+static
+void
+callout_add(struct callout_wheel *w, struct callout *c)
+{
+	uint32_t diff;
+	unsigned level;
+
+	diff = c->co_expire - w->cw_now;
+	if ((int32_t)diff < 0) {
+		/* already due: run at the next tick */
+		callout_link(&w->cw_slots[0][CW_INDEX(w->cw_now, 0)], c);
+		return;
+	}
+	for (level = 0; level < CW_LEVELS - 1; level++) {
+		if (diff < (1U << ((level + 1) * CW_BITS))) {
+			break;
+		}
+	}
+	callout_link(&w->cw_slots[level][CW_INDEX(c->co_expire, level)], c);
+}
+
+void
+callout_schedule(struct callout *c, unsigned ticks)
+{
+	struct callout_wheel *w;
+	int spl;
+
+	KASSERT(!c->co_pending);
+
+	if (ticks > CALLOUT_MAXTICKS) {
+		ticks = CALLOUT_MAXTICKS;
+	}
+
+	/* stay on this cpu while we find its wheel */
+	spl = splhigh();
+	w = curcpu->c_callouts;
+	spinlock_acquire(&w->cw_lock);
+	c->co_wheel = w;
+	c->co_expire = w->cw_now + ticks;
+	c->co_pending = true;
+	callout_add(w, c);
+	spinlock_release(&w->cw_lock);
+	splx(spl);
+}
+
+bool
+callout_stop(struct callout *c)
+{
+	struct callout_wheel *w;
+	bool ret;
+
+	w = c->co_wheel;
+	if (w == NULL) {
+		return false;
+	}
+
+	/*
+	 * Only the owner reschedules a callout, so co_wheel can't
+	 * change under us while we're looking at it.
+	 */
+	spinlock_acquire(&w->cw_lock);
+	ret = c->co_pending;
+	if (ret) {
+		callout_unlink(c);
+		c->co_pending = false;
+	}
+	spinlock_release(&w->cw_lock);
+	return ret;
+}
+
+void
+callout_drain(struct callout *c)
+{
+	struct callout_wheel *w;
+	bool running;
+
+	KASSERT(!curthread->t_in_interrupt);
+	KASSERT(curcpu->c_spinlocks == 0);
+
+	w = c->co_wheel;
+	if (w == NULL) {
+		return;
+	}
+
+	do {
+		spinlock_acquire(&w->cw_lock);
+		running = (w->cw_running == c);
+		spinlock_release(&w->cw_lock);
+	} while (running);
+}
+
+/*
+ * Move everything in slot INDEX of level LEVEL down to where it now
+ * belongs. Returns INDEX, so the caller knows whether this level has
+ * wrapped too. Wheel locked.
+ */
+static
+unsigned
+callout_cascade(struct callout_wheel *w, unsigned level, unsigned index)
+{
+	struct callout *c;
+
+	while ((c = w->cw_slots[level][index]) != NULL) {
+		callout_unlink(c);
+		callout_add(w, c);
+	}
+	return index;
+}
+
+void
+callout_tick(void)
+{
+	struct callout_wheel *w;
+	struct callout *due, *c;
+	unsigned index, level;
+
+	/* called from hardclock, so interrupts are off already */
+	w = curcpu->c_callouts;
+	spinlock_acquire(&w->cw_lock);
+
+	index = CW_INDEX(w->cw_now, 0);
+	for (level = 1; index == 0 && level < CW_LEVELS; level++) {
+		index = callout_cascade(w, level,
+					CW_INDEX(w->cw_now, level));
+	}
+	index = CW_INDEX(w->cw_now, 0);
+	w->cw_now++;
+
+	/*
+	 * Take the due callouts off the slot first: one that
+	 * reschedules itself might land in the same slot again.
+	 */
+	due = w->cw_slots[0][index];
+	w->cw_slots[0][index] = NULL;
+	if (due != NULL) {
+		due->co_prevp = &due;
+	}
+
+	while ((c = due) != NULL) {
+		callout_unlink(c);
+		c->co_pending = false;
+		w->cw_running = c;
+		spinlock_release(&w->cw_lock);
+
+		c->co_func(c->co_arg);
+
+		spinlock_acquire(&w->cw_lock);
+		w->cw_running = NULL;
+	}
+	spinlock_release(&w->cw_lock);
+}
+
+unsigned
+callout_next(void)
+{
+	struct callout_wheel *w;
+	unsigned ret, d, level, wrap;
+	int spl;
+
+	spl = splhigh();
+	w = curcpu->c_callouts;
+	spinlock_acquire(&w->cw_lock);
+
+	ret = CALLOUT_MAXTICKS;
+	for (d=0; d<CW_SLOTS; d++) {
+		if (w->cw_slots[0][CW_INDEX(w->cw_now + d, 0)] != NULL) {
+			ret = d + 1;
+			break;
+		}
+	}
+
+	/*
+	 * Anything on the upper levels comes down at a cascade, and the
+	 * next one is when level 0 wraps. Be conservative and stop
+	 * there rather than work out the exact time.
+	 */
+	wrap = ((CW_SLOTS - CW_INDEX(w->cw_now, 0)) & CW_MASK) + 1;
+	if (wrap < ret) {
+		for (level=1; level<CW_LEVELS; level++) {
+			for (d=0; d<CW_SLOTS; d++) {
+				if (w->cw_slots[level][d] != NULL) {
+					ret = wrap;
+					goto done;
+				}
+			}
+		}
+	}
+ done:
+	spinlock_release(&w->cw_lock);
+	splx(spl);
+	return ret;
+}
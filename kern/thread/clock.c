@@ -31,6 +31,7 @@
 #include <lib.h>
 #include <cpu.h>
 #include <wchan.h>
+#include <callout.h>
 #include <clock.h>
 #include <thread.h>
 #include <current.h>
@@ -38,9 +39,8 @@
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution than one second.
+ * Callbacks at points in the future are scheduled with callouts (see
+ * callout.h), which run from hardclock with a resolution of one tick.
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
  * skimp on that because we have a known-good hardware clock.
@@ -50,14 +50,15 @@
  * Timing constants. These should be tuned along with any work done on
  * the scheduler.
  */
-#define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
+#define SCHEDULE_HARDCLOCKS	50	/* Age priorities every 50 hardclocks. */
 #define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
 
 /*
- * Once a second, everything waiting on lbolt is awakened by CPU 0.
+ * Threads in clocksleep. Nobody wakes this channel; its sleepers
+ * leave when their timeouts expire.
  */
-static struct wchan *lbolt;
-static struct spinlock lbolt_lock;
+static struct wchan *sleep_wchan;
+static struct spinlock sleep_lock;
 
 /*
  * Setup.
@@ -65,26 +66,13 @@ static struct spinlock lbolt_lock;
 void
 hardclock_bootstrap(void)
 {
-	spinlock_init(&lbolt_lock);
-	lbolt = wchan_create("lbolt");
-	if (lbolt == NULL) {
-		panic("Couldn't create lbolt\n");
+	spinlock_init(&sleep_lock);
+	sleep_wchan = wchan_create("clocksleep");
+	if (sleep_wchan == NULL) {
+		panic("Couldn't create clocksleep wchan\n");
 	}
 }
 
-/*
- * This is called once per second, on one processor, by the timer
- * code.
- */
-void
-timerclock(void)
-{
-	/* Just broadcast on lbolt */
-	spinlock_acquire(&lbolt_lock);
-	wchan_wakeall(lbolt, &lbolt_lock);
-	spinlock_release(&lbolt_lock);
-}
-
 /*
  * This is called HZ times a second (on each processor) by the timer
  * code.
@@ -97,13 +85,33 @@ hardclock(void)
 	 */
 
 	curcpu->c_hardclocks++;
+	callout_tick();
 	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
 		thread_consider_migration();
 	}
 	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
-	thread_yield();
+	if (thread_tick()) {
+		thread_yield();
+	}
+}
+
+/*
+ * Suspend execution for at least TICKS hardclocks.
+ */
+void
+clocksleep_ticks(unsigned ticks)
+{
+	unsigned chunk;
+
+	spinlock_acquire(&sleep_lock);
+	while (ticks > 0) {
+		chunk = ticks < CALLOUT_MAXTICKS ? ticks : CALLOUT_MAXTICKS;
+		wchan_sleep_timeout(sleep_wchan, &sleep_lock, chunk);
+		ticks -= chunk;
+	}
+	spinlock_release(&sleep_lock);
 }
 
 /*
@@ -112,10 +120,7 @@ hardclock(void)
 void
 clocksleep(int num_secs)
 {
-	spinlock_acquire(&lbolt_lock);
-	while (num_secs > 0) {
-		wchan_sleep(lbolt, &lbolt_lock);
-		num_secs--;
+	if (num_secs > 0) {
+		clocksleep_ticks(num_secs * HZ);
 	}
-	spinlock_release(&lbolt_lock);
 }
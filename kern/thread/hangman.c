@@ -180,3 +180,30 @@ hangman_release(struct hangman_actor *a,
 
 	spinlock_release(&hangman_lock);
 }
+
+/*
+ * Note that a is no longer waiting for l, without having become its
+ * holder. This is for shared acquisitions (e.g. a reader getting an
+ * rwlock), since a lockable only records a single holder.
+ */
+void
+hangman_giveup(struct hangman_actor *a,
+	       struct hangman_lockable *l)
+{
+	if (l == &hangman_lock.splk_hangman) {
+		/* don't recurse */
+		return;
+	}
+
+	spinlock_acquire(&hangman_lock);
+
+	if (a->a_waiting != l) {
+		spinlock_release(&hangman_lock);
+		panic("hangman_giveup: not waiting for lock %s (%p)\n",
+		      l->l_name, l);
+	}
+
+	a->a_waiting = NULL;
+
+	spinlock_release(&hangman_lock);
+}
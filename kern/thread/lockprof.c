@@ -0,0 +1,288 @@
+/*
+ * Lock contention profiler. See lockprof.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <lockprof.h>
+
+/*
+ * The locks that have been contended at least once. lockprof_lock is
+ * a leaf: nothing else is acquired while holding it. Its own profile
+ * is never put on the list, or registering it would recurse.
+ */
+static struct spinlock lockprof_lock = SPINLOCK_INITIALIZER;
+static struct lockprof *lockprof_list;
+
+/* How many locks lockprof_printstats shows. */
+#define LOCKPROF_TOP	16
+
+/*
+ * Check that LP, which is about to be initialized, isn't still on
+ * the list: if it is, whatever it was part of was freed without
+ * lockprof_cleanup. Fresh memory may hold anything, so a set
+ * lp_registered alone proves nothing; look for it.
+ */
+static
+void
+lockprof_checkunlisted(struct lockprof *lp)
+{
+	struct lockprof *l;
+
+	if (lp == &lockprof_lock.splk_prof) {
+		return;
+	}
+	spinlock_acquire(&lockprof_lock);
+	for (l = lockprof_list; l != NULL; l = l->lp_next) {
+		KASSERT(l != lp);
+	}
+	spinlock_release(&lockprof_lock);
+}
+
+void
+lockprof_init(struct lockprof *lp, const char *name, unsigned kind)
+{
+	if (lp->lp_registered) {
+		lockprof_checkunlisted(lp);
+	}
+
+	lp->lp_name = name;
+	lp->lp_kind = kind;
+	lp->lp_acquires = 0;
+	lp->lp_contended = 0;
+	lp->lp_waitcycles = 0;
+	lp->lp_maxwait = 0;
+	lp->lp_holder = NULL;
+	lp->lp_site = NULL;
+	lp->lp_blocker[0] = 0;
+	lp->lp_registered = false;
+	lp->lp_prev = NULL;
+	lp->lp_next = NULL;
+}
+
+void
+lockprof_cleanup(struct lockprof *lp)
+{
+	if (!lp->lp_registered) {
+		return;
+	}
+
+	spinlock_acquire(&lockprof_lock);
+	if (!lp->lp_registered) {
+		/* lockprof_reset got here first */
+		spinlock_release(&lockprof_lock);
+		return;
+	}
+	if (lp->lp_prev != NULL) {
+		lp->lp_prev->lp_next = lp->lp_next;
+	}
+	else {
+		lockprof_list = lp->lp_next;
+	}
+	if (lp->lp_next != NULL) {
+		lp->lp_next->lp_prev = lp->lp_prev;
+	}
+	lp->lp_registered = false;
+	spinlock_release(&lockprof_lock);
+}
+
+static
+void
+lockprof_register(struct lockprof *lp)
+{
+	if (lp == &lockprof_lock.splk_prof) {
+		/* don't recurse */
+		return;
+	}
+
+	spinlock_acquire(&lockprof_lock);
+	lp->lp_prev = NULL;
+	lp->lp_next = lockprof_list;
+	if (lockprof_list != NULL) {
+		lockprof_list->lp_prev = lp;
+	}
+	lockprof_list = lp;
+	lp->lp_registered = true;
+	spinlock_release(&lockprof_lock);
+}
+
+/*
+ * Copy a name into a LOCKPROF_NAMELEN buffer, truncating if needed.
+ */
+static
+void
+lockprof_copyname(char *buf, const char *name)
+{
+	unsigned i;
+
+	for (i=0; i<LOCKPROF_NAMELEN-1 && name[i] != 0; i++) {
+		buf[i] = name[i];
+	}
+	buf[i] = 0;
+}
+
+/*
+ * Account for a wait that started at cycle START and just ended with
+ * the current thread getting the lock. The previous holder is still
+ * in lp_holder at this point.
+ */
+void
+lockprof_contended(struct lockprof *lp, uint32_t start, const void *site)
+{
+	uint32_t wait;
+
+	wait = cpu_cycles() - start;
+
+	lp->lp_contended++;
+	lp->lp_waitcycles += wait;
+	if (wait > lp->lp_maxwait) {
+		lp->lp_maxwait = wait;
+	}
+	lp->lp_site = site;
+	if (lp->lp_holder != NULL && lp->lp_kind != LOCKPROF_CV) {
+		/*
+		 * The holder may have exited and its name been freed by
+		 * now, in which case this copies junk; that only spoils
+		 * the report.
+		 */
+		lockprof_copyname(lp->lp_blocker, lp->lp_holder);
+	}
+
+	if (!lp->lp_registered) {
+		lockprof_register(lp);
+	}
+}
+
+/*
+ * A copy of one lock's numbers, so they can be printed without holding
+ * lockprof_lock (and after the lock itself might have been destroyed).
+ */
+struct lockprof_snap {
+	char ls_name[LOCKPROF_NAMELEN];
+	const void *ls_addr;
+	unsigned ls_kind;
+	unsigned ls_acquires;
+	unsigned ls_contended;
+	uint64_t ls_waitcycles;
+	uint32_t ls_maxwait;
+	const void *ls_site;
+	char ls_blocker[LOCKPROF_NAMELEN];
+};
+
+static struct lockprof_snap lockprof_snaps[LOCKPROF_TOP];
+
+/*
+ * Insert LP into the table of the NUM worst locks so far, kept sorted
+ * by total wait. Returns the new number of entries.
+ */
+static
+unsigned
+lockprof_snapshot(const struct lockprof *lp, unsigned num)
+{
+	struct lockprof_snap *ls;
+	unsigned pos;
+
+	pos = num;
+	while (pos > 0 &&
+	       lockprof_snaps[pos-1].ls_waitcycles < lp->lp_waitcycles) {
+		if (pos < LOCKPROF_TOP) {
+			lockprof_snaps[pos] = lockprof_snaps[pos-1];
+		}
+		pos--;
+	}
+	if (pos >= LOCKPROF_TOP) {
+		return num;
+	}
+
+	ls = &lockprof_snaps[pos];
+	if (lp->lp_name != NULL) {
+		lockprof_copyname(ls->ls_name, lp->lp_name);
+	}
+	else {
+		strcpy(ls->ls_name, "(spinlock)");
+	}
+	ls->ls_addr = lp;
+	ls->ls_kind = lp->lp_kind;
+	ls->ls_acquires = lp->lp_acquires;
+	ls->ls_contended = lp->lp_contended;
+	ls->ls_waitcycles = lp->lp_waitcycles;
+	ls->ls_maxwait = lp->lp_maxwait;
+	ls->ls_site = lp->lp_site;
+	strcpy(ls->ls_blocker, lp->lp_blocker);
+
+	return num < LOCKPROF_TOP ? num + 1 : num;
+}
+
+/*
+ * Print the most contended locks, worst first.
+ *
+ * The snapshot table is static and not otherwise protected, so this
+ * should only be run from one place at a time (the menu).
+ */
+void
+lockprof_printstats(void)
+{
+	static const char *const kinds[] = { "spin", "lock", "cv" };
+	const struct lockprof *lp;
+	const struct lockprof_snap *ls;
+	unsigned i, num, total;
+
+	num = total = 0;
+	spinlock_acquire(&lockprof_lock);
+	for (lp = lockprof_list; lp != NULL; lp = lp->lp_next) {
+		num = lockprof_snapshot(lp, num);
+		total++;
+	}
+	spinlock_release(&lockprof_lock);
+
+	kprintf("lockprof: %u contended locks; top %u by wait time:\n",
+		total, num);
+	kprintf("%-16s %-4s %10s %10s %10s %14s %10s\n", "name", "kind",
+		"acquires", "contended", "avg wait", "total wait",
+		"max wait");
+	for (i=0; i<num; i++) {
+		ls = &lockprof_snaps[i];
+		kprintf("%-16s %-4s %10u %10u %10llu %14llu %10u\n",
+			ls->ls_name, kinds[ls->ls_kind],
+			ls->ls_acquires, ls->ls_contended,
+			ls->ls_contended == 0 ? 0 :
+			ls->ls_waitcycles / ls->ls_contended,
+			ls->ls_waitcycles, ls->ls_maxwait);
+		kprintf("    at %p, last waited for from %p", ls->ls_addr,
+			ls->ls_site);
+		if (ls->ls_blocker[0] != 0) {
+			kprintf(", held by %s", ls->ls_blocker);
+		}
+		kprintf("\n");
+	}
+	kprintf("(wait times are in cycles)\n");
+}
+
+/*
+ * Zero the counters of every lock on the list and take them off it.
+ * This races with threads updating the counters, so a few
+ * acquisitions right around the reset may be lost or half-counted.
+ */
+void
+lockprof_reset(void)
+{
+	struct lockprof *lp;
+
+	spinlock_acquire(&lockprof_lock);
+	while (lockprof_list != NULL) {
+		lp = lockprof_list;
+		lockprof_list = lp->lp_next;
+		lp->lp_acquires = 0;
+		lp->lp_contended = 0;
+		lp->lp_waitcycles = 0;
+		lp->lp_maxwait = 0;
+		lp->lp_site = NULL;
+		lp->lp_blocker[0] = 0;
+		lp->lp_prev = NULL;
+		lp->lp_next = NULL;
+		lp->lp_registered = false;
+	}
+	spinlock_release(&lockprof_lock);
+}
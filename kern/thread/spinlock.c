@@ -37,6 +37,7 @@
 #include <spl.h>
 #include <spinlock.h>
 #include <membar.h>
+#include <thread.h>	/* for lockprof */
 #include <current.h>	/* for curcpu */
 
 /*
@@ -50,9 +51,11 @@
 void
 spinlock_init(struct spinlock *splk)
 {
-	spinlock_data_set(&splk->splk_lock, 0);
+	spinlock_data_set(&splk->splk_next, 0);
+	spinlock_data_set(&splk->splk_serving, 0);
 	splk->splk_holder = NULL;
 	HANGMAN_LOCKABLEINIT(&splk->splk_hangman, "spinlock");
+	LOCKPROF_INIT(&splk->splk_prof, NULL, LOCKPROF_SPINLOCK);
 }
 
 /*
@@ -62,7 +65,9 @@ void
 spinlock_cleanup(struct spinlock *splk)
 {
 	KASSERT(splk->splk_holder == NULL);
-	KASSERT(spinlock_data_get(&splk->splk_lock) == 0);
+	KASSERT(spinlock_data_get(&splk->splk_next) ==
+		spinlock_data_get(&splk->splk_serving));
+	LOCKPROF_CLEANUP(&splk->splk_prof);
 }
 
 /*
@@ -70,12 +75,14 @@ spinlock_cleanup(struct spinlock *splk)
  *
  * First disable interrupts (otherwise, if we get a timer interrupt we
  * might come back to this lock and deadlock), then use a machine-level
- * atomic operation to wait for the lock to be free.
+ * atomic operation to take a ticket, and wait for it to come up.
  */
 void
 spinlock_acquire(struct spinlock *splk)
 {
 	struct cpu *mycpu;
+	spinlock_data_t ticket;
+	LOCKPROF_TIMESTAMP(waitstart);
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -93,24 +100,19 @@ spinlock_acquire(struct spinlock *splk)
 		mycpu = NULL;
 	}
 
-	while (1) {
-		/*
-		 * Do test-test-and-set, that is, read first before
-		 * doing test-and-set, to reduce bus contention.
-		 *
-		 * Test-and-set is a machine-level atomic operation
-		 * that writes 1 into the lock word and returns the
-		 * previous value. If that value was 0, the lock was
-		 * previously unheld and we now own it. If it was 1,
-		 * we don't.
-		 */
-		if (spinlock_data_get(&splk->splk_lock) != 0) {
-			continue;
+	/*
+	 * Take a ticket. Fetch-and-increment is a machine-level atomic
+	 * operation, so every cpu gets a different number, in the
+	 * order they arrived. Then wait until the lock is serving our
+	 * number; only the holder ever changes splk_serving, so this
+	 * just reads, which keeps the bus quiet while we wait.
+	 */
+	ticket = spinlock_data_fetchinc(&splk->splk_next);
+	if (spinlock_data_get(&splk->splk_serving) != ticket) {
+		LOCKPROF_START(waitstart);
+		while (spinlock_data_get(&splk->splk_serving) != ticket) {
+			/* spin */
 		}
-		if (spinlock_data_testandset(&splk->splk_lock) != 0) {
-			continue;
-		}
-		break;
 	}
 
 	membar_store_any();
@@ -118,6 +120,7 @@ spinlock_acquire(struct spinlock *splk)
 
 	if (CURCPU_EXISTS()) {
 		HANGMAN_ACQUIRE(&curcpu->c_hangman, &splk->splk_hangman);
+		LOCKPROF_ACQUIRED(&splk->splk_prof, waitstart);
 	}
 }
 
@@ -137,7 +140,9 @@ spinlock_release(struct spinlock *splk)
 
 	splk->splk_holder = NULL;
 	membar_any_store();
-	spinlock_data_set(&splk->splk_lock, 0);
+	/* Let the next ticket in. */
+	spinlock_data_set(&splk->splk_serving,
+			  spinlock_data_get(&splk->splk_serving) + 1);
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
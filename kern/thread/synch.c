@@ -36,8 +36,10 @@
 #include <lib.h>
 #include <spinlock.h>
 #include <wchan.h>
+#include <cpu.h>
 #include <thread.h>
 #include <current.h>
+#include <slab.h>
 #include <synch.h>
 
 ////////////////////////////////////////////////////////////
@@ -138,19 +140,56 @@ V(struct semaphore *sem)
 //
 // Lock.
 
+/*
+ * How many times an adaptive lock polls a running holder before giving
+ * up and sleeping. Roughly a context switch's worth of time.
+ */
+#define LOCK_SPIN_MAX 1000
+
+/*
+ * Locks are allocated from their own cache. A free lock is always
+ * released, so its spinlock and owner are set up once by the
+ * constructor and come back that way from lock_destroy.
+ */
+static struct kmem_cache *lock_cache;
+
+static
+void
+lock_ctor(void *obj)
+{
+#if OPT_SYNCH
+	struct lock *lock = obj;
+
+	spinlock_init(&lock->lk_lock);
+	lock->lk_owner = NULL;
+#else
+	(void)obj;
+#endif
+}
+
+void
+synch_bootstrap(void)
+{
+	lock_cache = kmem_cache_create("lock", sizeof(struct lock), 0,
+				       lock_ctor);
+	if (lock_cache == NULL) {
+		panic("synch_bootstrap: Out of memory\n");
+	}
+}
+
 struct lock *
 lock_create(const char *name)
 {
         struct lock *lock;
 
-        lock = kmalloc(sizeof(*lock));
+        lock = kmem_cache_alloc(lock_cache);
         if (lock == NULL) {
                 return NULL;
         }
 
         lock->lk_name = kstrdup(name);
         if (lock->lk_name == NULL) {
-                kfree(lock);
+                kmem_cache_free(lock_cache, lock);
                 return NULL;
         }
 
@@ -165,15 +204,32 @@ lock_create(const char *name)
 	if (lock->lk_wchan == NULL) {
 #endif
 	  kfree(lock->lk_name);
-	  kfree(lock);
+	  kmem_cache_free(lock_cache, lock);
 	  return NULL;
 	}
-	lock->lk_owner = NULL;
-	spinlock_init(&lock->lk_lock);
+	KASSERT(lock->lk_owner == NULL);
+	lock->lk_adaptive = false;
+	LOCKPROF_INIT(&lock->lk_lock.splk_prof, lock->lk_name,
+		      LOCKPROF_SPINLOCK);
+	LOCKPROF_INIT(&lock->lk_prof, lock->lk_name, LOCKPROF_LOCK);
 #endif	
         return lock;
 }
 
+struct lock *
+lock_create_adaptive(const char *name)
+{
+        struct lock *lock;
+
+        lock = lock_create(name);
+#if OPT_SYNCH
+        if (lock != NULL) {
+                lock->lk_adaptive = true;
+        }
+#endif
+        return lock;
+}
+
 void
 lock_destroy(struct lock *lock)
 {
@@ -181,22 +237,64 @@ lock_destroy(struct lock *lock)
 
         // add stuff here as needed
 #if OPT_SYNCH
+	LOCKPROF_CLEANUP(&lock->lk_prof);
 	spinlock_cleanup(&lock->lk_lock);
 #if USE_SEMAPHORE_FOR_LOCK
         sem_destroy(lock->lk_sem);
 #else
 	wchan_destroy(lock->lk_wchan);
 #endif
+	KASSERT(lock->lk_owner == NULL);
 #endif
         kfree(lock->lk_name);
-        kfree(lock);
+        kmem_cache_free(lock_cache, lock);
 }
 
+#if OPT_SYNCH
+/*
+ * Adaptive locks: wait, without sleeping, while LOCK is held by a
+ * thread running on another cpu, up to LOCK_SPIN_MAX polls. Returns
+ * when the lock looks free or spinning no longer looks worthwhile; the
+ * caller then acquires it the normal way, sleeping if need be.
+ *
+ * The holder is looked at without any locks, so it may have released
+ * the lock and even exited by the time we look at it. That's harmless:
+ * thread structures are ordinary kernel memory, so the worst that
+ * happens is a wrong guess, which only affects how long we spin.
+ */
+static
+void
+lock_spin(struct lock *lock)
+{
+	volatile struct thread *owner;
+	unsigned i;
+
+	for (i=0; i<LOCK_SPIN_MAX; i++) {
+		/*
+		 * lk_owner points to a volatile thread but isn't itself
+		 * volatile, so read it through a volatile lvalue or the
+		 * compiler will hoist the load out of the loop.
+		 */
+		owner = *(volatile struct thread * volatile *)&lock->lk_owner;
+		if (owner == NULL) {
+			return;
+		}
+		if (owner->t_state != S_RUN ||
+		    owner->t_cpu == curcpu->c_self) {
+			/* holder is not running; it won't let go soon */
+			return;
+		}
+	}
+}
+#endif
+
 void
 lock_acquire(struct lock *lock)
 {
         // Write this
 #if OPT_SYNCH
+	LOCKPROF_TIMESTAMP(waitstart);
+
         KASSERT(lock != NULL);
 	if (lock_do_i_hold(lock)) {
 	  kprintf("AAACKK!\n");
@@ -205,6 +303,15 @@ lock_acquire(struct lock *lock)
 
         KASSERT(curthread->t_in_interrupt == false);
 
+	if (lock->lk_owner != NULL) {
+		/* racy, but only decides whether to time the wait */
+		LOCKPROF_START(waitstart);
+	}
+
+	if (lock->lk_adaptive) {
+		lock_spin(lock);
+	}
+
 #if USE_SEMAPHORE_FOR_LOCK
 /*
  *  G.Cabodi - 2019: P BEFORE(!!!) spinlock acquire. OS161 forbids sleeping/realeasing
@@ -223,6 +330,7 @@ lock_acquire(struct lock *lock)
 #endif
         KASSERT(lock->lk_owner == NULL);
         lock->lk_owner=curthread;
+	LOCKPROF_ACQUIRED(&lock->lk_prof, waitstart);
 	spinlock_release(&lock->lk_lock);
 #endif
         (void)lock;  // suppress warning until code gets written
@@ -305,6 +413,8 @@ cv_create(const char *name)
 		return NULL;
 	}
         spinlock_init(&cv->cv_lock);
+	LOCKPROF_INIT(&cv->cv_lock.splk_prof, cv->cv_name, LOCKPROF_SPINLOCK);
+	LOCKPROF_INIT(&cv->cv_prof, cv->cv_name, LOCKPROF_CV);
 #endif
         return cv;
 }
@@ -316,6 +426,7 @@ cv_destroy(struct cv *cv)
 
         // add stuff here as needed
 #if OPT_SYNCH
+	LOCKPROF_CLEANUP(&cv->cv_prof);
 	spinlock_cleanup(&cv->cv_lock);
 	wchan_destroy(cv->cv_wchan);
 #endif
@@ -328,10 +439,13 @@ cv_wait(struct cv *cv, struct lock *lock)
 {
         // Write this
 #if OPT_SYNCH
+	LOCKPROF_TIMESTAMP(waitstart);
+
         KASSERT(lock != NULL);
 	KASSERT(cv != NULL);
 	KASSERT(lock_do_i_hold(lock));
 
+	LOCKPROF_START(waitstart);
 	spinlock_acquire(&cv->cv_lock);
 	/* G.Cabodi - 2019: spinlock already owned as atomic lock_release+wchan_sleep
 	   needed */
@@ -342,12 +456,43 @@ cv_wait(struct cv *cv, struct lock *lock)
 	   (possibly) going to wait state in lock_acquire. 
 	   Atomicity wakeup+lock_acquire not guaranteed (but not necessary!) */
 	lock_acquire(lock);
+	/* the cv's numbers are protected by the lock used with it */
+	LOCKPROF_ACQUIRED(&cv->cv_prof, waitstart);
 #endif
 
         (void)cv;    // suppress warning until code gets written
         (void)lock;  // suppress warning until code gets written
 }
 
+int
+cv_timedwait(struct cv *cv, struct lock *lock, unsigned ticks)
+{
+	int result = 0;
+
+#if OPT_SYNCH
+	LOCKPROF_TIMESTAMP(waitstart);
+
+	KASSERT(lock != NULL);
+	KASSERT(cv != NULL);
+	KASSERT(lock_do_i_hold(lock));
+
+	LOCKPROF_START(waitstart);
+	/* as in cv_wait */
+	spinlock_acquire(&cv->cv_lock);
+	lock_release(lock);
+	result = wchan_sleep_timeout(cv->cv_wchan, &cv->cv_lock, ticks);
+	spinlock_release(&cv->cv_lock);
+	lock_acquire(lock);
+	LOCKPROF_ACQUIRED(&cv->cv_prof, waitstart);
+#else
+	(void)cv;
+	(void)lock;
+	(void)ticks;
+#endif
+
+	return result;
+}
+
 void
 cv_signal(struct cv *cv, struct lock *lock)
 {
@@ -381,4 +526,148 @@ cv_broadcast(struct cv *cv, struct lock *lock)
 #endif
 	(void)cv;    // suppress warning until code gets written
 	(void)lock;  // suppress warning until code gets written
-}
\ No newline at end of file
+}
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+	struct rwlock *rw;
+
+	rw = kmalloc(sizeof(*rw));
+	if (rw == NULL) {
+		return NULL;
+	}
+
+	rw->rwlock_name = kstrdup(name);
+	if (rw->rwlock_name == NULL) {
+		kfree(rw);
+		return NULL;
+	}
+
+	rw->rw_readwc = wchan_create(rw->rwlock_name);
+	if (rw->rw_readwc == NULL) {
+		kfree(rw->rwlock_name);
+		kfree(rw);
+		return NULL;
+	}
+	rw->rw_writewc = wchan_create(rw->rwlock_name);
+	if (rw->rw_writewc == NULL) {
+		wchan_destroy(rw->rw_readwc);
+		kfree(rw->rwlock_name);
+		kfree(rw);
+		return NULL;
+	}
+
+	spinlock_init(&rw->rw_lock);
+	rw->rw_readers = 0;
+	rw->rw_writerswaiting = 0;
+	rw->rw_writer = NULL;
+	HANGMAN_LOCKABLEINIT(&rw->rw_hangman, rw->rwlock_name);
+
+	return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(rw->rw_readers == 0);
+	KASSERT(rw->rw_writer == NULL);
+	KASSERT(rw->rw_writerswaiting == 0);
+
+	/* wchan_cleanup will assert if anyone's waiting on it */
+	spinlock_cleanup(&rw->rw_lock);
+	wchan_destroy(rw->rw_writewc);
+	wchan_destroy(rw->rw_readwc);
+	kfree(rw->rwlock_name);
+	kfree(rw);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+	bool waited = false;
+
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer != curthread);
+	while (rw->rw_writer != NULL || rw->rw_writerswaiting > 0) {
+		if (!waited) {
+			HANGMAN_WAIT(&curthread->t_hangman, &rw->rw_hangman);
+			waited = true;
+		}
+		wchan_sleep(rw->rw_readwc, &rw->rw_lock);
+	}
+	if (waited) {
+		HANGMAN_GIVEUP(&curthread->t_hangman, &rw->rw_hangman);
+	}
+	rw->rw_readers++;
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_readers > 0);
+	rw->rw_readers--;
+	if (rw->rw_readers == 0 && rw->rw_writerswaiting > 0) {
+		wchan_wakeone(rw->rw_writewc, &rw->rw_lock);
+	}
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer != curthread);
+	HANGMAN_WAIT(&curthread->t_hangman, &rw->rw_hangman);
+	rw->rw_writerswaiting++;
+	while (rw->rw_writer != NULL || rw->rw_readers > 0) {
+		wchan_sleep(rw->rw_writewc, &rw->rw_lock);
+	}
+	rw->rw_writerswaiting--;
+	rw->rw_writer = curthread;
+	HANGMAN_ACQUIRE(&curthread->t_hangman, &rw->rw_hangman);
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer == curthread);
+	rw->rw_writer = NULL;
+	HANGMAN_RELEASE(&curthread->t_hangman, &rw->rw_hangman);
+	if (rw->rw_writerswaiting > 0) {
+		wchan_wakeone(rw->rw_writewc, &rw->rw_lock);
+	}
+	else {
+		wchan_wakeall(rw->rw_readwc, &rw->rw_lock);
+	}
+	spinlock_release(&rw->rw_lock);
+}
+
+bool
+rwlock_do_i_hold_write(struct rwlock *rw)
+{
+	bool ret;
+
+	spinlock_acquire(&rw->rw_lock);
+	ret = rw->rw_writer == curthread;
+	spinlock_release(&rw->rw_lock);
+	return ret;
+}
@@ -41,6 +41,7 @@
 #include <spl.h>
 #include <spinlock.h>
 #include <wchan.h>
+#include <callout.h>
 #include <thread.h>
 #include <threadlist.h>
 #include <threadprivate.h>
@@ -69,6 +70,9 @@ static struct cpuarray allcpus;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+/* Priority adjustment for threads going to sleep; see schedule(). */
+static void thread_sleep_boost(struct thread *cur);
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -109,44 +113,98 @@ thread_checkstack(struct thread *thread)
 }
 
 /*
- * Create a thread. This is used both to create a first thread
- * for each CPU and to create subsequent forked threads.
+ * Set the name of a new or recycled thread. Short names are copied
+ * into the thread itself so forking usually needn't allocate one.
  */
 static
-struct thread *
-thread_create(const char *name)
+int
+thread_setname(struct thread *thread, const char *name)
 {
-	struct thread *thread;
-
 	DEBUGASSERT(name != NULL);
 
-	thread = kmalloc(sizeof(*thread));
-	if (thread == NULL) {
-		return NULL;
+	if (strlen(name) < sizeof(thread->t_namebuf)) {
+		strcpy(thread->t_namebuf, name);
+		thread->t_name = thread->t_namebuf;
+		return 0;
 	}
-
 	thread->t_name = kstrdup(name);
 	if (thread->t_name == NULL) {
-		kfree(thread);
-		return NULL;
+		thread->t_name = thread->t_namebuf;
+		return ENOMEM;
 	}
+	return 0;
+}
+
+/*
+ * Free the name of a thread, if it was allocated.
+ */
+static
+void
+thread_freename(struct thread *thread)
+{
+	if (thread->t_name != thread->t_namebuf) {
+		kfree(thread->t_name);
+	}
+	thread->t_name = thread->t_namebuf;
+	thread->t_namebuf[0] = '\0';
+}
+
+/*
+ * Initialize the fields of a thread that is about to be used, whether
+ * newly allocated or taken from the thread cache. Does not touch the
+ * name or the stack.
+ */
+static
+void
+thread_init(struct thread *thread)
+{
 	thread->t_wchan_name = "NEW";
 	thread->t_state = S_READY;
 
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
 	threadlistnode_init(&thread->t_listnode, thread);
-	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
+	HANGMAN_ACTORINIT(&thread->t_hangman, thread->t_name);
 
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
 	thread->t_curspl = IPL_HIGH;
 	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
 
+	/* Scheduler fields: new threads start at the top */
+	thread->t_priority = 0;
+	thread->t_ticks = 0;
+	thread->t_cputicks = 0;
+	thread->t_lastran = 0;
+	thread->t_timedsleep = false;
+
 	/* If you add to struct thread, be sure to initialize here */
+}
+
+/*
+ * Create a thread. This is used both to create a first thread
+ * for each CPU and to create subsequent forked threads.
+ */
+static
+struct thread *
+thread_create(const char *name)
+{
+	struct thread *thread;
+
+	thread = kmalloc(sizeof(*thread));
+	if (thread == NULL) {
+		return NULL;
+	}
+
+	if (thread_setname(thread, name)) {
+		kfree(thread);
+		return NULL;
+	}
+	thread->t_stack = NULL;
+	thread_init(thread);
 
 	return thread;
 }
@@ -163,6 +221,7 @@ struct cpu *
 cpu_create(unsigned hardware_number)
 {
 	struct cpu *c;
+	unsigned i;
 	int result;
 	char namebuf[16];
 
@@ -176,17 +235,36 @@ cpu_create(unsigned hardware_number)
 
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
+	threadlist_init(&c->c_threadcache);
 	c->c_hardclocks = 0;
 	c->c_spinlocks = 0;
+	c->c_npagecache = 0;
+	spinlock_init(&c->c_pagecache_lock);
+	c->c_tlbvictim = 0;
+	c->c_tlbfaults = 0;
+	c->c_tlbreloads = 0;
+	c->c_tlbevictions = 0;
+	c->c_tlbinvalidations = 0;
+	c->c_curas = NULL;
+	c->c_curasid = 0;
+	c->c_asidnext = 1;
+	c->c_asidgen = 1;
+	c->c_idleticks = 0;
+	c->c_timerskew = 0;
 
 	c->c_isidle = false;
-	threadlist_init(&c->c_runqueue);
+	for (i=0; i<SCHED_NPRIO; i++) {
+		threadlist_init(&c->c_runqueue[i]);
+	}
+	c->c_runcount = 0;
 	spinlock_init(&c->c_runqueue_lock);
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
 	spinlock_init(&c->c_ipi_lock);
 
+	callout_cpu_init(c);
+
 	result = cpuarray_add(&allcpus, c, &c->c_number);
 	if (result != 0) {
 		panic("cpu_create: array_add: %s\n", strerror(result));
@@ -249,6 +327,21 @@ cpu_create(unsigned hardware_number)
 	return c;
 }
 
+/*
+ * Number of cpus, and access to each one; see cpu.h.
+ */
+unsigned
+cpu_count(void)
+{
+	return cpuarray_num(&allcpus);
+}
+
+struct cpu *
+cpu_get(unsigned n)
+{
+	return cpuarray_get(&allcpus, n);
+}
+
 /*
  * Destroy a thread.
  *
@@ -280,13 +373,80 @@ thread_destroy(struct thread *thread)
 	/* sheer paranoia */
 	thread->t_wchan_name = "DESTROYED";
 
-	kfree(thread->t_name);
+	thread_freename(thread);
 	kfree(thread);
 }
 
+/*
+ * Thread cache.
+ *
+ * Forking a thread costs two allocations (the thread and its stack)
+ * and exiting costs two frees, all under the allocator's lock. So
+ * instead of destroying exited threads, exorcise() keeps up to
+ * THREAD_CACHE_MAX of them per cpu, stacks still attached, and
+ * thread_fork takes one from there when it can. The most recently
+ * exited thread is reused first, as its stack is most likely to
+ * still be in the cache.
+ *
+ * Each cpu only touches its own cache, with interrupts off, so no
+ * lock is needed.
+ */
+#define THREAD_CACHE_MAX 16
+
+/*
+ * Keep the exited thread Z for reuse if there's room; otherwise
+ * destroy it. Called from exorcise(), with interrupts off.
+ */
+static
+void
+thread_cache_put(struct thread *z)
+{
+	struct threadlist *cache = &curcpu->c_threadcache;
+
+	if (z->t_stack == NULL || cache->tl_count >= THREAD_CACHE_MAX) {
+		thread_destroy(z);
+		return;
+	}
+
+	KASSERT(z->t_proc == NULL);
+	thread_checkstack(z);
+	thread_machdep_cleanup(&z->t_machdep);
+	thread_freename(z);
+	z->t_wchan_name = "CACHED";
+	threadlist_addhead(cache, z);
+}
+
+/*
+ * Get a thread, with a stack, from this cpu's cache and set it up as
+ * a new thread called NAME. Returns NULL if the cache is empty (or
+ * if a long name can't be allocated).
+ */
+static
+struct thread *
+thread_cache_get(const char *name)
+{
+	struct thread *thread;
+	int spl;
+
+	spl = splhigh();
+	thread = threadlist_remhead(&curcpu->c_threadcache);
+	splx(spl);
+	if (thread == NULL) {
+		return NULL;
+	}
+
+	if (thread_setname(thread, name)) {
+		thread_destroy(thread);
+		return NULL;
+	}
+	thread_init(thread);
+	thread_checkstack_init(thread);
+	return thread;
+}
+
 /*
  * Clean up zombies. (Zombies are threads that have exited but still
- * need to have thread_destroy called on them.)
+ * need to be destroyed, or put in the thread cache.)
  *
  * The list of zombies is per-cpu.
  */
@@ -299,7 +459,7 @@ exorcise(void)
 	while ((z = threadlist_remhead(&curcpu->c_zombies)) != NULL) {
 		KASSERT(z != curthread);
 		KASSERT(z->t_state == S_ZOMBIE);
-		thread_destroy(z);
+		thread_cache_put(z);
 	}
 }
 
@@ -311,6 +471,9 @@ exorcise(void)
 void
 thread_panic(void)
 {
+	struct threadlist *rq;
+	unsigned i;
+
 	/*
 	 * Kill off other CPUs.
 	 *
@@ -325,9 +488,13 @@ thread_panic(void)
 	 * to.  Instead, blat the list structure by hand, and take the
 	 * risk that it might not be quite atomic.
 	 */
-	curcpu->c_runqueue.tl_count = 0;
-	curcpu->c_runqueue.tl_head.tln_next = &curcpu->c_runqueue.tl_tail;
-	curcpu->c_runqueue.tl_tail.tln_prev = &curcpu->c_runqueue.tl_head;
+	for (i=0; i<SCHED_NPRIO; i++) {
+		rq = &curcpu->c_runqueue[i];
+		rq->tl_count = 0;
+		rq->tl_head.tln_next = &rq->tl_tail;
+		rq->tl_tail.tln_prev = &rq->tl_head;
+	}
+	curcpu->c_runcount = 0;
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -439,6 +606,178 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Run queue operations. Call with C's run queue lock held.
+ *
+ * Each cpu has one run queue per priority level; threads are queued
+ * at the tail of the queue for their t_priority and taken from the
+ * head of the highest-priority nonempty queue. c_runcount tracks the
+ * total so other cpus can check the load without the lock.
+ */
+
+static
+void
+runqueue_add(struct cpu *c, struct thread *t)
+{
+	KASSERT(t->t_priority < SCHED_NPRIO);
+	threadlist_addtail(&c->c_runqueue[t->t_priority], t);
+	c->c_runcount++;
+}
+
+static
+void
+runqueue_remove(struct cpu *c, struct thread *t)
+{
+	threadlist_remove(&c->c_runqueue[t->t_priority], t);
+	c->c_runcount--;
+}
+
+/* Take the next thread to run: the first of the highest priority. */
+static
+struct thread *
+runqueue_remhead(struct cpu *c)
+{
+	unsigned i;
+
+	for (i=0; i<SCHED_NPRIO; i++) {
+		if (!threadlist_isempty(&c->c_runqueue[i])) {
+			c->c_runcount--;
+			return threadlist_remhead(&c->c_runqueue[i]);
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Load balancing.
+ *
+ * Rather than having busy cpus push work away, a cpu that runs out of
+ * threads pulls one from the busiest other cpu (thread_steal) before
+ * going idle. Loads are compared using the unlocked c_runcount hints,
+ * so looking for work costs one lock, that of the victim.
+ *
+ * A thread's t_cpu is the cpu it last ran on, and wakeups queue it
+ * there, so threads normally stay where their cache state is. A
+ * stealing cpu takes the thread the victim would run last, skipping
+ * ones that ran on the victim within the last SCHED_HOT_HARDCLOCKS
+ * ticks (and so likely still have state in its cache) unless there
+ * is nothing else to take.
+ *
+ * So that queued work doesn't wait for an idle cpu's next timer tick,
+ * a cpu that queues a thread behind a running one pokes an idle cpu
+ * (thread_kick_idle).
+ */
+
+#define SCHED_HOT_HARDCLOCKS	2
+
+/*
+ * Poke some idle cpu other than BUSY, if there is one, so it looks for
+ * work to steal.
+ */
+static
+void
+thread_kick_idle(struct cpu *busy)
+{
+	struct cpu *c;
+	unsigned i, numcpus;
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != busy && c->c_isidle) {
+			ipi_send(c, IPI_UNIDLE);
+			return;
+		}
+	}
+}
+
+/*
+ * Take a thread from VICTIM's run queue to run here. Call with
+ * VICTIM's run queue lock held (and not our own).
+ */
+static
+struct thread *
+thread_steal_from(struct cpu *victim)
+{
+	struct thread *t, *cold, *any;
+	unsigned i;
+
+	cold = any = NULL;
+	for (i=SCHED_NPRIO; i-- > 0 && cold == NULL; ) {
+		THREADLIST_FORALL_REV(t, victim->c_runqueue[i]) {
+			/*
+			 * A thread that went to sleep on a cpu that
+			 * then went idle is still that cpu's
+			 * curthread, and if woken it is on the run
+			 * queue before the cpu has switched away from
+			 * it. Moving it then would be a disaster.
+			 */
+			if (t == victim->c_curthread) {
+				continue;
+			}
+			if (any == NULL) {
+				any = t;
+			}
+			if (victim->c_hardclocks - t->t_lastran >=
+			    SCHED_HOT_HARDCLOCKS) {
+				cold = t;
+				break;
+			}
+		}
+	}
+
+	t = cold;
+	if (t == NULL && victim->c_runcount >= 2) {
+		t = any;
+	}
+	if (t == NULL) {
+		return NULL;
+	}
+
+	runqueue_remove(victim, t);
+	t->t_cpu = curcpu->c_self;
+	DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u",
+	      t->t_name, victim->c_number, curcpu->c_number);
+	return t;
+}
+
+/*
+ * Look for a thread to steal from another cpu. Called by a cpu about
+ * to go idle, with interrupts off and without its own run queue lock
+ * (two idle cpus could otherwise deadlock stealing from each other).
+ */
+static
+struct thread *
+thread_steal(void)
+{
+	struct cpu *c, *victim;
+	struct thread *t;
+	unsigned i, numcpus, best;
+
+	victim = NULL;
+	best = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		/* an idle cpu is about to run its own threads */
+		if (c == curcpu->c_self || c->c_isidle) {
+			continue;
+		}
+		if (c->c_runcount > best) {
+			best = c->c_runcount;
+			victim = c;
+		}
+	}
+	if (victim == NULL) {
+		return NULL;
+	}
+
+	spinlock_acquire(&victim->c_runqueue_lock);
+	t = thread_steal_from(victim);
+	spinlock_release(&victim->c_runqueue_lock);
+	return t;
+}
+
 /*
  * Make a thread runnable.
  *
@@ -463,14 +802,20 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 
 	/* Target thread is now ready to run; put it on the run queue. */
 	target->t_state = S_READY;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	runqueue_add(targetcpu, target);
 
-	if (targetcpu->c_isidle && targetcpu != curcpu->c_self) {
-		/*
-		 * Other processor is idle; send interrupt to make
-		 * sure it unidles.
-		 */
-		ipi_send(targetcpu, IPI_UNIDLE);
+	if (targetcpu->c_isidle) {
+		if (targetcpu != curcpu->c_self) {
+			/*
+			 * Other processor is idle; send interrupt to
+			 * make sure it unidles.
+			 */
+			ipi_send(targetcpu, IPI_UNIDLE);
+		}
+	}
+	else {
+		/* It has to wait; maybe someone else can run it. */
+		thread_kick_idle(targetcpu);
 	}
 
 	if (!already_have_lock) {
@@ -497,18 +842,22 @@ thread_fork(const char *name,
 	struct thread *newthread;
 	int result;
 
-	newthread = thread_create(name);
+	/* Reuse an exited thread and its stack if we can */
+	newthread = thread_cache_get(name);
 	if (newthread == NULL) {
-		return ENOMEM;
-	}
+		newthread = thread_create(name);
+		if (newthread == NULL) {
+			return ENOMEM;
+		}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
-	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
+		/* Allocate a stack */
+		newthread->t_stack = kmalloc(STACK_SIZE);
+		if (newthread->t_stack == NULL) {
+			thread_destroy(newthread);
+			return ENOMEM;
+		}
+		thread_checkstack_init(newthread);
 	}
-	thread_checkstack_init(newthread);
 
 	/*
 	 * Now we clone various fields from the parent thread.
@@ -585,12 +934,15 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
 	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	if (newstate == S_READY && curcpu->c_runcount == 0) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
 	}
 
+	/* Note when it ran, for cache affinity. */
+	cur->t_lastran = curcpu->c_hardclocks;
+
 	/* Put the thread in the right place. */
 	switch (newstate) {
 	    case S_RUN:
@@ -599,6 +951,7 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 		thread_make_runnable(cur, true /*have lock*/);
 		break;
 	    case S_SLEEP:
+		thread_sleep_boost(cur);
 		cur->t_wchan_name = wc->wc_name;
 		/*
 		 * Add the thread to the list in the wait channel, and
@@ -638,10 +991,15 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		next = runqueue_remhead(curcpu);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			next = thread_steal();
+			if (next == NULL) {
+				/* no need to wake up before the next callout */
+				mainbus_idle_timer(callout_next());
+				cpu_idle();
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
@@ -815,139 +1173,116 @@ thread_yield(void)
 /*
  * Scheduler.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * This is a multilevel feedback queue. A thread at priority P runs
+ * for a quantum of SCHED_QUANTUM(P) hardclocks before it is preempted
+ * (thread_tick); using up a whole quantum moves it one level down, so
+ * compute-bound threads sink to the long quanta at the bottom. A
+ * thread that goes to sleep having used less than half its quantum
+ * moves one level up instead, so threads that mostly wait for the
+ * console or the disk stay near the top and get the cpu quickly when
+ * they wake. Time used before sleeping is carried over, so a thread
+ * can't stay on top by sleeping just before its quantum runs out.
+ *
+ * A running thread is also preempted at the next hardclock if a
+ * thread of higher priority is waiting on its cpu. To keep the
+ * bottom from starving, schedule() periodically moves every thread on
+ * the cpu one level up.
  */
 
-void
-schedule(void)
-{
-	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
-	 */
-}
+#define SCHED_QUANTUM(prio)	(1U << (prio))
 
 /*
- * Thread migration.
- *
- * This is also called periodically from hardclock(). If the current
- * CPU is busy and other CPUs are idle, or less busy, it should move
- * threads across to those other other CPUs.
- *
- * Migrating threads isn't free because of cache affinity; a thread's
- * working cache set will end up having to be moved to the other CPU,
- * which is fairly slow. The tradeoff between this performance loss
- * and the performance loss due to underutilization of some CPUs is
- * something that needs to be tuned and probably is workload-specific.
- *
- * For here and now, because we know we're running on System/161 and
- * System/161 does not (yet) model such cache effects, we'll be very
- * aggressive.
+ * Called when CUR goes to sleep: reward it if it didn't use much of
+ * its quantum.
  */
+static
 void
-thread_consider_migration(void)
+thread_sleep_boost(struct thread *cur)
 {
-	unsigned my_count, total_count, one_share, to_send;
-	unsigned i, numcpus;
-	struct cpu *c;
-	struct threadlist victims;
-	struct thread *t;
-
-	my_count = total_count = 0;
-	numcpus = cpuarray_num(&allcpus);
-	for (i=0; i<numcpus; i++) {
-		c = cpuarray_get(&allcpus, i);
-		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
-		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
+	if (cur->t_ticks * 2 < SCHED_QUANTUM(cur->t_priority)) {
+		if (cur->t_priority > 0) {
+			cur->t_priority--;
 		}
-		spinlock_release(&c->c_runqueue_lock);
+		cur->t_ticks = 0;
 	}
+}
 
-	one_share = DIVROUNDUP(total_count, numcpus);
-	if (my_count < one_share) {
-		return;
-	}
+bool
+thread_tick(void)
+{
+	struct thread *cur = curthread;
+	bool expired, preempt;
+	unsigned i;
 
-	to_send = my_count - one_share;
-	threadlist_init(&victims);
-	spinlock_acquire(&curcpu->c_runqueue_lock);
-	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
-		threadlist_addhead(&victims, t);
+	if (curcpu->c_isidle) {
+		/* curthread isn't really running; charge nobody */
+		return false;
 	}
-	spinlock_release(&curcpu->c_runqueue_lock);
 
-	for (i=0; i < numcpus && to_send > 0; i++) {
-		c = cpuarray_get(&allcpus, i);
-		if (c == curcpu->c_self) {
-			continue;
+	cur->t_cputicks++;
+	cur->t_ticks++;
+
+	expired = cur->t_ticks >= SCHED_QUANTUM(cur->t_priority);
+	if (expired) {
+		if (cur->t_priority < SCHED_NPRIO - 1) {
+			cur->t_priority++;
 		}
-		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
-			t = threadlist_remhead(&victims);
-			/*
-			 * Ordinarily, curthread will not appear on
-			 * the run queue. However, it can under the
-			 * following circumstances:
-			 *   - it went to sleep;
-			 *   - the processor became idle, so it
-			 *     remained curthread;
-			 *   - it was reawakened, so it was put on the
-			 *     run queue;
-			 *   - and the processor hasn't fully unidled
-			 *     yet, so all these things are still true.
-			 *
-			 * If the timer interrupt happens at (almost)
-			 * exactly the proper moment, we can come here
-			 * while things are in this state and see
-			 * curthread. However, *migrating* curthread
-			 * can cause bad things to happen (Exercise:
-			 * Why? And what?) so shuffle it to the end of
-			 * the list and decrement to_send in order to
-			 * skip it. Then it goes back on our own run
-			 * queue below.
-			 */
-			if (t == curthread) {
-				threadlist_addtail(&victims, t);
-				to_send--;
-				continue;
-			}
+		cur->t_ticks = 0;
+		/* nobody else is waiting, so don't bother switching */
+		return curcpu->c_runcount > 0;
+	}
 
-			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
-			DEBUG(DB_THREADS,
-			      "Migrated thread %s: cpu %u -> %u",
-			      t->t_name, curcpu->c_number, c->c_number);
-			to_send--;
-			if (c->c_isidle) {
-				/*
-				 * Other processor is idle; send
-				 * interrupt to make sure it unidles.
-				 */
-				ipi_send(c, IPI_UNIDLE);
-			}
+	preempt = false;
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	for (i=0; i<cur->t_priority; i++) {
+		if (!threadlist_isempty(&curcpu->c_runqueue[i])) {
+			preempt = true;
+			break;
 		}
-		spinlock_release(&c->c_runqueue_lock);
 	}
+	spinlock_release(&curcpu->c_runqueue_lock);
 
-	/*
-	 * Because the code above isn't atomic, the thread counts may have
-	 * changed while we were working and we may end up with leftovers.
-	 * Don't panic; just put them back on our own run queue.
-	 */
-	if (!threadlist_isempty(&victims)) {
-		spinlock_acquire(&curcpu->c_runqueue_lock);
-		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+	return preempt;
+}
+
+/*
+ * This is called periodically from hardclock(). It ages the current
+ * CPU's run queues: every thread moves up one priority level.
+ */
+void
+schedule(void)
+{
+	struct thread *t;
+	unsigned i;
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	for (i=1; i<SCHED_NPRIO; i++) {
+		while ((t = threadlist_remhead(&curcpu->c_runqueue[i]))
+		       != NULL) {
+			t->t_priority = i - 1;
+			threadlist_addtail(&curcpu->c_runqueue[i - 1], t);
 		}
-		spinlock_release(&curcpu->c_runqueue_lock);
 	}
+	if (!curcpu->c_isidle && curthread->t_priority > 0) {
+		curthread->t_priority--;
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+}
 
-	KASSERT(threadlist_isempty(&victims));
-	threadlist_cleanup(&victims);
+/*
+ * Thread migration.
+ *
+ * This is also called periodically from hardclock(). Idle cpus take
+ * work from busy ones themselves (see thread_steal), and are normally
+ * poked when work is queued; this just catches anything missed, by
+ * poking an idle cpu if we have threads waiting. It takes no locks.
+ */
+void
+thread_consider_migration(void)
+{
+	if (curcpu->c_runcount > 0) {
+		thread_kick_idle(curcpu->c_self);
+	}
 }
 
 ////////////////////////////////////////////////////////////
@@ -1013,6 +1348,80 @@ wchan_sleep(struct wchan *wc, struct spinlock *lk)
 	spinlock_acquire(lk);
 }
 
+/*
+ * State shared between wchan_sleep_timeout and its callout. It lives
+ * on the sleeper's stack.
+ */
+struct wchan_timeout {
+	struct thread *wt_thread;
+	struct wchan *wt_wc;
+	struct spinlock *wt_lk;
+	bool wt_expired;
+};
+
+/*
+ * Callout for wchan_sleep_timeout: if the thread is still asleep,
+ * take it off the channel and wake it up.
+ */
+static
+void
+wchan_timeout(void *data)
+{
+	struct wchan_timeout *wt = data;
+	struct thread *target = wt->wt_thread;
+
+	spinlock_acquire(wt->wt_lk);
+	if (target->t_timedsleep) {
+		threadlist_remove(&wt->wt_wc->wc_threads, target);
+		target->t_timedsleep = false;
+		wt->wt_expired = true;
+		thread_make_runnable(target, false);
+	}
+	spinlock_release(wt->wt_lk);
+}
+
+/*
+ * Like wchan_sleep, but give up after TICKS hardclocks. Returns 0 if
+ * woken by wchan_wake*, ETIMEDOUT if the time ran out first.
+ *
+ * The callout is stopped, or waited for, before relocking LK, since
+ * it needs LK itself.
+ */
+int
+wchan_sleep_timeout(struct wchan *wc, struct spinlock *lk, unsigned ticks)
+{
+	struct wchan_timeout wt;
+	struct callout timeout;
+
+	/* may not sleep in an interrupt handler */
+	KASSERT(!curthread->t_in_interrupt);
+
+	/* must hold the spinlock */
+	KASSERT(spinlock_do_i_hold(lk));
+
+	/* must not hold other spinlocks */
+	KASSERT(curcpu->c_spinlocks == 1);
+
+	wt.wt_thread = curthread;
+	wt.wt_wc = wc;
+	wt.wt_lk = lk;
+	wt.wt_expired = false;
+	callout_init(&timeout, wchan_timeout, &wt);
+
+	curthread->t_timedsleep = true;
+	callout_schedule(&timeout, ticks);
+	thread_switch(S_SLEEP, wc, lk);
+
+	if (!callout_stop(&timeout)) {
+		/* it fired; it may still be using wt */
+		callout_drain(&timeout);
+	}
+	spinlock_acquire(lk);
+	KASSERT(!curthread->t_timedsleep);
+
+	return wt.wt_expired ? ETIMEDOUT : 0;
+}
+
 /*
  * Wake up one thread sleeping on a wait channel.
  */
@@ -1030,6 +1439,7 @@ wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 		/* Nobody was sleeping. */
 		return;
 	}
+	target->t_timedsleep = false;
 
 	/*
 	 * Note that thread_make_runnable acquires a runqueue lock
@@ -1060,6 +1470,7 @@ wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 	 * private list.
 	 */
 	while ((target = threadlist_remhead(&wc->wc_threads)) != NULL) {
+		target->t_timedsleep = false;
 		threadlist_addtail(&list, target);
 	}
 
@@ -1167,8 +1578,9 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 void
 interprocessor_interrupt(void)
 {
+	struct tlbshootdown shootdown[TLBSHOOTDOWN_MAX];
 	uint32_t bits;
-	unsigned i;
+	unsigned i, numshootdown = 0;
 
 	spinlock_acquire(&curcpu->c_ipi_lock);
 	bits = curcpu->c_ipi_pending;
@@ -1198,16 +1610,24 @@ interprocessor_interrupt(void)
 	}
 	if (bits & (1U << IPI_TLBSHOOTDOWN)) {
 		/*
-		 * Note: depending on your VM system locking you might
-		 * need to release the ipi lock while calling
-		 * vm_tlbshootdown.
+		 * Take a copy of the requests and do them after
+		 * releasing the ipi lock. vm_tlbshootdown wakes the
+		 * thread waiting for the shootdown, which can send
+		 * an IPI of its own (thread_kick_idle); holding our
+		 * ipi lock across that can deadlock against another
+		 * cpu doing the same thing.
 		 */
-		for (i=0; i<curcpu->c_numshootdown; i++) {
-			vm_tlbshootdown(&curcpu->c_shootdown[i]);
+		numshootdown = curcpu->c_numshootdown;
+		for (i=0; i<numshootdown; i++) {
+			shootdown[i] = curcpu->c_shootdown[i];
 		}
 		curcpu->c_numshootdown = 0;
 	}
 
 	curcpu->c_ipi_pending = 0;
 	spinlock_release(&curcpu->c_ipi_lock);
+
+	for (i=0; i<numshootdown; i++) {
+		vm_tlbshootdown(&shootdown[i]);
+	}
 }
\ No newline at end of file
@@ -30,8 +30,12 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <uio.h>
+#include <vnode.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <pt.h>
+#include <coremap.h>
 #include <proc.h>
 
 /*
@@ -50,9 +54,19 @@ as_create(void)
 		return NULL;
 	}
 
-	/*
-	 * Initialize as needed.
-	 */
+	as->as_nsegs = 0;
+	spinlock_init(&as->as_ptlock);
+	as->as_dying = false;
+	as->as_evicting = 0;
+	as->as_asid = 0;
+	as->as_asidgen = 0;
+	as->as_asidcpu = NULL;
+	as->as_pt = pt_create();
+	if (as->as_pt == NULL) {
+		spinlock_cleanup(&as->as_ptlock);
+		kfree(as);
+		return NULL;
+	}
 
 	return as;
 }
@@ -61,17 +75,33 @@ int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
 	struct addrspace *newas;
+	unsigned i;
+	int result;
 
 	newas = as_create();
 	if (newas==NULL) {
 		return ENOMEM;
 	}
 
+	for (i=0; i<old->as_nsegs; i++) {
+		newas->as_segs[i] = old->as_segs[i];
+		if (newas->as_segs[i].seg_vnode != NULL) {
+			VOP_INCREF(newas->as_segs[i].seg_vnode);
+		}
+	}
+	newas->as_nsegs = old->as_nsegs;
+
 	/*
-	 * Write this.
+	 * Share every resident page copy-on-write. This write-protects
+	 * OLD's pages too, so drop the writable translations the TLB
+	 * may still hold for them.
 	 */
-
-	(void)old;
+	result = pt_copy(old, newas);
+	vmtlb_flushas(old);
+	if (result) {
+		as_destroy(newas);
+		return result;
+	}
 
 	*ret = newas;
 	return 0;
@@ -80,10 +110,18 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 void
 as_destroy(struct addrspace *as)
 {
-	/*
-	 * Clean up as needed.
-	 */
+	unsigned i;
+
+	/* Keep the pager away before tearing down the page table. */
+	coremap_as_dying(as);
+	pt_destroy(as->as_pt);
+	for (i=0; i<as->as_nsegs; i++) {
+		if (as->as_segs[i].seg_vnode != NULL) {
+			VOP_DECREF(as->as_segs[i].seg_vnode);
+		}
+	}
 
+	spinlock_cleanup(&as->as_ptlock);
 	kfree(as);
 }
 
@@ -101,53 +139,76 @@ as_activate(void)
 		return;
 	}
 
-	/*
-	 * Write this.
-	 */
+	vmtlb_activate(as);
 }
 
 void
 as_deactivate(void)
 {
 	/*
-	 * Write this. For many designs it won't need to actually do
-	 * anything. See proc.c for an explanation of why it (might)
-	 * be needed.
+	 * Nothing to do: TLB entries are tagged with the address
+	 * space's ASID, so they are harmless while it is not active.
 	 */
 }
 
+/*
+ * Add a segment covering [VADDR, VADDR+MEMSIZE), rounded out to whole
+ * pages, with permissions PERM. Nothing is allocated.
+ */
+static
+int
+as_add_segment(struct addrspace *as, vaddr_t vaddr, size_t memsize, int perm)
+{
+	struct segment *seg;
+	vaddr_t end;
+
+	end = ROUNDUP(vaddr + memsize, PAGE_SIZE);
+	vaddr &= PAGE_FRAME;
+	if (end <= vaddr || end > USERSPACETOP) {
+		return EFAULT;
+	}
+
+	if (as->as_nsegs >= AS_MAXSEGS) {
+		return ENOMEM;
+	}
+
+	seg = &as->as_segs[as->as_nsegs++];
+	seg->seg_base = vaddr;
+	seg->seg_npages = (end - vaddr) / PAGE_SIZE;
+	seg->seg_perm = perm;
+	seg->seg_vnode = NULL;
+	seg->seg_offset = 0;
+	seg->seg_fbase = vaddr;
+	seg->seg_filesize = 0;
+	return 0;
+}
+
 /*
  * Set up a segment at virtual address VADDR of size MEMSIZE. The
  * segment in memory extends from VADDR up to (but not including)
  * VADDR+MEMSIZE.
  *
  * The READABLE, WRITEABLE, and EXECUTABLE flags are set if read,
- * write, or execute permission should be set on the segment. At the
- * moment, these are ignored. When you write the VM system, you may
- * want to implement them.
+ * write, or execute permission should be set on the segment. Only
+ * WRITEABLE is enforced, since the MIPS TLB cannot express the
+ * others.
  */
 int
 as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
 		 int readable, int writeable, int executable)
 {
-	/*
-	 * Write this.
-	 */
+	int perm;
 
-	(void)as;
-	(void)vaddr;
-	(void)memsize;
-	(void)readable;
-	(void)writeable;
-	(void)executable;
-	return ENOSYS;
+	perm = (readable ? SEG_R : 0) | (writeable ? SEG_W : 0) |
+		(executable ? SEG_X : 0);
+	return as_add_segment(as, vaddr, memsize, perm);
 }
 
 int
 as_prepare_load(struct addrspace *as)
 {
 	/*
-	 * Write this.
+	 * Nothing to do: pages are loaded on demand by vm_fault.
 	 */
 
 	(void)as;
@@ -157,10 +218,6 @@ as_prepare_load(struct addrspace *as)
 int
 as_complete_load(struct addrspace *as)
 {
-	/*
-	 * Write this.
-	 */
-
 	(void)as;
 	return 0;
 }
@@ -168,11 +225,13 @@ as_complete_load(struct addrspace *as)
 int
 as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 {
-	/*
-	 * Write this.
-	 */
+	int result;
 
-	(void)as;
+	result = as_add_segment(as, USERSTACK - AS_STACKPAGES * PAGE_SIZE,
+				AS_STACKPAGES * PAGE_SIZE, SEG_R | SEG_W);
+	if (result) {
+		return result;
+	}
 
 	/* Initial user-level stack pointer */
 	*stackptr = USERSTACK;
@@ -180,3 +239,115 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+/*
+ * Attach the file V to the region containing VADDR: FILESIZE bytes
+ * starting at VADDR come from V at offset OFFSET. The region must
+ * already have been defined with as_define_region.
+ */
+int
+as_define_backing(struct addrspace *as, vaddr_t vaddr, size_t filesize,
+		  struct vnode *v, off_t offset)
+{
+	struct segment *seg;
+	unsigned i;
+
+	if (filesize == 0) {
+		return 0;
+	}
+
+	for (i=0; i<as->as_nsegs; i++) {
+		seg = &as->as_segs[i];
+		if (seg->seg_vnode != NULL || vaddr < seg->seg_base ||
+		    vaddr + filesize >
+		    seg->seg_base + seg->seg_npages * PAGE_SIZE) {
+			continue;
+		}
+
+		VOP_INCREF(v);
+		seg->seg_vnode = v;
+		seg->seg_offset = offset;
+		seg->seg_fbase = vaddr;
+		seg->seg_filesize = filesize;
+		return 0;
+	}
+	return EFAULT;
+}
+
+/*
+ * Return the segment containing VADDR. If two segments share the
+ * page, prefer the writable one so that writes to it are allowed.
+ */
+struct segment *
+as_find_segment(struct addrspace *as, vaddr_t vaddr)
+{
+	struct segment *seg, *found;
+	unsigned i;
+
+	found = NULL;
+	for (i=0; i<as->as_nsegs; i++) {
+		seg = &as->as_segs[i];
+		if (vaddr >= seg->seg_base &&
+		    vaddr < seg->seg_base + seg->seg_npages * PAGE_SIZE) {
+			if (seg->seg_perm & SEG_W) {
+				return seg;
+			}
+			if (found == NULL) {
+				found = seg;
+			}
+		}
+	}
+	return found;
+}
+
+/*
+ * Initialize the physical page PADDR with what the user page at VADDR
+ * should start out holding: zeros, overlaid with whatever parts of
+ * the executable map onto it. (Two ELF segments can share a page, so
+ * check all of them.)
+ */
+int
+as_fill_page(struct addrspace *as, vaddr_t vaddr, paddr_t paddr)
+{
+	struct segment *seg;
+	struct iovec iov;
+	struct uio ku;
+	vaddr_t start, end;
+	char *kbuf;
+	unsigned i;
+	int result;
+
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+
+	kbuf = (char *)PADDR_TO_KVADDR(paddr);
+	bzero(kbuf, PAGE_SIZE);
+
+	for (i=0; i<as->as_nsegs; i++) {
+		seg = &as->as_segs[i];
+		if (seg->seg_vnode == NULL) {
+			continue;
+		}
+
+		start = seg->seg_fbase > vaddr ? seg->seg_fbase : vaddr;
+		end = seg->seg_fbase + seg->seg_filesize;
+		if (end > vaddr + PAGE_SIZE) {
+			end = vaddr + PAGE_SIZE;
+		}
+		if (start >= end) {
+			continue;
+		}
+
+		uio_kinit(&iov, &ku, kbuf + (start - vaddr), end - start,
+			  seg->seg_offset + (start - seg->seg_fbase), UIO_READ);
+		result = VOP_READ(seg->seg_vnode, &ku);
+		if (result) {
+			return result;
+		}
+		if (ku.uio_resid != 0) {
+			/* short read; executable was truncated */
+			kprintf("as_fill_page: short read on segment\n");
+			return ENOEXEC;
+		}
+	}
+
+	return 0;
+}
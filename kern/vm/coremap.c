@@ -0,0 +1,861 @@
+/*
+ * Coremap: physical page frame allocation.
+ *
+ * There is one struct coremap_entry per physical page frame. Kernel
+ * allocations are runs of contiguous frames (the first frame of the
+ * run records its length so free_kpages knows how much to release);
+ * user pages are always single frames and remember which address
+ * space and virtual page they belong to.
+ *
+ * User frames are reference counted so that fork can share them
+ * copy-on-write. A shared frame has no owner (cme_as is NULL); the
+ * last remaining sharer becomes the owner again when it writes to the
+ * page (coremap_claim_upage) or just loads it into the TLB
+ * (coremap_reference_upage), so pages that are only ever read don't
+ * stay unevictable after a fork.
+ *
+ * Only owned, unshared, unpinned user frames can be evicted to swap.
+ * Victims are chosen by the clock algorithm: the hand sweeps the
+ * coremap, giving a second chance to frames that vm_fault has marked
+ * referenced since the last sweep. A pager thread (vm.c) evicts ahead
+ * of demand to keep at least CM_PAGER_LOW frames free; below
+ * CM_RESERVE, user allocations fail (and the caller evicts
+ * synchronously) so that the kernel heap always has something left.
+ *
+ * Free frames are managed as a binary buddy system: free memory is a
+ * set of naturally aligned blocks of 2^k frames (k <= CM_MAXORDER),
+ * one doubly linked free list per order, threaded through the coremap
+ * entries themselves. An allocation takes the smallest block that
+ * fits, splitting larger ones as needed, and gives back any frames
+ * beyond what was asked for, so odd-sized kernel allocations do not
+ * waste memory. Freed blocks are merged with their buddies. Both are
+ * O(CM_MAXORDER), independent of the amount of RAM.
+ *
+ * Single-page kernel allocations mostly bypass all of this: each cpu
+ * keeps a small stack of free pages (c_pagecache in struct cpu) that
+ * it refills from, and drains to, the buddy lists in batches of
+ * CM_BATCH, so the coremap lock is taken once per batch rather than
+ * once per page. Pages sitting in a cpu's cache are CME_CACHED. When
+ * memory runs short, every cpu's cache is drained back before an
+ * allocation fails or the pager evicts anything (cm_pagecache_drain),
+ * so free pages aren't left stranded there. A cpu's c_pagecache_lock
+ * comes before coremap_lock.
+ *
+ * Frames below the first free address reported by ram.c hold the
+ * kernel image, the exception vectors, anything ram_stealmem handed
+ * out during early boot, and the coremap itself. They are marked
+ * CME_FIXED and are never reused.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
+#include <thread.h>
+#include <wchan.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <coremap.h>
+
+/* Frame states */
+#define CME_FREE	0	/* available */
+#define CME_FIXED	1	/* kernel image or early boot, never freed */
+#define CME_KERNEL	2	/* part of an alloc_kpages run */
+#define CME_USER	3	/* page of a user address space */
+#define CME_CACHED	4	/* free, in some cpu's c_pagecache */
+
+/* Pages moved between a cpu's page cache and the buddy lists at once. */
+#define CM_BATCH	(CPU_PAGECACHE / 2)
+
+/* Free frame watermarks. */
+#define CM_RESERVE	8	/* user pages can't use the last few frames */
+#define CM_PAGER_LOW	32	/* wake the pager below this */
+#define CM_PAGER_HIGH	64	/* the pager stops evicting above this */
+
+/* Largest buddy block is 2^CM_MAXORDER frames (4M). */
+#define CM_MAXORDER	10
+#define CM_NOTHEAD	0xff	/* cme_order of frames not heading a free block */
+
+struct coremap_entry {
+	struct addrspace *cme_as;	/* owner, for CME_USER */
+	vaddr_t cme_vaddr;		/* user virtual page, for CME_USER */
+	unsigned cme_npages;		/* run length, first page of CME_KERNEL */
+	unsigned cme_refcount;		/* page tables mapping it, CME_USER */
+	unsigned cme_next;		/* free list links, for free block heads */
+	unsigned cme_prev;
+	uint8_t cme_state;		/* CME_* */
+	uint8_t cme_order;		/* order if free block head, else CM_NOTHEAD */
+	uint8_t cme_busy;		/* pinned, or being evicted */
+	uint8_t cme_referenced;		/* used since the clock hand passed */
+};
+
+/*
+ * Before coremap_bootstrap runs, pages come straight from ram_stealmem.
+ */
+static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * One lock for the whole coremap.
+ */
+static struct spinlock coremap_lock = SPINLOCK_INITIALIZER;
+
+static struct coremap_entry *coremap;
+static unsigned long coremap_nframes;	/* frames of RAM in total */
+static unsigned long coremap_nfree;	/* frames currently free */
+static bool coremap_ready = false;
+
+/*
+ * Buddy free lists. Frame 0 holds the exception vectors and is never
+ * free, so 0 doubles as the list terminator.
+ */
+static unsigned cm_freelist[CM_MAXORDER+1];
+static unsigned long cm_nblocks[CM_MAXORDER+1];	/* blocks on each list */
+
+/*
+ * Page replacement state.
+ */
+static unsigned long cm_clockhand;	/* next frame the clock looks at */
+static struct wchan *cm_pagerwc;	/* pager thread sleeps here */
+static struct wchan *cm_evictwc;	/* as_destroy waits here for evictions */
+static unsigned long cm_nevicted;	/* frames reclaimed by eviction */
+
+/*
+ * Check if we're in a context that can sleep. The allocator itself
+ * does not, but callers should not assume that.
+ */
+static
+void
+vm_can_sleep(void)
+{
+	if (CURCPU_EXISTS()) {
+		/* must not hold spinlocks */
+		KASSERT(curcpu->c_spinlocks == 0);
+
+		/* must not be in an interrupt handler */
+		KASSERT(curthread->t_in_interrupt == 0);
+	}
+}
+
+/*
+ * Put FRAME, the head of a free block of order ORDER, on its free list.
+ */
+static
+void
+cm_push(unsigned long frame, unsigned order)
+{
+	unsigned head;
+
+	head = cm_freelist[order];
+	coremap[frame].cme_order = order;
+	coremap[frame].cme_prev = 0;
+	coremap[frame].cme_next = head;
+	if (head != 0) {
+		coremap[head].cme_prev = frame;
+	}
+	cm_freelist[order] = frame;
+	cm_nblocks[order]++;
+}
+
+/*
+ * Take the free block headed by FRAME off its free list.
+ */
+static
+void
+cm_unlink(unsigned long frame)
+{
+	unsigned order, next, prev;
+
+	order = coremap[frame].cme_order;
+	KASSERT(order <= CM_MAXORDER);
+
+	next = coremap[frame].cme_next;
+	prev = coremap[frame].cme_prev;
+	if (prev == 0) {
+		KASSERT(cm_freelist[order] == frame);
+		cm_freelist[order] = next;
+	}
+	else {
+		coremap[prev].cme_next = next;
+	}
+	if (next != 0) {
+		coremap[next].cme_prev = prev;
+	}
+	coremap[frame].cme_order = CM_NOTHEAD;
+	cm_nblocks[order]--;
+}
+
+/*
+ * Free the aligned block of 2^ORDER frames at FRAME, merging it with
+ * its buddy for as long as the buddy is free too.
+ */
+static
+void
+cm_freeblock(unsigned long frame, unsigned order)
+{
+	unsigned long buddy;
+
+	KASSERT((frame & ((1UL << order) - 1)) == 0);
+
+	while (order < CM_MAXORDER) {
+		buddy = frame ^ (1UL << order);
+		if (buddy >= coremap_nframes ||
+		    coremap[buddy].cme_order != order) {
+			break;
+		}
+		KASSERT(coremap[buddy].cme_state == CME_FREE);
+		cm_unlink(buddy);
+		frame &= ~(1UL << order);
+		order++;
+	}
+	cm_push(frame, order);
+}
+
+/*
+ * Free an arbitrary run of frames by splitting it into the largest
+ * aligned blocks it contains.
+ */
+static
+void
+cm_freerange(unsigned long frame, unsigned long npages)
+{
+	unsigned order;
+
+	while (npages > 0) {
+		order = 0;
+		while (order < CM_MAXORDER &&
+		       (frame & (1UL << order)) == 0 &&
+		       (2UL << order) <= npages) {
+			order++;
+		}
+		cm_freeblock(frame, order);
+		frame += 1UL << order;
+		npages -= 1UL << order;
+	}
+}
+
+/*
+ * Allocate NPAGES contiguous frames and mark them STATE. Returns the
+ * index of the first frame, or 0 (which is always CME_FIXED, as it
+ * holds the exception vectors) if there is no such run.
+ *
+ * Call with coremap_lock held.
+ */
+static
+unsigned long
+coremap_getrun(unsigned long npages, unsigned state)
+{
+	unsigned long i, frame;
+	unsigned want, order;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(npages > 0);
+
+	for (want = 0; (1UL << want) < npages; want++) {
+		if (want == CM_MAXORDER) {
+			return 0;
+		}
+	}
+
+	for (order = want; order <= CM_MAXORDER; order++) {
+		if (cm_freelist[order] != 0) {
+			break;
+		}
+	}
+	if (order > CM_MAXORDER) {
+		return 0;
+	}
+
+	frame = cm_freelist[order];
+	cm_unlink(frame);
+	/* Give back whatever part of the block we don't need. */
+	cm_freerange(frame + npages, (1UL << order) - npages);
+
+	for (i=frame; i<frame+npages; i++) {
+		KASSERT(coremap[i].cme_state == CME_FREE);
+		KASSERT(coremap[i].cme_order == CM_NOTHEAD);
+		coremap[i].cme_state = state;
+		coremap[i].cme_npages = 0;
+	}
+	coremap[frame].cme_npages = npages;
+	coremap_nfree -= npages;
+
+	return frame;
+}
+
+/*
+ * Give back NPAGES frames starting at FRAME.
+ *
+ * Call with coremap_lock held.
+ */
+static
+void
+coremap_putrun(unsigned long frame, unsigned long npages)
+{
+	unsigned long i;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(frame + npages <= coremap_nframes);
+
+	for (i=frame; i<frame+npages; i++) {
+		KASSERT(coremap[i].cme_state == CME_KERNEL ||
+			coremap[i].cme_state == CME_USER ||
+			coremap[i].cme_state == CME_CACHED);
+		coremap[i].cme_state = CME_FREE;
+		coremap[i].cme_as = NULL;
+		coremap[i].cme_vaddr = 0;
+		coremap[i].cme_npages = 0;
+		coremap[i].cme_refcount = 0;
+		coremap[i].cme_busy = 0;
+		coremap[i].cme_referenced = 0;
+	}
+	cm_freerange(frame, npages);
+	coremap_nfree += npages;
+}
+
+void
+coremap_bootstrap(void)
+{
+	paddr_t lastpaddr, firstpaddr;
+	unsigned long i, firstframe, cmpages;
+
+	/* ram_getfirstfree clears what ram_getsize returns; call it last. */
+	lastpaddr = ram_getsize();
+	coremap_nframes = lastpaddr / PAGE_SIZE;
+	cmpages = DIVROUNDUP(coremap_nframes * sizeof(struct coremap_entry),
+			     PAGE_SIZE);
+
+	spinlock_acquire(&stealmem_lock);
+	firstpaddr = ram_getfirstfree();
+	spinlock_release(&stealmem_lock);
+
+	/* The coremap lives at the start of free memory. */
+	coremap = (struct coremap_entry *)PADDR_TO_KVADDR(firstpaddr);
+	firstframe = firstpaddr / PAGE_SIZE + cmpages;
+	if (firstframe >= coremap_nframes) {
+		panic("coremap: no memory left after the kernel\n");
+	}
+
+	for (i=0; i<coremap_nframes; i++) {
+		coremap[i].cme_as = NULL;
+		coremap[i].cme_vaddr = 0;
+		coremap[i].cme_npages = 0;
+		coremap[i].cme_refcount = 0;
+		coremap[i].cme_next = 0;
+		coremap[i].cme_prev = 0;
+		coremap[i].cme_state = i < firstframe ? CME_FIXED : CME_FREE;
+		coremap[i].cme_order = CM_NOTHEAD;
+		coremap[i].cme_busy = 0;
+		coremap[i].cme_referenced = 0;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	for (i=0; i<=CM_MAXORDER; i++) {
+		cm_freelist[i] = 0;
+		cm_nblocks[i] = 0;
+	}
+	cm_freerange(firstframe, coremap_nframes - firstframe);
+	coremap_nfree = coremap_nframes - firstframe;
+	coremap_ready = true;
+	spinlock_release(&coremap_lock);
+
+	cm_pagerwc = wchan_create("pager");
+	cm_evictwc = wchan_create("evict");
+	if (cm_pagerwc == NULL || cm_evictwc == NULL) {
+		panic("coremap: wchan_create failed\n");
+	}
+
+	kprintf("coremap: %lu frames, %lu free\n",
+		coremap_nframes, coremap_nfree);
+}
+
+/*
+ * Take a page from this cpu's page cache, refilling it from the buddy
+ * lists if it is empty. Returns the frame number, or 0 if out of
+ * memory. Call with interrupts off.
+ */
+static
+unsigned long
+cm_pagecache_get(struct cpu *c)
+{
+	unsigned long frame;
+
+	spinlock_acquire(&c->c_pagecache_lock);
+	if (c->c_npagecache == 0) {
+		spinlock_acquire(&coremap_lock);
+		while (c->c_npagecache < CM_BATCH) {
+			frame = coremap_getrun(1, CME_CACHED);
+			if (frame == 0) {
+				break;
+			}
+			c->c_pagecache[c->c_npagecache++] = frame * PAGE_SIZE;
+		}
+		spinlock_release(&coremap_lock);
+		if (c->c_npagecache == 0) {
+			spinlock_release(&c->c_pagecache_lock);
+			return 0;
+		}
+	}
+	frame = c->c_pagecache[--c->c_npagecache] / PAGE_SIZE;
+	spinlock_release(&c->c_pagecache_lock);
+
+	/* The frame is ours alone now, so no lock is needed to claim it. */
+	KASSERT(coremap[frame].cme_state == CME_CACHED);
+	coremap[frame].cme_state = CME_KERNEL;
+	coremap[frame].cme_npages = 1;
+	return frame;
+}
+
+/*
+ * Put the single kernel page FRAME into this cpu's page cache, first
+ * draining a batch back to the buddy lists if the cache is full. Call
+ * with interrupts off.
+ */
+static
+void
+cm_pagecache_put(struct cpu *c, unsigned long frame)
+{
+	unsigned long oframe;
+
+	KASSERT(coremap[frame].cme_state == CME_KERNEL);
+	KASSERT(coremap[frame].cme_npages == 1);
+
+	coremap[frame].cme_state = CME_CACHED;
+	coremap[frame].cme_npages = 0;
+
+	spinlock_acquire(&c->c_pagecache_lock);
+	if (c->c_npagecache == CPU_PAGECACHE) {
+		spinlock_acquire(&coremap_lock);
+		while (c->c_npagecache > CPU_PAGECACHE - CM_BATCH) {
+			oframe = c->c_pagecache[--c->c_npagecache] / PAGE_SIZE;
+			coremap_putrun(oframe, 1);
+		}
+		spinlock_release(&coremap_lock);
+	}
+	c->c_pagecache[c->c_npagecache++] = frame * PAGE_SIZE;
+	spinlock_release(&c->c_pagecache_lock);
+}
+
+/*
+ * Count the pages sitting in cpu page caches. Each cpu's count is
+ * read without its lock, so the total is only a hint.
+ */
+static
+unsigned long
+cm_ncached(void)
+{
+	unsigned long n = 0;
+	unsigned i;
+
+	for (i=0; i<cpu_count(); i++) {
+		n += cpu_get(i)->c_npagecache;
+	}
+	return n;
+}
+
+/*
+ * Give the pages in every cpu's page cache back to the buddy lists.
+ * Returns true if there were any. Call without coremap_lock held.
+ */
+static
+bool
+cm_pagecache_drain(void)
+{
+	struct cpu *c;
+	unsigned long frame;
+	unsigned i;
+	bool any = false;
+
+	for (i=0; i<cpu_count(); i++) {
+		c = cpu_get(i);
+		spinlock_acquire(&c->c_pagecache_lock);
+		if (c->c_npagecache > 0) {
+			spinlock_acquire(&coremap_lock);
+			while (c->c_npagecache > 0) {
+				frame = c->c_pagecache[--c->c_npagecache]
+					/ PAGE_SIZE;
+				coremap_putrun(frame, 1);
+			}
+			spinlock_release(&coremap_lock);
+			any = true;
+		}
+		spinlock_release(&c->c_pagecache_lock);
+	}
+	return any;
+}
+
+/* Allocate/free some kernel-space virtual pages */
+vaddr_t
+alloc_kpages(unsigned npages)
+{
+	unsigned long frame;
+	paddr_t pa;
+	int spl;
+
+	vm_can_sleep();
+
+	if (npages == 1 && coremap_ready && CURCPU_EXISTS()) {
+		spl = splhigh();
+		frame = cm_pagecache_get(curcpu->c_self);
+		splx(spl);
+		if (frame != 0) {
+			return PADDR_TO_KVADDR((paddr_t)frame * PAGE_SIZE);
+		}
+		/* Fall through and try the buddy lists anyway. */
+	}
+
+	spinlock_acquire(&coremap_lock);
+	if (!coremap_ready) {
+		spinlock_release(&coremap_lock);
+		spinlock_acquire(&stealmem_lock);
+		pa = ram_stealmem(npages);
+		spinlock_release(&stealmem_lock);
+		if (pa == 0) {
+			return 0;
+		}
+		return PADDR_TO_KVADDR(pa);
+	}
+
+	frame = coremap_getrun(npages, CME_KERNEL);
+	spinlock_release(&coremap_lock);
+
+	if (frame == 0 && cm_pagecache_drain()) {
+		/* there were free pages stuck in cpu caches; try again */
+		spinlock_acquire(&coremap_lock);
+		frame = coremap_getrun(npages, CME_KERNEL);
+		spinlock_release(&coremap_lock);
+	}
+	if (frame == 0) {
+		return 0;
+	}
+	return PADDR_TO_KVADDR((paddr_t)frame * PAGE_SIZE);
+}
+
+void
+free_kpages(vaddr_t addr)
+{
+	unsigned long frame;
+	int spl;
+
+	KASSERT(addr >= MIPS_KSEG0);
+	frame = (addr - MIPS_KSEG0) / PAGE_SIZE;
+	KASSERT(frame < coremap_nframes);
+
+	/* The caller owns the frame, so peeking at it unlocked is safe. */
+	if (coremap[frame].cme_state == CME_KERNEL &&
+	    coremap[frame].cme_npages == 1 && CURCPU_EXISTS()) {
+		spl = splhigh();
+		cm_pagecache_put(curcpu->c_self, frame);
+		splx(spl);
+		return;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(frame < coremap_nframes);
+	if (coremap[frame].cme_state == CME_FIXED) {
+		/* Allocated before the coremap existed; just leak it. */
+		spinlock_release(&coremap_lock);
+		return;
+	}
+	KASSERT(coremap[frame].cme_state == CME_KERNEL);
+	KASSERT(coremap[frame].cme_npages > 0);
+	coremap_putrun(frame, coremap[frame].cme_npages);
+	spinlock_release(&coremap_lock);
+}
+
+paddr_t
+coremap_alloc_upage(struct addrspace *as, vaddr_t vaddr)
+{
+	unsigned long frame;
+
+	KASSERT(as != NULL);
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(coremap_ready);
+	if (coremap_nfree <= CM_RESERVE) {
+		/* get back what the cpu caches are sitting on first */
+		spinlock_release(&coremap_lock);
+		if (cm_ncached() > 0) {
+			cm_pagecache_drain();
+		}
+		spinlock_acquire(&coremap_lock);
+	}
+	frame = 0;
+	if (coremap_nfree > CM_RESERVE) {
+		frame = coremap_getrun(1, CME_USER);
+	}
+	if (frame != 0) {
+		coremap[frame].cme_as = as;
+		coremap[frame].cme_vaddr = vaddr;
+		coremap[frame].cme_refcount = 1;
+		coremap[frame].cme_busy = 1;
+		coremap[frame].cme_referenced = 1;
+	}
+	if (coremap_nfree < CM_PAGER_LOW) {
+		wchan_wakeone(cm_pagerwc, &coremap_lock);
+	}
+	spinlock_release(&coremap_lock);
+
+	return (paddr_t)frame * PAGE_SIZE;
+}
+
+void
+coremap_unpin_upage(paddr_t paddr)
+{
+	unsigned long frame;
+
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+	frame = paddr / PAGE_SIZE;
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(frame < coremap_nframes);
+	KASSERT(coremap[frame].cme_state == CME_USER);
+	KASSERT(coremap[frame].cme_busy);
+	coremap[frame].cme_busy = 0;
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_free_upage(paddr_t paddr)
+{
+	unsigned long frame;
+
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+	frame = paddr / PAGE_SIZE;
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(frame < coremap_nframes);
+	KASSERT(coremap[frame].cme_state == CME_USER);
+	KASSERT(coremap[frame].cme_refcount > 0);
+	coremap[frame].cme_refcount--;
+	if (coremap[frame].cme_refcount == 0) {
+		coremap_putrun(frame, 1);
+	}
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_share_upage(paddr_t paddr)
+{
+	unsigned long frame;
+
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+	frame = paddr / PAGE_SIZE;
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(frame < coremap_nframes);
+	KASSERT(coremap[frame].cme_state == CME_USER);
+	KASSERT(coremap[frame].cme_refcount > 0);
+	coremap[frame].cme_refcount++;
+	coremap[frame].cme_as = NULL;
+	coremap[frame].cme_vaddr = 0;
+	spinlock_release(&coremap_lock);
+}
+
+bool
+coremap_claim_upage(paddr_t paddr, struct addrspace *as, vaddr_t vaddr)
+{
+	unsigned long frame;
+	bool mine;
+
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+	frame = paddr / PAGE_SIZE;
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(frame < coremap_nframes);
+	KASSERT(coremap[frame].cme_state == CME_USER);
+	mine = coremap[frame].cme_refcount == 1;
+	if (mine) {
+		coremap[frame].cme_as = as;
+		coremap[frame].cme_vaddr = vaddr;
+	}
+	spinlock_release(&coremap_lock);
+
+	return mine;
+}
+
+void
+coremap_reference_upage(paddr_t paddr, struct addrspace *as, vaddr_t vaddr)
+{
+	struct coremap_entry *cme;
+
+	KASSERT(spinlock_do_i_hold(&as->as_ptlock));
+
+	cme = &coremap[paddr / PAGE_SIZE];
+
+	/*
+	 * Only a hint for the clock, so no lock: a lost update just
+	 * means the page looks a bit older than it is.
+	 */
+	cme->cme_referenced = 1;
+
+	/*
+	 * Likewise, peek before locking to see if the frame is shared.
+	 * If it is but the count is down to one, that one is AS: the
+	 * page table entry we hold the lock on maps it.
+	 */
+	if (cme->cme_as == NULL) {
+		spinlock_acquire(&coremap_lock);
+		KASSERT(cme->cme_state == CME_USER);
+		if (cme->cme_as == NULL && cme->cme_refcount == 1) {
+			cme->cme_as = as;
+			cme->cme_vaddr = vaddr;
+		}
+		spinlock_release(&coremap_lock);
+	}
+}
+
+bool
+coremap_pick_victim(paddr_t *paddr, struct addrspace **as, vaddr_t *vaddr)
+{
+	struct coremap_entry *cme;
+	unsigned long n;
+
+	spinlock_acquire(&coremap_lock);
+
+	/* Twice around: the first pass may only clear referenced bits. */
+	for (n = 0; n < 2 * coremap_nframes; n++) {
+		cme = &coremap[cm_clockhand];
+		cm_clockhand = (cm_clockhand + 1) % coremap_nframes;
+
+		if (cme->cme_state != CME_USER || cme->cme_busy ||
+		    cme->cme_as == NULL || cme->cme_as->as_dying) {
+			continue;
+		}
+		KASSERT(cme->cme_refcount == 1);
+		if (cme->cme_referenced) {
+			cme->cme_referenced = 0;
+			continue;
+		}
+
+		cme->cme_busy = 1;
+		cme->cme_as->as_evicting++;
+		*paddr = (paddr_t)(cme - coremap) * PAGE_SIZE;
+		*as = cme->cme_as;
+		*vaddr = cme->cme_vaddr;
+		spinlock_release(&coremap_lock);
+		return true;
+	}
+
+	spinlock_release(&coremap_lock);
+	return false;
+}
+
+bool
+coremap_evict_check(paddr_t paddr, struct addrspace *as)
+{
+	unsigned long frame;
+	bool ok;
+
+	frame = paddr / PAGE_SIZE;
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(coremap[frame].cme_state == CME_USER);
+	KASSERT(coremap[frame].cme_busy);
+	ok = coremap[frame].cme_as == as && coremap[frame].cme_refcount == 1;
+	spinlock_release(&coremap_lock);
+
+	return ok;
+}
+
+void
+coremap_evict_done(paddr_t paddr, struct addrspace *as, bool evicted)
+{
+	unsigned long frame;
+
+	frame = paddr / PAGE_SIZE;
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(coremap[frame].cme_state == CME_USER);
+	KASSERT(coremap[frame].cme_busy);
+	if (evicted) {
+		KASSERT(coremap[frame].cme_refcount == 1);
+		coremap_putrun(frame, 1);
+		cm_nevicted++;
+	}
+	else {
+		coremap[frame].cme_busy = 0;
+	}
+	KASSERT(as->as_evicting > 0);
+	as->as_evicting--;
+	if (as->as_evicting == 0) {
+		wchan_wakeall(cm_evictwc, &coremap_lock);
+	}
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_as_dying(struct addrspace *as)
+{
+	spinlock_acquire(&coremap_lock);
+	as->as_dying = true;
+	while (as->as_evicting > 0) {
+		wchan_sleep(cm_evictwc, &coremap_lock);
+	}
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_pager_wait(void)
+{
+	spinlock_acquire(&coremap_lock);
+	wchan_sleep(cm_pagerwc, &coremap_lock);
+	spinlock_release(&coremap_lock);
+}
+
+bool
+coremap_pager_wanted(void)
+{
+	bool wanted;
+
+	spinlock_acquire(&coremap_lock);
+	if (coremap_nfree < CM_PAGER_HIGH) {
+		/* don't evict while free pages sit in cpu caches */
+		spinlock_release(&coremap_lock);
+		if (cm_ncached() > 0) {
+			cm_pagecache_drain();
+		}
+		spinlock_acquire(&coremap_lock);
+	}
+	wanted = coremap_nfree < CM_PAGER_HIGH;
+	spinlock_release(&coremap_lock);
+
+	return wanted;
+}
+
+/*
+ * Print free memory and how it is broken up: for each block size, the
+ * number of free blocks of exactly that size and the share of free
+ * memory that could satisfy an allocation of that size. The lower the
+ * share for large sizes, the more fragmented physical memory is.
+ */
+void
+coremap_printstats(void)
+{
+	unsigned long nblocks[CM_MAXORDER+1];
+	unsigned long nfree, ncached, nframes, nevicted, usable;
+	int i;
+
+	spinlock_acquire(&coremap_lock);
+	for (i=0; i<=CM_MAXORDER; i++) {
+		nblocks[i] = cm_nblocks[i];
+	}
+	nfree = coremap_nfree;
+	nframes = coremap_nframes;
+	nevicted = cm_nevicted;
+	spinlock_release(&coremap_lock);
+	ncached = cm_ncached();
+
+	kprintf("coremap: %lu of %lu frames free, %lu more in cpu caches\n",
+		nfree, nframes, ncached);
+	kprintf("%lu frames reclaimed by eviction\n", nevicted);
+	kprintf("    pages  free blocks  usable\n");
+	usable = 0;
+	for (i=CM_MAXORDER; i>=0; i--) {
+		usable += nblocks[i] << i;
+		kprintf("    %5lu  %11lu  %5lu%%\n", 1UL << i, nblocks[i],
+			nfree == 0 ? 0 : usable * 100 / nfree);
+	}
+}
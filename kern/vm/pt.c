@@ -0,0 +1,182 @@
+/*
+ * Two-level page tables for user address spaces. See pt.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <pt.h>
+#include <coremap.h>
+#include <swap.h>
+
+/*
+ * Threads waiting for an eviction to finish. One channel for all
+ * address spaces: evictions are rare enough that spurious wakeups
+ * don't matter.
+ */
+static struct wchan *pt_evictwc;
+
+void
+pt_bootstrap(void)
+{
+	pt_evictwc = wchan_create("pt_evict");
+	if (pt_evictwc == NULL) {
+		panic("pt_bootstrap: wchan_create failed\n");
+	}
+}
+
+void
+pt_wait(struct addrspace *as, pte_t *pte)
+{
+	KASSERT(spinlock_do_i_hold(&as->as_ptlock));
+
+	while (*pte & (PTE_EVICTING | PTE_SWAPIN)) {
+		wchan_sleep(pt_evictwc, &as->as_ptlock);
+	}
+}
+
+void
+pt_wakeup(struct addrspace *as)
+{
+	wchan_wakeall(pt_evictwc, &as->as_ptlock);
+}
+
+struct pagetable *
+pt_create(void)
+{
+	struct pagetable *pt;
+	unsigned i;
+
+	pt = kmalloc(sizeof(struct pagetable));
+	if (pt == NULL) {
+		return NULL;
+	}
+	for (i=0; i<PT_L1_SIZE; i++) {
+		pt->pt_dir[i] = NULL;
+	}
+	return pt;
+}
+
+void
+pt_destroy(struct pagetable *pt)
+{
+	unsigned i, j;
+	pte_t *l2;
+
+	for (i=0; i<PT_L1_SIZE; i++) {
+		l2 = pt->pt_dir[i];
+		if (l2 == NULL) {
+			continue;
+		}
+		for (j=0; j<PT_L2_SIZE; j++) {
+			KASSERT((l2[j] & (PTE_EVICTING | PTE_SWAPIN)) == 0);
+			if (l2[j] & PTE_VALID) {
+				coremap_free_upage(l2[j] & PTE_FRAME);
+			}
+			else if (l2[j] & PTE_SWAPPED) {
+				swap_free(PTE_SLOT(l2[j]));
+			}
+		}
+		kfree(l2);
+	}
+	kfree(pt);
+}
+
+pte_t *
+pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create)
+{
+	unsigned l1;
+	pte_t *l2;
+
+	KASSERT(vaddr < USERSPACETOP);
+
+	l1 = PT_L1_INDEX(vaddr);
+	l2 = pt->pt_dir[l1];
+	if (l2 == NULL) {
+		if (!create) {
+			return NULL;
+		}
+		l2 = kmalloc(PT_L2_SIZE * sizeof(pte_t));
+		if (l2 == NULL) {
+			return NULL;
+		}
+		bzero(l2, PT_L2_SIZE * sizeof(pte_t));
+		pt->pt_dir[l1] = l2;
+	}
+	return &l2[PT_L2_INDEX(vaddr)];
+}
+
+/*
+ * Give NEWAS a private copy of the swapped-out page OLDPTE at VADDR.
+ */
+static
+int
+pt_copy_swapped(struct addrspace *newas, vaddr_t vaddr, pte_t oldpte,
+		pte_t *newpte)
+{
+	paddr_t paddr;
+	int result;
+
+	paddr = vm_alloc_upage(newas, vaddr);
+	if (paddr == 0) {
+		return ENOMEM;
+	}
+	result = swap_in(paddr, PTE_SLOT(oldpte));
+	if (result) {
+		coremap_free_upage(paddr);
+		return result;
+	}
+	*newpte = paddr | PTE_VALID | (oldpte & PTE_WRITE);
+	coremap_unpin_upage(paddr);
+	return 0;
+}
+
+int
+pt_copy(struct addrspace *oldas, struct addrspace *newas)
+{
+	unsigned i, j;
+	pte_t *oldl2, *newpte, old;
+	vaddr_t vaddr;
+	int result;
+
+	for (i=0; i<PT_L1_SIZE; i++) {
+		oldl2 = oldas->as_pt->pt_dir[i];
+		if (oldl2 == NULL) {
+			continue;
+		}
+		for (j=0; j<PT_L2_SIZE; j++) {
+			if (oldl2[j] == 0) {
+				continue;
+			}
+			vaddr = PT_MKVADDR(i, j);
+			newpte = pt_lookup(newas->as_pt, vaddr, true);
+			if (newpte == NULL) {
+				return ENOMEM;
+			}
+
+			spinlock_acquire(&oldas->as_ptlock);
+			pt_wait(oldas, &oldl2[j]);
+			old = oldl2[j];
+			if (old & PTE_VALID) {
+				old &= ~PTE_WRITE;
+				oldl2[j] = old;
+				coremap_share_upage(old & PTE_FRAME);
+				*newpte = old;
+			}
+			spinlock_release(&oldas->as_ptlock);
+
+			if (old & PTE_SWAPPED) {
+				result = pt_copy_swapped(newas, vaddr, old,
+							 newpte);
+				if (result) {
+					return result;
+				}
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,477 @@
+/*
+ * Object caches. See slab.h.
+ *
+ * Each slab is one page, allocated with alloc_kpages. The objects
+ * start at the bottom of the page and struct kmem_slab sits at the
+ * top, so the slab of any object is found by rounding its address.
+ * Each buffer has a link word after the object proper that strings
+ * the free buffers of the slab together; the object itself is never
+ * written by the allocator, which is what lets constructed state
+ * survive a free.
+ *
+ * In front of the slabs each cpu has a magazine of up to KMEM_MAGSIZE
+ * free objects, touched only by its own cpu with interrupts off.
+ * kmem_cache_alloc and kmem_cache_free go to the slabs (and the
+ * cache's spinlock) only when the magazine is empty or full, and
+ * then move half a magazine's worth at once.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
+#include <platform/maxcpus.h>
+#include <vm.h>
+#include <slab.h>
+
+#define KMEM_MAGSIZE	14		/* objects per magazine */
+#define KMEM_BATCH	(KMEM_MAGSIZE / 2)	/* moved to/from slabs at once */
+#define KMEM_NAMELEN	16
+#define KMEM_MAXPRINT	32		/* caches shown by printstats */
+
+/* Free objects held by one cpu. */
+struct kmem_magazine {
+	unsigned km_count;		/* objects in km_objs */
+	unsigned km_allocs;		/* statistics: allocations */
+	void *km_objs[KMEM_MAGSIZE];
+};
+
+/* Header of a slab, at the top of its page. */
+struct kmem_slab {
+	struct kmem_slab *sl_next;	/* on kc_partial or kc_full */
+	struct kmem_slab **sl_prevp;
+	struct kmem_cache *sl_cache;	/* cache we belong to */
+	void *sl_free;			/* first free buffer */
+	unsigned sl_inuse;		/* buffers allocated */
+};
+
+struct kmem_cache {
+	char kc_name[KMEM_NAMELEN];
+	size_t kc_size;			/* object size */
+	size_t kc_bufsize;		/* object + link, aligned */
+	size_t kc_linkoff;		/* offset of link in buffer */
+	unsigned kc_perslab;		/* buffers per slab */
+	void (*kc_ctor)(void *obj);
+
+	struct kmem_cache *kc_next;	/* on kmem_caches */
+
+	/*
+	 * Slabs, protected by kc_lock. kc_partial holds slabs with at
+	 * least one free buffer, including at most one that is
+	 * entirely free; kc_full holds slabs with none.
+	 */
+	struct spinlock kc_lock;
+	struct kmem_slab *kc_partial;
+	struct kmem_slab *kc_full;
+	unsigned kc_nslabs;		/* slabs on both lists */
+	unsigned kc_nempty;		/* slabs with nothing allocated */
+	unsigned kc_out;		/* buffers out of the slabs */
+	unsigned kc_refills;		/* statistics: trips to the slabs */
+
+	struct kmem_magazine kc_mags[MAXCPUS];	/* indexed by c_number */
+};
+
+/* All caches, for printstats. */
+static struct spinlock kmem_lock = SPINLOCK_INITIALIZER;
+static struct kmem_cache *kmem_caches;
+
+#define KMEM_LINK(kc, buf) (*(void **)((char *)(buf) + (kc)->kc_linkoff))
+#define KMEM_SLAB(buf) \
+	((struct kmem_slab *)(((vaddr_t)(buf) & PAGE_FRAME) + PAGE_SIZE - \
+			      sizeof(struct kmem_slab)))
+
+////////////////////////////////////////////////////////////
+// slab lists
+
+static
+void
+kmem_slab_link(struct kmem_slab **list, struct kmem_slab *slab)
+{
+	slab->sl_next = *list;
+	slab->sl_prevp = list;
+	if (*list != NULL) {
+		(*list)->sl_prevp = &slab->sl_next;
+	}
+	*list = slab;
+}
+
+static
+void
+kmem_slab_unlink(struct kmem_slab *slab)
+{
+	*slab->sl_prevp = slab->sl_next;
+	if (slab->sl_next != NULL) {
+		slab->sl_next->sl_prevp = slab->sl_prevp;
+	}
+	slab->sl_next = NULL;
+	slab->sl_prevp = NULL;
+}
+
+////////////////////////////////////////////////////////////
+// slab layer
+
+/*
+ * Get a page and make a slab of it, running the constructor on every
+ * buffer. The slab is not yet on any list.
+ */
+static
+struct kmem_slab *
+kmem_slab_create(struct kmem_cache *kc)
+{
+	struct kmem_slab *slab;
+	vaddr_t page;
+	char *buf;
+	unsigned i;
+
+	page = alloc_kpages(1);
+	if (page == 0) {
+		return NULL;
+	}
+
+	slab = KMEM_SLAB(page);
+	slab->sl_next = NULL;
+	slab->sl_prevp = NULL;
+	slab->sl_cache = kc;
+	slab->sl_free = NULL;
+	slab->sl_inuse = 0;
+
+	/* Thread the free list from the top so it hands out in order */
+	for (i = kc->kc_perslab; i-- > 0; ) {
+		buf = (char *)page + i * kc->kc_bufsize;
+		if (kc->kc_ctor != NULL) {
+			kc->kc_ctor(buf);
+		}
+		KMEM_LINK(kc, buf) = slab->sl_free;
+		slab->sl_free = buf;
+	}
+	return slab;
+}
+
+/*
+ * Take up to N objects from the slabs of KC, making a new slab if
+ * there are none free. Returns how many were taken; 0 only if out of
+ * memory.
+ */
+static
+unsigned
+kmem_slab_get(struct kmem_cache *kc, void **objs, unsigned n)
+{
+	struct kmem_slab *slab;
+	unsigned got;
+
+	spinlock_acquire(&kc->kc_lock);
+	while (kc->kc_partial == NULL) {
+		/* alloc_kpages may sleep, so not while holding kc_lock */
+		spinlock_release(&kc->kc_lock);
+		slab = kmem_slab_create(kc);
+		if (slab == NULL) {
+			return 0;
+		}
+		spinlock_acquire(&kc->kc_lock);
+		kmem_slab_link(&kc->kc_partial, slab);
+		kc->kc_nslabs++;
+		kc->kc_nempty++;
+	}
+
+	for (got = 0; got < n && kc->kc_partial != NULL; got++) {
+		slab = kc->kc_partial;
+		KASSERT(slab->sl_free != NULL);
+		objs[got] = slab->sl_free;
+		slab->sl_free = KMEM_LINK(kc, objs[got]);
+		if (slab->sl_inuse++ == 0) {
+			kc->kc_nempty--;
+		}
+		if (slab->sl_free == NULL) {
+			kmem_slab_unlink(slab);
+			kmem_slab_link(&kc->kc_full, slab);
+		}
+	}
+	kc->kc_out += got;
+	kc->kc_refills++;
+	spinlock_release(&kc->kc_lock);
+
+	return got;
+}
+
+/*
+ * Return N objects to the slabs of KC. Slabs that become entirely
+ * free are given back to the VM system, except for one kept to
+ * absorb the next allocation.
+ */
+static
+void
+kmem_slab_put(struct kmem_cache *kc, void **objs, unsigned n)
+{
+	struct kmem_slab *slab, *tofree;
+	unsigned i;
+
+	tofree = NULL;
+
+	spinlock_acquire(&kc->kc_lock);
+	for (i = 0; i < n; i++) {
+		slab = KMEM_SLAB(objs[i]);
+		KASSERT(slab->sl_cache == kc);
+		KASSERT(slab->sl_inuse > 0);
+
+		if (slab->sl_free == NULL) {
+			kmem_slab_unlink(slab);
+			kmem_slab_link(&kc->kc_partial, slab);
+		}
+		KMEM_LINK(kc, objs[i]) = slab->sl_free;
+		slab->sl_free = objs[i];
+
+		if (--slab->sl_inuse == 0) {
+			if (kc->kc_nempty > 0) {
+				kmem_slab_unlink(slab);
+				kc->kc_nslabs--;
+				/* chain on sl_next for freeing below */
+				slab->sl_next = tofree;
+				tofree = slab;
+			}
+			else {
+				kc->kc_nempty++;
+			}
+		}
+	}
+	KASSERT(kc->kc_out >= n);
+	kc->kc_out -= n;
+	spinlock_release(&kc->kc_lock);
+
+	while (tofree != NULL) {
+		slab = tofree;
+		tofree = slab->sl_next;
+		free_kpages((vaddr_t)slab & PAGE_FRAME);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// interface
+
+struct kmem_cache *
+kmem_cache_create(const char *name, size_t size, size_t align,
+		  void (*ctor)(void *obj))
+{
+	struct kmem_cache *kc;
+	unsigned i;
+
+	if (align < sizeof(void *)) {
+		align = sizeof(void *);
+	}
+	KASSERT((align & (align - 1)) == 0);
+	KASSERT(size > 0);
+
+	kc = kmalloc(sizeof(*kc));
+	if (kc == NULL) {
+		return NULL;
+	}
+
+	snprintf(kc->kc_name, sizeof(kc->kc_name), "%s", name);
+	kc->kc_size = size;
+	kc->kc_linkoff = ROUNDUP(size, sizeof(void *));
+	kc->kc_bufsize = ROUNDUP(kc->kc_linkoff + sizeof(void *), align);
+	kc->kc_perslab = (PAGE_SIZE - sizeof(struct kmem_slab)) /
+		kc->kc_bufsize;
+	KASSERT(kc->kc_perslab > 0);
+	kc->kc_ctor = ctor;
+
+	spinlock_init(&kc->kc_lock);
+	kc->kc_partial = NULL;
+	kc->kc_full = NULL;
+	kc->kc_nslabs = 0;
+	kc->kc_nempty = 0;
+	kc->kc_out = 0;
+	kc->kc_refills = 0;
+
+	for (i = 0; i < MAXCPUS; i++) {
+		kc->kc_mags[i].km_count = 0;
+		kc->kc_mags[i].km_allocs = 0;
+	}
+
+	spinlock_acquire(&kmem_lock);
+	kc->kc_next = kmem_caches;
+	kmem_caches = kc;
+	spinlock_release(&kmem_lock);
+
+	return kc;
+}
+
+void
+kmem_cache_destroy(struct kmem_cache *kc)
+{
+	struct kmem_cache **kcp;
+	struct kmem_magazine *mag;
+	struct kmem_slab *slab;
+	unsigned i;
+
+	spinlock_acquire(&kmem_lock);
+	for (kcp = &kmem_caches; *kcp != kc; kcp = &(*kcp)->kc_next) {
+		KASSERT(*kcp != NULL);
+	}
+	*kcp = kc->kc_next;
+	spinlock_release(&kmem_lock);
+
+	/* Nobody else may be using the cache, so no need for splhigh */
+	for (i = 0; i < MAXCPUS; i++) {
+		mag = &kc->kc_mags[i];
+		kmem_slab_put(kc, mag->km_objs, mag->km_count);
+		mag->km_count = 0;
+	}
+
+	KASSERT(kc->kc_out == 0);
+	KASSERT(kc->kc_full == NULL);
+	while (kc->kc_partial != NULL) {
+		slab = kc->kc_partial;
+		KASSERT(slab->sl_inuse == 0);
+		kmem_slab_unlink(slab);
+		free_kpages((vaddr_t)slab & PAGE_FRAME);
+	}
+
+	spinlock_cleanup(&kc->kc_lock);
+	kfree(kc);
+}
+
+void *
+kmem_cache_alloc(struct kmem_cache *kc)
+{
+	struct kmem_magazine *mag;
+	void *objs[KMEM_BATCH];
+	unsigned i, n;
+	int spl;
+
+	if (!CURCPU_EXISTS()) {
+		/* Too early in boot for magazines */
+		return kmem_slab_get(kc, objs, 1) ? objs[0] : NULL;
+	}
+
+	spl = splhigh();
+	mag = &kc->kc_mags[curcpu->c_number];
+	mag->km_allocs++;
+	if (mag->km_count > 0) {
+		objs[0] = mag->km_objs[--mag->km_count];
+		splx(spl);
+		return objs[0];
+	}
+	splx(spl);
+
+	/* Empty; get a batch from the slabs, keep all but one */
+	n = kmem_slab_get(kc, objs, KMEM_BATCH);
+	if (n == 0) {
+		return NULL;
+	}
+
+	spl = splhigh();
+	/* We may have moved cpus while getting them */
+	mag = &kc->kc_mags[curcpu->c_number];
+	for (i = 1; i < n && mag->km_count < KMEM_MAGSIZE; i++) {
+		mag->km_objs[mag->km_count++] = objs[i];
+	}
+	splx(spl);
+
+	if (i < n) {
+		kmem_slab_put(kc, &objs[i], n - i);
+	}
+	return objs[0];
+}
+
+void
+kmem_cache_free(struct kmem_cache *kc, void *obj)
+{
+	struct kmem_magazine *mag;
+	void *objs[KMEM_BATCH];
+	unsigned i;
+	int spl;
+
+	KASSERT(obj != NULL);
+	KASSERT(KMEM_SLAB(obj)->sl_cache == kc);
+
+	if (!CURCPU_EXISTS()) {
+		kmem_slab_put(kc, &obj, 1);
+		return;
+	}
+
+	spl = splhigh();
+	mag = &kc->kc_mags[curcpu->c_number];
+	if (mag->km_count < KMEM_MAGSIZE) {
+		mag->km_objs[mag->km_count++] = obj;
+		splx(spl);
+		return;
+	}
+
+	/* Full; send the older half back to the slabs */
+	for (i = 0; i < KMEM_BATCH; i++) {
+		objs[i] = mag->km_objs[i];
+	}
+	for (i = KMEM_BATCH; i < KMEM_MAGSIZE; i++) {
+		mag->km_objs[i - KMEM_BATCH] = mag->km_objs[i];
+	}
+	mag->km_count -= KMEM_BATCH;
+	mag->km_objs[mag->km_count++] = obj;
+	splx(spl);
+
+	kmem_slab_put(kc, objs, KMEM_BATCH);
+}
+
+////////////////////////////////////////////////////////////
+// statistics
+
+struct kmem_stats {
+	char ks_name[KMEM_NAMELEN];
+	size_t ks_size;
+	unsigned ks_nslabs;
+	unsigned ks_inuse;
+	unsigned ks_allocs;
+	unsigned ks_refills;
+};
+
+void
+kmem_cache_printstats(void)
+{
+	struct kmem_stats stats[KMEM_MAXPRINT];
+	struct kmem_stats *ks;
+	struct kmem_cache *kc;
+	unsigned i, j, n, more, cached;
+
+	/* Copy out under the locks, print afterwards */
+	n = more = 0;
+	spinlock_acquire(&kmem_lock);
+	for (kc = kmem_caches; kc != NULL; kc = kc->kc_next) {
+		if (n == KMEM_MAXPRINT) {
+			more++;
+			continue;
+		}
+		ks = &stats[n++];
+		strcpy(ks->ks_name, kc->kc_name);
+		ks->ks_size = kc->kc_size;
+
+		/* the magazines are read unlocked; close enough */
+		cached = 0;
+		ks->ks_allocs = 0;
+		for (j = 0; j < MAXCPUS; j++) {
+			cached += kc->kc_mags[j].km_count;
+			ks->ks_allocs += kc->kc_mags[j].km_allocs;
+		}
+
+		spinlock_acquire(&kc->kc_lock);
+		ks->ks_nslabs = kc->kc_nslabs;
+		ks->ks_inuse = kc->kc_out > cached ? kc->kc_out - cached : 0;
+		ks->ks_refills = kc->kc_refills;
+		spinlock_release(&kc->kc_lock);
+	}
+	spinlock_release(&kmem_lock);
+
+	kprintf("Object caches:\n");
+	kprintf("    %-15s %5s %6s %6s %9s %9s\n",
+		"name", "size", "slabs", "inuse", "allocs", "refills");
+	for (i = 0; i < n; i++) {
+		ks = &stats[i];
+		kprintf("    %-15s %5lu %6u %6u %9u %9u\n",
+			ks->ks_name, (unsigned long)ks->ks_size,
+			ks->ks_nslabs, ks->ks_inuse,
+			ks->ks_allocs, ks->ks_refills);
+	}
+	if (more > 0) {
+		kprintf("    (and %u more)\n", more);
+	}
+}
@@ -0,0 +1,175 @@
+/*
+ * Swap space management. See swap.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <bitmap.h>
+#include <spinlock.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <vm.h>
+#include <swap.h>
+
+static struct vnode *swap_vnode;	/* the device, or NULL */
+static struct bitmap *swap_map;		/* one bit per slot, set if in use */
+static unsigned swap_nslots;		/* size of the device in pages */
+
+/*
+ * Protects swap_map and the counters. The I/O itself needs no lock:
+ * each slot belongs to exactly one page.
+ */
+static struct spinlock swap_lock = SPINLOCK_INITIALIZER;
+static unsigned swap_inuse;		/* slots allocated */
+static unsigned long swap_nins;		/* pages read back */
+static unsigned long swap_nouts;	/* pages written */
+
+void
+swap_bootstrap(void)
+{
+	char path[sizeof(SWAP_DEVICE)];
+	struct stat st;
+	int result;
+
+	/* vfs_open may scribble on its argument */
+	strcpy(path, SWAP_DEVICE);
+	result = vfs_open(path, O_RDWR, 0, &swap_vnode);
+	if (result) {
+		kprintf("swap: %s: %s; running without swap\n",
+			SWAP_DEVICE, strerror(result));
+		swap_vnode = NULL;
+		return;
+	}
+
+	result = VOP_STAT(swap_vnode, &st);
+	if (result) {
+		panic("swap: %s: stat: %s\n", SWAP_DEVICE, strerror(result));
+	}
+
+	swap_nslots = st.st_size / PAGE_SIZE;
+	swap_map = bitmap_create(swap_nslots);
+	if (swap_map == NULL) {
+		panic("swap: Out of memory\n");
+	}
+
+	kprintf("swap: %s, %u pages\n", SWAP_DEVICE, swap_nslots);
+}
+
+bool
+swap_enabled(void)
+{
+	return swap_vnode != NULL;
+}
+
+int
+swap_alloc(unsigned *slot)
+{
+	int result;
+
+	KASSERT(swap_enabled());
+
+	spinlock_acquire(&swap_lock);
+	result = bitmap_alloc(swap_map, slot);
+	if (result == 0) {
+		swap_inuse++;
+	}
+	spinlock_release(&swap_lock);
+
+	return result;
+}
+
+void
+swap_free(unsigned slot)
+{
+	KASSERT(slot < swap_nslots);
+
+	spinlock_acquire(&swap_lock);
+	KASSERT(bitmap_isset(swap_map, slot));
+	bitmap_unmark(swap_map, slot);
+	swap_inuse--;
+	spinlock_release(&swap_lock);
+}
+
+/*
+ * Move one page between memory and the swap device.
+ */
+static
+int
+swap_io(paddr_t paddr, unsigned slot, enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+	KASSERT(slot < swap_nslots);
+
+	uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE,
+		  (off_t)slot * PAGE_SIZE, rw);
+	if (rw == UIO_READ) {
+		result = VOP_READ(swap_vnode, &ku);
+	}
+	else {
+		result = VOP_WRITE(swap_vnode, &ku);
+	}
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		return EIO;
+	}
+	return 0;
+}
+
+int
+swap_in(paddr_t paddr, unsigned slot)
+{
+	int result;
+
+	result = swap_io(paddr, slot, UIO_READ);
+	if (result == 0) {
+		spinlock_acquire(&swap_lock);
+		swap_nins++;
+		spinlock_release(&swap_lock);
+	}
+	return result;
+}
+
+int
+swap_out(paddr_t paddr, unsigned slot)
+{
+	int result;
+
+	result = swap_io(paddr, slot, UIO_WRITE);
+	if (result == 0) {
+		spinlock_acquire(&swap_lock);
+		swap_nouts++;
+		spinlock_release(&swap_lock);
+	}
+	return result;
+}
+
+void
+swap_printstats(void)
+{
+	unsigned inuse;
+	unsigned long nins, nouts;
+
+	if (!swap_enabled()) {
+		kprintf("swap: none\n");
+		return;
+	}
+
+	spinlock_acquire(&swap_lock);
+	inuse = swap_inuse;
+	nins = swap_nins;
+	nouts = swap_nouts;
+	spinlock_release(&swap_lock);
+
+	kprintf("swap: %u of %u pages in use; %lu pages out, %lu in\n",
+		inuse, swap_nslots, nouts, nins);
+}
@@ -0,0 +1,575 @@
+/*
+ * Machine-independent part of the paging VM system.
+ *
+ * User pages are allocated on first touch: vm_fault looks the
+ * faulting address up in the process's segment list, allocates and
+ * fills a frame if the page table has nothing for it yet, and loads
+ * the translation into the TLB.
+ *
+ * After fork, parent and child share their pages read-only; the first
+ * write to such a page from either side lands here and gets a private
+ * copy (or just the write bit back, if the other side is already
+ * gone).
+ *
+ * When memory runs short, pages are evicted to swap (swap.c). A pager
+ * thread evicts in the background to keep a reserve of free frames;
+ * if that is not enough, a fault evicts synchronously. Evictions are
+ * serialized by vm_evict_lock. Evicting a page takes these steps:
+ *
+ *    1. coremap_pick_victim chooses a frame by the clock algorithm
+ *       and marks it busy, which also keeps its owner's address
+ *       space from being destroyed under us;
+ *    2. under the owner's as_ptlock, the page table entry goes from
+ *       PTE_VALID to PTE_EVICTING, after which the owner can't load
+ *       the page into the TLB;
+ *    3. every cpu drops the owner's TLB entries (vm_shootdown);
+ *    4. the page is written to swap (or just dropped, if it belongs
+ *       to a read-only segment and can be read back from the
+ *       executable);
+ *    5. the entry becomes PTE_SWAPPED (or empty), waiters are woken,
+ *       and the frame is freed.
+ *
+ * Because the pager may change an entry at any moment the as_ptlock
+ * is not held, vm_fault installs a new entry only if the old one is
+ * still what it was when the fault started; otherwise it just returns
+ * and lets the access fault again.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <thread.h>
+#include <proc.h>
+#include <current.h>
+#include <mips/tlb.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <pt.h>
+#include <coremap.h>
+#include <swap.h>
+
+/* Serializes evictions (and the use of vm_shootdown_sem). */
+static struct lock *vm_evict_lock;
+
+/* Counts acknowledgements of TLB shootdowns. */
+static struct semaphore *vm_shootdown_sem;
+
+static void vm_pager(void *data1, unsigned long data2);
+
+void
+vm_bootstrap(void)
+{
+	int result;
+
+	coremap_bootstrap();
+	pt_bootstrap();
+
+	vm_evict_lock = lock_create("vm_evict");
+	vm_shootdown_sem = sem_create("vm_shootdown", 0);
+	if (vm_evict_lock == NULL || vm_shootdown_sem == NULL) {
+		panic("vm_bootstrap: Out of memory\n");
+	}
+
+	swap_bootstrap();
+	if (swap_enabled()) {
+		result = thread_fork("pager", NULL, vm_pager, NULL, 0);
+		if (result) {
+			panic("vm_bootstrap: thread_fork: %s\n",
+			      strerror(result));
+		}
+	}
+}
+
+/*
+ * Drop the translations of ts_as from this cpu's TLB, and tell the
+ * evicting thread we're done.
+ */
+void
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	vmtlb_flushas(ts->ts_as);
+	V(ts->ts_done);
+}
+
+/*
+ * Make sure no cpu can use a TLB entry of AS loaded before now. Call
+ * with vm_evict_lock held.
+ */
+static
+void
+vm_shootdown(struct addrspace *as)
+{
+	struct tlbshootdown ts;
+	struct cpu *c;
+	unsigned i, n;
+	int spl;
+
+	KASSERT(lock_do_i_hold(vm_evict_lock));
+
+	ts.ts_as = as;
+	ts.ts_done = vm_shootdown_sem;
+
+	/* Don't migrate while deciding which cpus are "other". */
+	spl = splhigh();
+	n = 0;
+	for (i=0; i<cpu_count(); i++) {
+		c = cpu_get(i);
+		if (c != curcpu->c_self) {
+			ipi_tlbshootdown(c, &ts);
+			n++;
+		}
+	}
+	vmtlb_flushas(as);
+	splx(spl);
+
+	while (n-- > 0) {
+		P(vm_shootdown_sem);
+	}
+}
+
+/*
+ * Evict one page. Returns 0 if a frame was freed (or there was a
+ * reason to just try again), or an error if nothing can be evicted.
+ */
+static
+int
+vm_evict_one(void)
+{
+	struct addrspace *as;
+	struct segment *seg;
+	paddr_t paddr;
+	vaddr_t vaddr;
+	pte_t *pte, old;
+	unsigned slot;
+	bool clean;
+	int result;
+
+	lock_acquire(vm_evict_lock);
+
+	if (!coremap_pick_victim(&paddr, &as, &vaddr)) {
+		lock_release(vm_evict_lock);
+		return ENOMEM;
+	}
+
+	/* Read-only segments can be read back from the executable. */
+	seg = as_find_segment(as, vaddr);
+	KASSERT(seg != NULL);
+	clean = (seg->seg_perm & SEG_W) == 0;
+
+	slot = 0;
+	if (!clean) {
+		result = swap_alloc(&slot);
+		if (result) {
+			coremap_evict_done(paddr, as, false);
+			lock_release(vm_evict_lock);
+			return result;
+		}
+	}
+
+	pte = pt_lookup(as->as_pt, vaddr, false);
+	KASSERT(pte != NULL);
+
+	spinlock_acquire(&as->as_ptlock);
+	if (!coremap_evict_check(paddr, as)) {
+		/* fork shared it since we picked it; leave it be */
+		spinlock_release(&as->as_ptlock);
+		if (!clean) {
+			swap_free(slot);
+		}
+		coremap_evict_done(paddr, as, false);
+		lock_release(vm_evict_lock);
+		return 0;
+	}
+	old = *pte;
+	KASSERT((old & (PTE_VALID | PTE_FRAME)) == (PTE_VALID | paddr));
+	*pte = PTE_EVICTING;
+	spinlock_release(&as->as_ptlock);
+
+	vm_shootdown(as);
+
+	result = clean ? 0 : swap_out(paddr, slot);
+
+	spinlock_acquire(&as->as_ptlock);
+	if (result) {
+		*pte = old;
+	}
+	else if (clean) {
+		*pte = 0;
+	}
+	else {
+		*pte = PTE_MKSWAP(slot) | (old & PTE_WRITE);
+	}
+	pt_wakeup(as);
+	spinlock_release(&as->as_ptlock);
+
+	if (result && !clean) {
+		swap_free(slot);
+	}
+	coremap_evict_done(paddr, as, result == 0);
+
+	lock_release(vm_evict_lock);
+	return result;
+}
+
+/*
+ * The pager thread: whenever free memory drops below the low
+ * watermark, evict until it is back above the high one.
+ */
+static
+void
+vm_pager(void *data1, unsigned long data2)
+{
+	(void)data1;
+	(void)data2;
+
+	while (1) {
+		coremap_pager_wait();
+		while (coremap_pager_wanted()) {
+			if (vm_evict_one()) {
+				break;
+			}
+		}
+	}
+}
+
+/*
+ * Allocate a (pinned) frame for the user page VADDR of AS, evicting
+ * something if necessary. Returns 0 if memory is exhausted.
+ */
+paddr_t
+vm_alloc_upage(struct addrspace *as, vaddr_t vaddr)
+{
+	paddr_t paddr;
+
+	while ((paddr = coremap_alloc_upage(as, vaddr)) == 0) {
+		if (!swap_enabled() || vm_evict_one() != 0) {
+			return 0;
+		}
+	}
+	return paddr;
+}
+
+/*
+ * Load the translation VADDR -> PTE of AS into the TLB. Call with
+ * as_ptlock held, so the pager can't be evicting the page.
+ */
+static
+void
+vm_tlb_load(struct addrspace *as, vaddr_t vaddr, pte_t pte)
+{
+	uint32_t elo;
+
+	KASSERT(pte & PTE_VALID);
+
+	elo = (pte & PTE_FRAME) | TLBLO_VALID;
+	if (pte & PTE_WRITE) {
+		elo |= TLBLO_DIRTY;
+	}
+	DEBUG(DB_VM, "vm: 0x%x -> 0x%x\n", vaddr, pte & PTE_FRAME);
+	vmtlb_load(vaddr, elo);
+	coremap_reference_upage(pte & PTE_FRAME, as, vaddr);
+}
+
+/*
+ * If *PTE is still OLD, replace it with NEW and load it into the TLB.
+ * Returns false if the pager got there first.
+ */
+static
+bool
+vm_pte_install(struct addrspace *as, vaddr_t vaddr, pte_t *pte,
+	       pte_t old, pte_t new)
+{
+	bool ok;
+
+	spinlock_acquire(&as->as_ptlock);
+	ok = *pte == old;
+	if (ok) {
+		*pte = new;
+		vm_tlb_load(as, vaddr, new);
+	}
+	spinlock_release(&as->as_ptlock);
+
+	return ok;
+}
+
+/*
+ * Read the swapped-out page OLD at VADDR into the pinned frame PADDR
+ * and install it as NEW, then free its swap slot.
+ *
+ * The entry is marked PTE_SWAPIN for the duration, so anyone else
+ * after the page (another fault, or pt_copy) waits in pt_wait until
+ * it is resident rather than reading the slot too; otherwise the
+ * slot could be freed and reused while they were still reading it.
+ */
+static
+int
+vm_swap_in(struct addrspace *as, vaddr_t vaddr, pte_t *pte, pte_t old,
+	   paddr_t paddr, pte_t new)
+{
+	bool claimed;
+	int result;
+
+	KASSERT(old & PTE_SWAPPED);
+
+	spinlock_acquire(&as->as_ptlock);
+	claimed = *pte == old;
+	if (claimed) {
+		*pte = old | PTE_SWAPIN;
+	}
+	spinlock_release(&as->as_ptlock);
+	if (!claimed) {
+		/* someone else got there first; fault again */
+		coremap_free_upage(paddr);
+		return 0;
+	}
+
+	result = swap_in(paddr, PTE_SLOT(old));
+
+	spinlock_acquire(&as->as_ptlock);
+	KASSERT(*pte == (old | PTE_SWAPIN));
+	if (result) {
+		*pte = old;
+	}
+	else {
+		*pte = new;
+		vm_tlb_load(as, vaddr, new);
+	}
+	pt_wakeup(as);
+	spinlock_release(&as->as_ptlock);
+
+	if (result) {
+		coremap_free_upage(paddr);
+		return result;
+	}
+	coremap_unpin_upage(paddr);
+
+	/* Nobody else can have been reading it */
+	swap_free(PTE_SLOT(old));
+	return 0;
+}
+
+/*
+ * Bring in the non-resident page OLD at VADDR: from swap if it was
+ * swapped out, otherwise zero-filled or from the executable.
+ */
+static
+int
+vm_page_in(struct addrspace *as, struct segment *seg, vaddr_t vaddr,
+	   pte_t *pte, pte_t old)
+{
+	paddr_t paddr;
+	pte_t new;
+	int result;
+
+	paddr = vm_alloc_upage(as, vaddr);
+	if (paddr == 0) {
+		return ENOMEM;
+	}
+
+	new = paddr | PTE_VALID;
+	if (seg->seg_perm & SEG_W) {
+		new |= PTE_WRITE;
+	}
+
+	if (old & PTE_SWAPPED) {
+		return vm_swap_in(as, vaddr, pte, old, paddr, new);
+	}
+
+	result = as_fill_page(as, vaddr, paddr);
+	if (result) {
+		coremap_free_upage(paddr);
+		return result;
+	}
+
+	if (!vm_pte_install(as, vaddr, pte, old, new)) {
+		coremap_free_upage(paddr);
+		return 0;
+	}
+	coremap_unpin_upage(paddr);
+	return 0;
+}
+
+/*
+ * Give AS its own writable copy of the copy-on-write page OLD at VADDR.
+ */
+static
+int
+vm_cow_break(struct addrspace *as, vaddr_t vaddr, pte_t *pte, pte_t old)
+{
+	paddr_t oldpaddr, newpaddr;
+	bool done;
+
+	KASSERT((old & (PTE_VALID | PTE_WRITE)) == PTE_VALID);
+	oldpaddr = old & PTE_FRAME;
+
+	/* If nobody else has it any more, just take it over. */
+	spinlock_acquire(&as->as_ptlock);
+	done = *pte != old;
+	if (!done && coremap_claim_upage(oldpaddr, as, vaddr)) {
+		*pte = old | PTE_WRITE;
+		vm_tlb_load(as, vaddr, *pte);
+		done = true;
+	}
+	spinlock_release(&as->as_ptlock);
+	if (done) {
+		return 0;
+	}
+
+	/*
+	 * Still shared, so it can't be evicted (the pager only takes
+	 * pages with an owner) and is safe to copy from.
+	 */
+	newpaddr = vm_alloc_upage(as, vaddr);
+	if (newpaddr == 0) {
+		return ENOMEM;
+	}
+	memmove((void *)PADDR_TO_KVADDR(newpaddr),
+		(const void *)PADDR_TO_KVADDR(oldpaddr), PAGE_SIZE);
+
+	if (!vm_pte_install(as, vaddr, pte, old,
+			    newpaddr | (old & ~PTE_FRAME) | PTE_WRITE)) {
+		coremap_free_upage(newpaddr);
+		return 0;
+	}
+	coremap_unpin_upage(newpaddr);
+	coremap_free_upage(oldpaddr);
+	return 0;
+}
+
+/*
+ * Fast path for the common case of a TLB miss on a page that is
+ * already resident with suitable permissions: load it straight from
+ * the page table, without looking at segments. Returns true if it
+ * handled the fault.
+ */
+static
+bool
+vm_tlb_reload(struct addrspace *as, int faulttype, vaddr_t faultaddress)
+{
+	pte_t *pte;
+	bool hit;
+	int spl;
+
+	if (faulttype == VM_FAULT_READONLY) {
+		return false;
+	}
+
+	pte = pt_lookup(as->as_pt, faultaddress, false);
+	if (pte == NULL) {
+		return false;
+	}
+
+	spinlock_acquire(&as->as_ptlock);
+	hit = (*pte & PTE_VALID) &&
+		(faulttype == VM_FAULT_READ || (*pte & PTE_WRITE));
+	if (hit) {
+		vm_tlb_load(as, faultaddress, *pte);
+	}
+	spinlock_release(&as->as_ptlock);
+
+	if (hit) {
+		spl = splhigh();
+		curcpu->c_tlbreloads++;
+		splx(spl);
+	}
+	return hit;
+}
+
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+	struct addrspace *as;
+	struct segment *seg;
+	pte_t *pte, old;
+	int spl;
+
+	faultaddress &= PAGE_FRAME;
+
+	DEBUG(DB_VM, "vm: fault: 0x%x\n", faultaddress);
+
+	spl = splhigh();
+	curcpu->c_tlbfaults++;
+	splx(spl);
+
+	switch (faulttype) {
+	    case VM_FAULT_READONLY:
+	    case VM_FAULT_READ:
+	    case VM_FAULT_WRITE:
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	if (curproc == NULL) {
+		/*
+		 * No process. This is probably a kernel fault early
+		 * in boot. Return EFAULT so as to panic instead of
+		 * getting into an infinite faulting loop.
+		 */
+		return EFAULT;
+	}
+
+	as = proc_getas();
+	if (as == NULL) {
+		/*
+		 * No address space set up. This is probably also a
+		 * kernel fault early in boot.
+		 */
+		return EFAULT;
+	}
+
+	if (faultaddress < USERSPACETOP &&
+	    vm_tlb_reload(as, faulttype, faultaddress)) {
+		return 0;
+	}
+
+	seg = as_find_segment(as, faultaddress);
+	if (seg == NULL) {
+		return EFAULT;
+	}
+	if (faulttype != VM_FAULT_READ && (seg->seg_perm & SEG_W) == 0) {
+		return EFAULT;
+	}
+
+	pte = pt_lookup(as->as_pt, faultaddress, true);
+	if (pte == NULL) {
+		return ENOMEM;
+	}
+
+	spinlock_acquire(&as->as_ptlock);
+	pt_wait(as, pte);
+	old = *pte;
+	spinlock_release(&as->as_ptlock);
+
+	if ((old & PTE_VALID) == 0) {
+		return vm_page_in(as, seg, faultaddress, pte, old);
+	}
+	if (faulttype != VM_FAULT_READ && (old & PTE_WRITE) == 0) {
+		return vm_cow_break(as, faultaddress, pte, old);
+	}
+	vm_pte_install(as, faultaddress, pte, old, old);
+	return 0;
+}
+
+/*
+ * Print each cpu's TLB counters. They are read without any locking,
+ * so they may be slightly stale.
+ */
+void
+vm_printtlbstats(void)
+{
+	struct cpu *c;
+	unsigned i;
+
+	kprintf("cpu     faults    reloads  evictions  invalidations\n");
+	for (i=0; i<cpu_count(); i++) {
+		c = cpu_get(i);
+		kprintf("%3u %10u %10u %10u %14u\n", c->c_number,
+			c->c_tlbfaults, c->c_tlbreloads, c->c_tlbevictions,
+			c->c_tlbinvalidations);
+	}
+}